@@ -0,0 +1,29 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+
+// pretend the board booted a second ago: src/ uses 0 as "timer disabled", so millis() must not start at 0
+static const auto startTime = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+
+HardwareSerial Serial(0);
+
+uint32_t millis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+uint32_t micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {
+    std::this_thread::yield();
+}
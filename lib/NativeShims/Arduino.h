@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * Host stand-in for the Arduino-ESP32 core.
+ * Covers just enough for src/devices, src/Job and src/bench to build with `pio run -e native`.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "WString.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define log_printf(...)  printf(__VA_ARGS__)
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+inline bool isDigit(char c) { return isdigit((unsigned char)c) != 0; }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Stream.h"
+
+/**
+ * Host console. Output goes to stdout, nothing is ever received.
+ */
+class HardwareSerial : public Stream {
+public:
+    HardwareSerial(int uart_nr) : uart_nr(uart_nr) {}
+
+    void begin(unsigned long baud) { this->baud = baud; }
+    void end() {}
+    void updateBaudRate(unsigned long baud) { this->baud = baud; }
+    uint32_t baudRate() { return baud; }
+
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+    size_t write(uint8_t c) override { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *buf, size_t size) override { return fwrite(buf, 1, size, stdout); }
+    using Print::write;
+
+    void flush() override { fflush(stdout); }
+
+private:
+    int uart_nr;
+    unsigned long baud = 0;
+};
+
+extern HardwareSerial Serial;
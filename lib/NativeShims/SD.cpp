@@ -0,0 +1,145 @@
+#include "SD.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+struct FileImpl {
+    std::string path;
+    std::string hostPath;
+    FILE* f = nullptr;
+    DIR* dir = nullptr;
+    size_t fileSize = 0;
+
+    ~FileImpl() {
+        if(f) fclose(f);
+        if(dir) closedir(dir);
+    }
+};
+
+SDFS SD;
+
+bool SDFS::begin(uint8_t) {
+    const char* r = getenv("SD_ROOT");
+    return begin(r!=nullptr ? r : ".");
+}
+
+bool SDFS::begin(const char* r) {
+    root = r;
+    if(!root.empty() && root.back()=='/') root.pop_back();
+    struct stat st;
+    return stat(root.c_str(), &st)==0 && S_ISDIR(st.st_mode);
+}
+
+std::string SDFS::hostPath(const char* path) const {
+    std::string r = root.empty() ? std::string(".") : root;
+    if(path[0]!='/') r += '/';
+    return r + path;
+}
+
+File SDFS::open(const char* path, const char* mode) {
+    auto impl = std::make_shared<FileImpl>();
+    impl->path = path;
+    impl->hostPath = hostPath(path);
+    struct stat st;
+    bool exists = stat(impl->hostPath.c_str(), &st)==0;
+    if(exists && S_ISDIR(st.st_mode)) {
+        impl->dir = opendir(impl->hostPath.c_str());
+        if(impl->dir==nullptr) return File();
+        return File(impl);
+    }
+    if(!exists && mode[0]=='r') return File();
+    impl->f = fopen(impl->hostPath.c_str(), mode[0]=='r' ? "rb" : mode[0]=='a' ? "ab" : "wb");
+    if(impl->f==nullptr) return File();
+    impl->fileSize = exists ? st.st_size : 0;
+    return File(impl);
+}
+
+bool SDFS::exists(const char* path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st)==0;
+}
+
+bool SDFS::remove(const char* path) {
+    return ::remove(hostPath(path).c_str())==0;
+}
+
+bool SDFS::rename(const char* from, const char* to) {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str())==0;
+}
+
+bool SDFS::mkdir(const char* path) {
+    return ::mkdir(hostPath(path).c_str(), 0755)==0;
+}
+
+
+size_t File::write(uint8_t c) { return write(&c, 1); }
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    if(!impl || !impl->f) return 0;
+    size_t n = fwrite(buf, 1, size, impl->f);
+    long p = ftell(impl->f);
+    if(p>0 && (size_t)p>impl->fileSize) impl->fileSize = p;
+    return n;
+}
+
+int File::available() {
+    if(!impl || !impl->f) return 0;
+    return impl->fileSize - position();
+}
+
+int File::read() {
+    uint8_t c;
+    return read(&c, 1)==1 ? c : -1;
+}
+
+int File::peek() {
+    if(!impl || !impl->f) return -1;
+    int c = fgetc(impl->f);
+    if(c!=EOF) ungetc(c, impl->f);
+    return c==EOF ? -1 : c;
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+    if(!impl || !impl->f) return 0;
+    return fread(buf, 1, size, impl->f);
+}
+
+void File::flush() { if(impl && impl->f) fflush(impl->f); }
+
+bool File::seek(uint32_t pos) {
+    if(!impl || !impl->f) return false;
+    return fseek(impl->f, pos, SEEK_SET)==0;
+}
+
+size_t File::position() const {
+    if(!impl || !impl->f) return 0;
+    long p = ftell(impl->f);
+    return p<0 ? 0 : p;
+}
+
+size_t File::size() const { return impl ? impl->fileSize : 0; }
+
+void File::close() { impl.reset(); }
+
+const char* File::name() const { return impl ? impl->path.c_str() : ""; }
+
+bool File::isDirectory() const { return impl && impl->dir!=nullptr; }
+
+File File::openNextFile(const char* mode) {
+    if(!impl || !impl->dir) return File();
+    struct dirent* e;
+    while( (e = readdir(impl->dir)) != nullptr ) {
+        if(strcmp(e->d_name, ".")==0 || strcmp(e->d_name, "..")==0) continue;
+        std::string p = impl->path;
+        if(p.empty() || p.back()!='/') p += '/';
+        return SD.open((p + e->d_name).c_str(), mode);
+    }
+    return File();
+}
+
+void File::rewindDirectory() { if(impl && impl->dir) rewinddir(impl->dir); }
+
+File::operator bool() const { return (bool)impl; }
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+
+#include "Arduino.h"
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+struct FileImpl;
+
+/**
+ * SD card file backed by a host file or directory.
+ * Paths are relative to SD.begin() root (or $SD_ROOT, or the current directory).
+ */
+class File : public Stream {
+public:
+    File() {}
+    File(std::shared_ptr<FileImpl> impl): impl(impl) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t* buf, size_t size);
+    size_t read(char* buf, size_t size) { return read((uint8_t*)buf, size); }
+    void flush() override;
+
+    bool seek(uint32_t pos);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    const char* name() const;
+
+    bool isDirectory() const;
+    File openNextFile(const char* mode = FILE_READ);
+    void rewindDirectory();
+
+    operator bool() const;
+
+private:
+    std::shared_ptr<FileImpl> impl;
+};
+
+class SDFS {
+public:
+    bool begin(uint8_t ssPin=0);
+    bool begin(const char* root);
+
+    File open(const char* path, const char* mode = FILE_READ);
+    File open(const String &path, const char* mode = FILE_READ) { return open(path.c_str(), mode); }
+    bool exists(const char* path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to);
+    bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+    bool mkdir(const char* path);
+    bool mkdir(const String &path) { return mkdir(path.c_str()); }
+
+    std::string hostPath(const char* path) const;
+
+private:
+    std::string root;
+};
+
+extern SDFS SD;
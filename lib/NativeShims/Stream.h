@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WString.h"
+
+uint32_t millis();
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while(size--) n += write(*buf++);
+        return n;
+    }
+    size_t write(const char *buf, size_t size) { return write((const uint8_t*)buf, size); }
+    size_t write(const char *str) { return str==nullptr ? 0 : write(str, strlen(str)); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned int v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(double v, int digits=2) { return printf("%.*f", digits, v); }
+
+    size_t println() { return write("\r\n"); }
+    template<typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+
+    size_t printf(const char *fmt, ...) __attribute__ ((format (printf, 2, 3))) {
+        char buf[256];
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if(len<0) return 0;
+        if((size_t)len>=sizeof(buf)) len = sizeof(buf)-1;
+        return write(buf, len);
+    }
+
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long t) { timeout = t; }
+
+    size_t readBytes(char *buffer, size_t length) {
+        size_t count = 0;
+        while(count<length) {
+            int c = timedRead();
+            if(c<0) break;
+            *buffer++ = (char)c;
+            count++;
+        }
+        return count;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    String readString() {
+        String ret;
+        int c;
+        while((c = timedRead()) >= 0) ret += (char)c;
+        return ret;
+    }
+
+protected:
+    unsigned long timeout = 1000;
+
+    int timedRead() {
+        uint32_t start = millis();
+        do {
+            int c = read();
+            if(c>=0) return c;
+        } while(millis()-start < timeout);
+        return -1;
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * Subset of Arduino String, backed by std::string.
+ * Only what src/devices and src/Job use is implemented.
+ */
+class String {
+public:
+    String() {}
+    String(const char *s): s(s!=nullptr ? s : "") {}
+    String(const char *s, size_t len): s(s, len) {}
+    String(const std::string &s): s(s) {}
+    explicit String(char c): s(1, c) {}
+    explicit String(int v) : s(std::to_string(v)) {}
+    explicit String(unsigned int v) : s(std::to_string(v)) {}
+    explicit String(long v) : s(std::to_string(v)) {}
+    explicit String(unsigned long v) : s(std::to_string(v)) {}
+    explicit String(float v, unsigned int decimals=2) { fromFloat(v, decimals); }
+    explicit String(double v, unsigned int decimals=2) { fromFloat(v, decimals); }
+
+    const char* c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+    bool reserve(unsigned int size) { s.reserve(size); return true; }
+
+    // Arduino String is "true" whenever its buffer is allocated, i.e. almost always
+    explicit operator bool() const { return true; }
+
+    char charAt(unsigned int i) const { return i<s.length() ? s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char& operator[](unsigned int i) { return s[i]; }
+
+    String& operator+=(const String &o) { s += o.s; return *this; }
+    String& operator+=(const char *o) { s += o; return *this; }
+    String& operator+=(char c) { s += c; return *this; }
+    String& operator+=(int v) { s += std::to_string(v); return *this; }
+    String& operator+=(unsigned int v) { s += std::to_string(v); return *this; }
+    String& operator+=(long v) { s += std::to_string(v); return *this; }
+    String& operator+=(unsigned long v) { s += std::to_string(v); return *this; }
+    bool concat(const String &o) { s += o.s; return true; }
+
+    bool operator==(const String &o) const { return s==o.s; }
+    bool operator==(const char *o) const { return s==o; }
+    bool operator!=(const String &o) const { return s!=o.s; }
+    bool operator!=(const char *o) const { return s!=o; }
+    bool operator<(const String &o) const { return s<o.s; }
+
+    int indexOf(char c, unsigned int from=0) const { return pos(s.find(c, from)); }
+    int indexOf(const String &str, unsigned int from=0) const { return pos(s.find(str.s, from)); }
+    int lastIndexOf(char c) const { return pos(s.rfind(c)); }
+    int lastIndexOf(const String &str) const { return pos(s.rfind(str.s)); }
+
+    String substring(unsigned int from) const { return from<s.length() ? String(s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if(from>to) std::swap(from, to);
+        if(from>=s.length()) return String();
+        return String(s.substr(from, to-from));
+    }
+
+    bool startsWith(const String &pre) const { return s.compare(0, pre.s.length(), pre.s)==0; }
+    bool endsWith(const String &suf) const {
+        return s.length()>=suf.s.length() && s.compare(s.length()-suf.s.length(), suf.s.length(), suf.s)==0;
+    }
+
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+
+    void trim() {
+        size_t b = 0, e = s.length();
+        while(b<e && isspace((unsigned char)s[b])) b++;
+        while(e>b && isspace((unsigned char)s[e-1])) e--;
+        s = s.substr(b, e-b);
+    }
+    void toLowerCase() { for(auto &c: s) c = tolower((unsigned char)c); }
+    void toUpperCase() { for(auto &c: s) c = toupper((unsigned char)c); }
+
+    friend String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+    friend String operator+(const String &a, const char *b) { return String(a.s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b.s); }
+    friend String operator+(const String &a, char b) { return String(a.s + b); }
+    friend String operator+(char a, const String &b) { return String(a + b.s); }
+    friend String operator+(const String &a, int b) { return String(a.s + std::to_string(b)); }
+    friend String operator+(const String &a, unsigned int b) { return String(a.s + std::to_string(b)); }
+    friend String operator+(const String &a, long b) { return String(a.s + std::to_string(b)); }
+    friend String operator+(const String &a, unsigned long b) { return String(a.s + std::to_string(b)); }
+
+private:
+    std::string s;
+
+    static int pos(size_t p) { return p==std::string::npos ? -1 : (int)p; }
+
+    void fromFloat(double v, unsigned int decimals) {
+        char buf[40]; snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+        s = buf;
+    }
+};
@@ -0,0 +1,154 @@
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <string.h>
+#include <thread>
+
+struct TaskShim {
+    std::mutex m;
+    std::condition_variable cv;
+    uint32_t notifications = 0;
+};
+
+static thread_local TaskShim *currentTask = nullptr;
+
+TaskHandle_t xTaskGetCurrentTaskHandle( void ) {
+    // threads not started through xTaskCreatePinnedToCore (e.g. main) get a handle on first use
+    if(currentTask == nullptr) currentTask = new TaskShim();
+    return currentTask;
+}
+
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t pvTaskCode, const char * const pcName, const uint32_t usStackDepth,
+        void * const pvParameters, UBaseType_t uxPriority, TaskHandle_t * const pvCreatedTask, const BaseType_t xCoreID ) {
+    TaskShim *task = new TaskShim();
+    if(pvCreatedTask != nullptr) *pvCreatedTask = task;
+    std::thread([=]() {
+        currentTask = task;
+        pvTaskCode(pvParameters);
+    }).detach();
+    return pdPASS;
+}
+
+void vTaskDelete( TaskHandle_t xTaskToDelete ) {
+    // the thread ends when its function returns
+}
+
+void vTaskDelay( const TickType_t xTicksToDelay ) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(xTicksToDelay * portTICK_PERIOD_MS));
+}
+
+BaseType_t xTaskNotifyGive( TaskHandle_t xTaskToNotify ) {
+    {
+        std::lock_guard<std::mutex> lock(xTaskToNotify->m);
+        xTaskToNotify->notifications++;
+    }
+    xTaskToNotify->cv.notify_one();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake( BaseType_t xClearCountOnExit, TickType_t xTicksToWait ) {
+    TaskShim *task = xTaskGetCurrentTaskHandle();
+    std::unique_lock<std::mutex> lock(task->m);
+    auto hasNotification = [task]() { return task->notifications != 0; };
+    if(xTicksToWait == portMAX_DELAY) task->cv.wait(lock, hasNotification);
+    else task->cv.wait_for(lock, std::chrono::milliseconds(xTicksToWait * portTICK_PERIOD_MS), hasNotification);
+    uint32_t ret = task->notifications;
+    if(ret != 0) task->notifications = xClearCountOnExit ? 0 : ret-1;
+    return ret;
+}
+
+static_assert(sizeof(std::timed_mutex) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+
+SemaphoreHandle_t xSemaphoreCreateMutex( void ) {
+    return new std::timed_mutex();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic( StaticSemaphore_t *pxMutexBuffer ) {
+    return new (pxMutexBuffer->impl) std::timed_mutex();
+}
+
+BaseType_t xSemaphoreTake( SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait ) {
+    std::timed_mutex *m = static_cast<std::timed_mutex*>(xSemaphore);
+    if(xTicksToWait == portMAX_DELAY) { m->lock(); return pdTRUE; }
+    return m->try_lock_for(std::chrono::milliseconds(xTicksToWait * portTICK_PERIOD_MS)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive( SemaphoreHandle_t xSemaphore ) {
+    static_cast<std::timed_mutex*>(xSemaphore)->unlock();
+    return pdTRUE;
+}
+
+namespace {
+
+struct Queue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint8_t *data;
+    size_t length, itemSize;
+    size_t head = 0, count = 0;
+
+    Queue(size_t length, size_t itemSize): data(new uint8_t[length*itemSize]), length(length), itemSize(itemSize) {}
+    ~Queue() { delete[] data; }
+
+    template<typename Pred>
+    bool wait(std::unique_lock<std::mutex> &lock, TickType_t ticks, Pred ready) {
+        if(ticks == portMAX_DELAY) { changed.wait(lock, ready); return true; }
+        return changed.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), ready);
+    }
+};
+
+}
+
+QueueHandle_t xQueueCreate( UBaseType_t uxQueueLength, UBaseType_t uxItemSize ) {
+    return new Queue(uxQueueLength, uxItemSize);
+}
+
+void vQueueDelete( QueueHandle_t xQueue ) {
+    delete static_cast<Queue*>(xQueue);
+}
+
+BaseType_t xQueueSend( QueueHandle_t xQueue, const void * pvItemToQueue, TickType_t xTicksToWait ) {
+    Queue *q = static_cast<Queue*>(xQueue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if(!q->wait(lock, xTicksToWait, [q]() { return q->count < q->length; })) return pdFAIL;
+    memcpy(q->data + (q->head + q->count) % q->length * q->itemSize, pvItemToQueue, q->itemSize);
+    q->count++;
+    q->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive( QueueHandle_t xQueue, void * pvBuffer, TickType_t xTicksToWait ) {
+    Queue *q = static_cast<Queue*>(xQueue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if(!q->wait(lock, xTicksToWait, [q]() { return q->count > 0; })) return pdFAIL;
+    memcpy(pvBuffer, q->data + q->head * q->itemSize, q->itemSize);
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    q->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReset( QueueHandle_t xQueue ) {
+    Queue *q = static_cast<Queue*>(xQueue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->head = q->count = 0;
+    q->changed.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting( const QueueHandle_t xQueue ) {
+    Queue *q = static_cast<Queue*>(xQueue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable( const QueueHandle_t xQueue ) {
+    Queue *q = static_cast<Queue*>(xQueue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->length - q->count;
+}
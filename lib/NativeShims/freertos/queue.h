@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * Host implementation of the FreeRTOS queue API used in src/.
+ * Fixed-size items copied in and out under a mutex; send and receive block up to their timeout.
+ */
+
+#include <freertos/FreeRTOS.h>
+
+typedef void * QueueHandle_t;
+
+QueueHandle_t xQueueCreate( UBaseType_t uxQueueLength, UBaseType_t uxItemSize );
+void vQueueDelete( QueueHandle_t xQueue );
+BaseType_t xQueueSend( QueueHandle_t xQueue, const void * pvItemToQueue, TickType_t xTicksToWait );
+BaseType_t xQueueReceive( QueueHandle_t xQueue, void * pvBuffer, TickType_t xTicksToWait );
+BaseType_t xQueueReset( QueueHandle_t xQueue );
+UBaseType_t uxQueueMessagesWaiting( const QueueHandle_t xQueue );
+UBaseType_t uxQueueSpacesAvailable( const QueueHandle_t xQueue );
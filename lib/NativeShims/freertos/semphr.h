@@ -0,0 +1,18 @@
+#pragma once
+
+/*
+ * Host implementation of FreeRTOS mutexes, backed by std::timed_mutex.
+ */
+
+#include <freertos/FreeRTOS.h>
+
+typedef void * SemaphoreHandle_t;
+
+typedef struct {
+    alignas(8) uint8_t impl[64];
+} StaticSemaphore_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex( void );
+SemaphoreHandle_t xSemaphoreCreateMutexStatic( StaticSemaphore_t *pxMutexBuffer );
+BaseType_t xSemaphoreTake( SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait );
+BaseType_t xSemaphoreGive( SemaphoreHandle_t xSemaphore );
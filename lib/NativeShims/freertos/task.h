@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+ * Host implementation of the FreeRTOS task API used in src/.
+ * Tasks are detached std::threads; core and priority are ignored.
+ * Direct-to-task notifications are a counter per thread.
+ */
+
+#include <freertos/FreeRTOS.h>
+
+struct TaskShim;
+typedef TaskShim * TaskHandle_t;
+typedef void (*TaskFunction_t)( void * );
+
+BaseType_t xTaskCreatePinnedToCore( TaskFunction_t pvTaskCode, const char * const pcName, const uint32_t usStackDepth,
+    void * const pvParameters, UBaseType_t uxPriority, TaskHandle_t * const pvCreatedTask, const BaseType_t xCoreID );
+void vTaskDelete( TaskHandle_t xTaskToDelete );
+void vTaskDelay( const TickType_t xTicksToDelay );
+TaskHandle_t xTaskGetCurrentTaskHandle( void );
+
+BaseType_t xTaskNotifyGive( TaskHandle_t xTaskToNotify );
+uint32_t ulTaskNotifyTake( BaseType_t xClearCountOnExit, TickType_t xTicksToWait );
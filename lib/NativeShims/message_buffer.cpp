@@ -0,0 +1,94 @@
+#include "message_buffer.h"
+
+#include <string.h>
+
+#include <mutex>
+#include <new>
+
+namespace {
+
+/** Byte ring storing [uint32 length][payload] records, like FreeRTOS stream buffers. */
+struct MessageBuffer {
+    std::mutex mutex;
+    uint8_t *data;
+    size_t size;
+    size_t head = 0, tail = 0, used = 0;
+    bool owned;
+
+    MessageBuffer(uint8_t *storage, size_t size, bool owned): data(storage), size(size), owned(owned) {}
+    ~MessageBuffer() { if(owned) delete[] data; }
+
+    void put(const uint8_t *src, size_t len) {
+        for(size_t i=0; i<len; i++) { data[head] = src[i]; head = (head+1) % size; }
+        used += len;
+    }
+    void get(uint8_t *dst, size_t len) {
+        for(size_t i=0; i<len; i++) { if(dst) dst[i] = data[tail]; tail = (tail+1) % size; }
+        used -= len;
+    }
+    void peekLen(uint32_t &len) {
+        size_t t = tail;
+        uint8_t *d = (uint8_t*)&len;
+        for(size_t i=0; i<sizeof(len); i++) { d[i] = data[t]; t = (t+1) % size; }
+    }
+};
+
+static_assert(sizeof(MessageBuffer) <= sizeof(StaticMessageBuffer_t), "StaticMessageBuffer_t too small");
+
+const size_t HEADER = sizeof(uint32_t);
+
+}
+
+MessageBufferHandle_t xMessageBufferCreate( size_t xBufferSizeBytes ) {
+    return new MessageBuffer(new uint8_t[xBufferSizeBytes], xBufferSizeBytes, true);
+}
+
+MessageBufferHandle_t xMessageBufferCreateStatic( size_t xBufferSizeBytes, uint8_t *pucStorage, StaticMessageBuffer_t *pxStatic ) {
+    return new (pxStatic) MessageBuffer(pucStorage, xBufferSizeBytes, false);
+}
+
+void vMessageBufferDelete( MessageBufferHandle_t h ) {
+    MessageBuffer *b = (MessageBuffer*)h;
+    if(b->owned) delete b; else b->~MessageBuffer();
+}
+
+size_t xMessageBufferSend( MessageBufferHandle_t h, const void *pvTxData, size_t len, TickType_t ) {
+    MessageBuffer *b = (MessageBuffer*)h;
+    std::lock_guard<std::mutex> lock(b->mutex);
+    if(b->size - b->used < len + HEADER) return 0;
+    uint32_t l = len;
+    b->put((const uint8_t*)&l, HEADER);
+    b->put((const uint8_t*)pvTxData, len);
+    return len;
+}
+
+size_t xMessageBufferReceive( MessageBufferHandle_t h, void *pvRxData, size_t xBufferLengthBytes, TickType_t ) {
+    MessageBuffer *b = (MessageBuffer*)h;
+    std::lock_guard<std::mutex> lock(b->mutex);
+    if(b->used < HEADER) return 0;
+    uint32_t len;
+    b->peekLen(len);
+    if(len > xBufferLengthBytes) return 0; // leave it in the buffer, as FreeRTOS does
+    b->get(nullptr, HEADER);
+    b->get((uint8_t*)pvRxData, len);
+    return len;
+}
+
+BaseType_t xMessageBufferReset( MessageBufferHandle_t h ) {
+    MessageBuffer *b = (MessageBuffer*)h;
+    std::lock_guard<std::mutex> lock(b->mutex);
+    b->head = b->tail = b->used = 0;
+    return pdPASS;
+}
+
+size_t xMessageBufferSpaceAvailable( MessageBufferHandle_t h ) {
+    MessageBuffer *b = (MessageBuffer*)h;
+    std::lock_guard<std::mutex> lock(b->mutex);
+    return b->size - b->used;
+}
+
+BaseType_t xMessageBufferIsEmpty( MessageBufferHandle_t h ) {
+    MessageBuffer *b = (MessageBuffer*)h;
+    std::lock_guard<std::mutex> lock(b->mutex);
+    return b->used==0 ? pdTRUE : pdFALSE;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Host implementation of the FreeRTOS message buffer API used in src/.
+ * Same space accounting as on the ESP32 (4-byte length header per message),
+ * guarded by a mutex instead of a critical section. Timeouts are ignored.
+ */
+
+#include <freertos/FreeRTOS.h>
+
+typedef void * MessageBufferHandle_t;
+
+typedef struct {
+    uint8_t impl[128];
+} StaticMessageBuffer_t;
+
+MessageBufferHandle_t xMessageBufferCreate( size_t xBufferSizeBytes );
+MessageBufferHandle_t xMessageBufferCreateStatic( size_t xBufferSizeBytes, uint8_t *pucStorage, StaticMessageBuffer_t *pxStatic );
+void vMessageBufferDelete( MessageBufferHandle_t xMessageBuffer );
+size_t xMessageBufferSend( MessageBufferHandle_t xMessageBuffer, const void *pvTxData, size_t xDataLengthBytes, TickType_t xTicksToWait );
+size_t xMessageBufferReceive( MessageBufferHandle_t xMessageBuffer, void *pvRxData, size_t xBufferLengthBytes, TickType_t xTicksToWait );
+BaseType_t xMessageBufferReset( MessageBufferHandle_t xMessageBuffer );
+size_t xMessageBufferSpaceAvailable( MessageBufferHandle_t xMessageBuffer );
+BaseType_t xMessageBufferIsEmpty( MessageBufferHandle_t xMessageBuffer );
+
+#define xMessageBufferSpacesAvailable( xMessageBuffer ) xMessageBufferSpaceAvailable( xMessageBuffer )
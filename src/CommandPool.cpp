@@ -0,0 +1,5 @@
+#include "CommandPool.h"
+
+CommandPool CommandPool::pool;
+
+CommandPool& CommandPool::getPool() { return pool; }
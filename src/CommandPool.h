@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+typedef uint8_t CommandHandle;
+
+/**
+ * Fixed slots for G-code lines on their way to the device.
+ *
+ * A line is written into a slot once, by whoever schedules it, and then only its
+ * handle travels through the device queues and the sent queue. 
+ * Whoever holds a handle owns the slot until it is passed on or freed.
+ * alloc() and free() are lock-free and can be called from any task.
+ */
+class CommandPool {
+public:
+
+    static const size_t SIZE = 128;
+    static const size_t MAX_LINE = 96;
+    static const CommandHandle NONE = 0xFF;
+
+    static CommandPool& getPool();
+
+    CommandPool() {
+        for(auto &w: freeMask) w = 0xFFFFFFFF;
+    }
+
+    /// @return handle of a free slot or NONE
+    CommandHandle alloc() {
+        for(size_t i=0; i<WORDS; i++) {
+            uint32_t w = freeMask[i].load(std::memory_order_relaxed);
+            while(w != 0) {
+                uint32_t bit = w & (~w+1);
+                if(freeMask[i].compare_exchange_weak(w, w & ~bit, std::memory_order_acquire)) {
+                    return i*32 + __builtin_ctz(bit);
+                }
+            }
+        }
+        return NONE;
+    }
+
+    /// Allocates a slot and copies the line into it (truncated to MAX_LINE)
+    CommandHandle alloc(const char* str, size_t len) {
+        CommandHandle h = alloc();
+        if(h==NONE) return NONE;
+        if(len > MAX_LINE) len = MAX_LINE;
+        memcpy(slots[h].text, str, len);
+        slots[h].text[len] = 0;
+        slots[h].len = len;
+        return h;
+    }
+
+    void free(CommandHandle h) {
+        if(h==NONE) return;
+        freeMask[h/32].fetch_or(1u << (h%32), std::memory_order_release);
+    }
+
+    char* text(CommandHandle h) { return slots[h].text; }
+    size_t length(CommandHandle h) { return slots[h].len; }
+    void setLength(CommandHandle h, size_t len) { slots[h].len = len; }
+
+    size_t getFree() const {
+        size_t n = 0;
+        for(const auto &w: freeMask) n += __builtin_popcount(w.load(std::memory_order_relaxed));
+        return n;
+    }
+
+private:
+    static const size_t WORDS = SIZE/32;
+
+    struct Slot {
+        uint8_t len;
+        char text[MAX_LINE+1];
+    };
+
+    Slot slots[SIZE];
+    std::atomic<uint32_t> freeMask[WORDS];
+
+    static CommandPool pool;
+};
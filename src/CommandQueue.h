@@ -2,16 +2,22 @@
 
 
 #include <Arduino.h>
-#include <message_buffer.h>
 #include <etl/queue.h>
 
+#include "CommandPool.h"
+
+/**
+ * Lines sent to the device and not yet acknowledged.
+ * push() takes ownership of the command: it is freed once the queue no longer needs its text.
+ * extraBytes are sent along with the command text (line number, checksum) and count towards the byte limit.
+ */
 class Counter {
 public:
     virtual void clear() = 0;
 
     virtual bool canPush(size_t len) const = 0;
 
-    virtual bool push(char* msg, size_t len) = 0;
+    virtual bool push(CommandHandle cmd, size_t extraBytes=0, uint32_t lineNumber=0) = 0;
 
     virtual size_t size() const = 0;
 
@@ -27,43 +33,49 @@ public:
 };
 
 
-template< uint16_t LEN_LINES = 16, uint16_t LEN_BYTES = 128, uint8_t MAX_LINE_LEN = 100 >
+/**
+ * Keeps the sent commands themselves, e.g. to look at the command an `ok` belongs to,
+ * or to send them again.
+ */
+template< uint16_t LEN_LINES = 16, uint16_t LEN_BYTES = 128 >
 class SizedQueue: public Counter {
 public:
+
+    struct Entry {
+        CommandHandle cmd;
+        uint8_t bytes;
+        uint32_t lineNumber;
+    };
+
     SizedQueue() {
-        freeLines = LEN_LINES;
+        first = 0;
+        count = 0;
         freeBytes = LEN_BYTES;
-        buf = xMessageBufferCreateStatic(LEN_BYTES, data, &bufStruct);
     }
 
     void clear() override {
-        xMessageBufferReset(buf);
-        havePeekedLine = false;
-        peekedLineLen = 0;
-        freeLines = LEN_LINES;
-        freeBytes = LEN_BYTES;
+        while(count!=0) pop();
     }
 
     bool canPush(size_t len) const override {
-        if(len>MAX_LINE_LEN) len = MAX_LINE_LEN;
-        return freeBytes>len+1 && freeLines>0;
+        return freeBytes>len && count<LEN_LINES;
     }
 
-    bool push(char* msg, size_t len)  override  {
+    bool push(CommandHandle cmd, size_t extraBytes=0, uint32_t lineNumber=0)  override  {
+        size_t len = CommandPool::getPool().length(cmd) + extraBytes;
         if(!canPush(len)) return false;
-        if(len>MAX_LINE_LEN) len = MAX_LINE_LEN;
-        assert( xMessageBufferSend(buf, msg, len, 0) );
-        freeLines --;
+        entries[(first+count) % LEN_LINES] = Entry{cmd, (uint8_t)(len+1), lineNumber};
+        count++;
         freeBytes -= len+1;
         return true;
     }
 
     inline size_t size() const override  {
-        return LEN_LINES-freeLines;
+        return count;
     }
 
     inline size_t getFreeLines() const override  {
-        return freeLines;
+        return LEN_LINES-count;
     }
 
     inline size_t bytes() const override  {
@@ -75,70 +87,81 @@ public:
     }
 
     size_t peek(char* &msg) override  {
-        if(size() == 0) return 0;
-        if(!havePeekedLine) {
-            loadLineFromBuf();
-        }
-        //len = peekedLineLen;
-        msg = peekedLine;
-        return peekedLineLen;
+        if(count==0) return 0;
+        msg = CommandPool::getPool().text(entries[first].cmd);
+        return CommandPool::getPool().length(entries[first].cmd);
     }
 
-    void pop()  override {
-        if(size() == 0) return;
-        freeLines ++;
-        if(havePeekedLine) {
-            freeBytes += peekedLineLen+1;
-            havePeekedLine = false;
-            peekedLineLen = 0;
-        } else {
-            size_t r = xMessageBufferReceive(buf, peekedLine, MAX_LINE_LEN, 0);
-            freeBytes += r+1;
-        }
+    /// i-th oldest unacknowledged line
+    const Entry& at(size_t i) const { return entries[(first+i) % LEN_LINES]; }
+    const Entry& back() const { return at(count-1); }
 
+    /// Drops the newest line without freeing its command, the caller takes it over
+    CommandHandle popBack() {
+        if(count==0) return CommandPool::NONE;
+        count--;
+        const Entry &e = at(count);
+        freeBytes += e.bytes;
+        return e.cmd;
     }
 
+    void pop()  override {
+        if(count==0) return;
+        const Entry &e = entries[first];
+        freeBytes += e.bytes;
+        CommandPool::getPool().free(e.cmd);
+        first = (first+1) % LEN_LINES;
+        count--;
+    }
 
-private:
-    MessageBufferHandle_t buf;
-    StaticMessageBuffer_t bufStruct;
-    uint8_t data[LEN_BYTES];
 
-    size_t freeLines;
+private:
+    Entry entries[LEN_LINES];
+    size_t first, count;
     size_t freeBytes;
-    char peekedLine[MAX_LINE_LEN+1];
-    size_t peekedLineLen;
-    bool havePeekedLine;
-
-    bool loadLineFromBuf() {
-        peekedLineLen = xMessageBufferReceive(buf, peekedLine, MAX_LINE_LEN, 0);
-        havePeekedLine = peekedLineLen>0;
-        peekedLine[peekedLineLen]=0;
-        return havePeekedLine;
-    }
 };
 
 
+/**
+ * Counts characters in the device RX buffer, does not store lines themselves
+ * (commands are freed as soon as they are pushed).
+ * Template arguments are the storage limits; actual capacity can be lowered (or
+ * set to what the device reports) at runtime with setCapacity().
+ */
 template< uint16_t LEN_LINES = 16, uint16_t LEN_BYTES = 128, uint8_t SUFFIX_LEN=1>
 class SimpleCounter : public Counter {
 public:
     SimpleCounter() {
+        maxLines = LEN_LINES;
+        maxBytes = LEN_BYTES;
         freeBytes = LEN_BYTES;
     }
 
+    void setCapacity(size_t lines, size_t bytes) {
+        if(lines>LEN_LINES) lines = LEN_LINES;
+        size_t used = maxBytes - freeBytes;
+        freeBytes = bytes>used ? bytes-used : 0;
+        maxLines = lines;
+        maxBytes = bytes;
+    }
+
+    size_t getCapacityBytes() const { return maxBytes; }
+
     void clear()  override {
         queue.clear();
-        freeBytes = LEN_BYTES;
+        freeBytes = maxBytes;
     }
 
     bool canPush(size_t len) const override {
-        return queue.size()<LEN_LINES && freeBytes >= len+SUFFIX_LEN;
+        return queue.size()<maxLines && freeBytes >= len+SUFFIX_LEN;
     }
 
-    bool push(char* msg, size_t len) override {
+    bool push(CommandHandle cmd, size_t extraBytes=0, uint32_t lineNumber=0) override {
+        size_t len = CommandPool::getPool().length(cmd) + extraBytes;
         if(!canPush(len)) return false;
         queue.push(len);
         freeBytes -= len+SUFFIX_LEN;
+        CommandPool::getPool().free(cmd);
         return true;
     }
 
@@ -147,11 +170,11 @@ public:
     }
 
     inline size_t getFreeLines() const  override {
-        return LEN_LINES - queue.size();
+        return maxLines - queue.size();
     }
 
     inline size_t bytes() const  override {
-        return LEN_BYTES-freeBytes;
+        return maxBytes-freeBytes;
     }
 
     inline size_t getFreeBytes() const  override {
@@ -174,5 +197,7 @@ public:
 
 private:
     etl::queue<size_t, LEN_LINES> queue;
+    size_t maxLines;
+    size_t maxBytes;
     size_t freeBytes;
-};
+};
\ No newline at end of file
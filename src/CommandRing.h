@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#ifdef ESP32
+    #define RING_CACHE_LINE 32
+#else
+    #define RING_CACHE_LINE 64
+#endif
+
+/**
+ * Bounded FIFO of small items (command handles) for one consumer task and one or, 
+ * with MULTI_PRODUCER, several producer tasks.
+ *
+ * N is the static capacity (a power of two); setLimit() can lower it at runtime.
+ * pop() is wait-free. push() is wait-free with a single producer; with several producers
+ * it retries a compare-and-swap while another producer is claiming the same position.
+ * Producer and consumer indices live on separate cache lines.
+ */
+template<typename T, size_t N, bool MULTI_PRODUCER = false>
+class CommandRing {
+    static_assert( (N & (N-1)) == 0, "CommandRing size must be a power of two");
+public:
+
+    CommandRing(): limit(N), head(0), tail(0) {
+        for(size_t i=0; i<N; i++) slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    void setLimit(size_t l) { limit = l<N ? l : N; }
+    size_t getLimit() const { return limit; }
+
+    /// Producer side. @return false if full
+    bool push(const T &v) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        while(true) {
+            if(h - tail.load(std::memory_order_acquire) >= limit) return false;
+            if(!MULTI_PRODUCER) {
+                head.store(h+1, std::memory_order_relaxed);
+                break;
+            }
+            if(head.compare_exchange_weak(h, h+1, std::memory_order_relaxed)) break;
+        }
+        Slot &s = slots[h & (N-1)];
+        s.value = v;
+        s.seq.store(h+1, std::memory_order_release); // publish
+        return true;
+    }
+
+    /// Consumer side. @return false if empty (or the oldest item is still being written)
+    bool pop(T &v) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        Slot &s = slots[t & (N-1)];
+        if(s.seq.load(std::memory_order_acquire) != t+1) return false;
+        v = s.value;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { 
+        uint32_t t = tail.load(std::memory_order_acquire);
+        return head.load(std::memory_order_acquire) - t;
+    }
+    bool empty() const { return size()==0; }
+    size_t spaceAvailable() const { size_t s = size(); return s<limit ? limit-s : 0; }
+    static constexpr size_t capacity() { return N; }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> seq;  // position+1 once the item at that position is written
+        T value;
+    };
+
+    Slot slots[N];
+    size_t limit;
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> head;
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> tail;
+};
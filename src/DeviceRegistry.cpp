@@ -0,0 +1,7 @@
+#include "DeviceRegistry.h"
+
+// constructed on first use, the jobs subscribe to the event bus
+DeviceRegistry& DeviceRegistry::get() {
+    static DeviceRegistry registry;
+    return registry;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "devices/GCodeDevice.h"
+#include "Job.h"
+
+/**
+ * Controllers the pendant is connected to, each with its own Job.
+ *
+ * Every device is driven by its own device task (Job::loop() and GCodeDevice::loop()) 
+ * and its job by its own reader task, so several devices stream at the same time.
+ * Slots are fixed by the serial port configuration; a slot's device is set once it is detected.
+ * The UI and the web server work with the selected device.
+ */
+class DeviceRegistry {
+public:
+
+    static const size_t MAX_DEVICES = 2;
+
+    static DeviceRegistry& get();
+
+    DeviceRegistry() {
+        for(size_t i=0; i<MAX_DEVICES; i++) jobs[i].setDevice(nullptr, i);
+    }
+
+    /// Number of configured slots; call before the device tasks start
+    void begin(size_t slots) { count = slots<MAX_DEVICES ? slots : MAX_DEVICES; }
+    size_t size() { return count; }
+
+    /// Storage for DeviceDetector to create the device of slot i in
+    DeviceDetector::DeviceBuffer& getDeviceBuffer(size_t i) { return buffers[i]; }
+
+    /** Sets the device of slot i, before its task starts calling loop() */
+    void setDevice(size_t i, GCodeDevice *dev) {
+        if(i>=MAX_DEVICES) return;
+        if(dev!=nullptr) dev->setId(i);
+        jobs[i].setDevice(dev, i);
+        devices[i] = dev;
+        if(count<=i) count = i+1;
+    }
+
+    /// nullptr while the slot's device is being detected
+    GCodeDevice* getDevice(size_t i) { return i<MAX_DEVICES ? devices[i].load() : nullptr; }
+    Job* getJob(size_t i) { return i<MAX_DEVICES ? &jobs[i] : nullptr; }
+
+    void select(size_t i) { if(i<count) selected = i; }
+    size_t getSelectedIndex() { return selected; }
+    GCodeDevice* getSelected() { return devices[selected].load(); }
+    /// Job of the selected device, there is one even if the device is not detected yet
+    Job* getSelectedJob() { return &jobs[selected]; }
+
+private:
+    std::atomic<GCodeDevice*> devices[MAX_DEVICES] = {};
+    Job jobs[MAX_DEVICES];
+    DeviceDetector::DeviceBuffer buffers[MAX_DEVICES];
+    std::atomic<size_t> count{0};
+    std::atomic<size_t> selected{0};
+};
@@ -0,0 +1,168 @@
+#include "DirCache.h"
+#include "GcbWriter.h"
+
+#define DC_DEBUGF(...) // { Serial.printf(__VA_ARGS__); }
+
+DirCache& DirCache::get() {
+    static DirCache cache;
+    return cache;
+}
+
+DirCache::DirCache() {
+    mutex = xSemaphoreCreateMutexStatic(&mutexBuf);
+}
+
+/// No trailing '/', except for the root
+static String normalize(const String &path) {
+    String p = path;
+    while(p.length()>1 && p.endsWith("/")) p = p.substring(0, p.length()-1);
+    if(p.length()==0) p = "/";
+    return p;
+}
+
+void DirCache::open(const String &dirPath) {
+    String p = normalize(dirPath);
+    lock();
+    bool cached = p==path && !failed;
+    if(!cached) {
+        large = false;
+        restart(p);
+    }
+    unlock();
+    if(!cached && loaderTask!=nullptr) xTaskNotifyGive(loaderTask);
+}
+
+void DirCache::invalidate(const String &file) {
+    int s = file.lastIndexOf('/');
+    String dir = normalize(s<=0 ? String("/") : file.substring(0, s));
+    lock();
+    bool cached = dir==path;
+    if(cached) {
+        // the window stays where it is, so a view keeps its place
+        large = false;
+        memset(total, 0, sizeof(total));
+        restart(dir, windowKinds, windowFirst);
+    }
+    unlock();
+    if(cached && loaderTask!=nullptr) xTaskNotifyGive(loaderTask);
+}
+
+bool DirCache::coversLocked(uint8_t kinds, size_t first, size_t n) {
+    if(complete && first >= sum(total, kinds)) return true;    // past the end
+    if(windowFirst==0 && !windowStarted) return true;
+    if((kinds & storedKinds()) != kinds) return false;
+    if(!windowStarted) return first>=windowFirst;
+    size_t lo = sum(before, kinds), in = 0;
+    for(size_t i=0; i<nEntries; i++) if(entries[i].kind & kinds) in++;
+    return first>=lo && (first+n <= lo+in || !full);
+}
+
+bool DirCache::want(uint8_t kinds, size_t first, size_t n) {
+    lock();
+    bool covered = coversLocked(kinds, first, n);
+    if(!covered) restart(path, kinds, first > WINDOW_BACK ? first - WINDOW_BACK : 0);
+    unlock();
+    if(!covered && loaderTask!=nullptr) xTaskNotifyGive(loaderTask);
+    return covered;
+}
+
+void DirCache::restart(const String &dirPath, uint8_t kinds, size_t first) {
+    if(dirPath!=path) memset(total, 0, sizeof(total));
+    path = dirPath;
+    windowKinds = kinds;
+    windowFirst = first;
+    windowStarted = false;
+    windowStart = 0;
+    nEntries = poolLen = sortedCount = 0;
+    complete = full = failed = false;
+    reload = true;
+    loadStart = millis();
+    version++;
+}
+
+void DirCache::loaderLoop() {
+    while(1) {
+        load.notifyTake(pdTRUE, portMAX_DELAY);
+        while(reload) {
+            lock();
+            reload = false;
+            String p = path;
+            unlock();
+            readDir(p);
+        }
+    }
+}
+
+void DirCache::readDir(const String &dirPath) {
+    File dir = SD.open(dirPath);
+    if(!dir || !dir.isDirectory()) {
+        dir.close();
+        lock();
+        if(!reload) { failed = true; complete = true; loadMs = millis()-loadStart; version++; }
+        unlock();
+        return;
+    }
+    File f;
+    size_t seen[3] = {};
+    // a newer open(), want() or invalidate() sets reload, this read is dropped then
+    while(!reload && (f = dir.openNextFile()) ) {
+        const char* name = f.name();
+        const char* s = strrchr(name, '/');
+        if(s!=nullptr) name = s+1;
+        uint8_t kind = f.isDirectory() ? DIR : GcbWriter::isGCode(name) ? GCODE : OTHER;
+        if(kind==DIR || !GcbWriter::isSidecar(name)) {
+            uint32_t size = kind==DIR ? 0 : f.size();
+            lock();
+            if(!reload) {
+                if(!windowStarted && sum(seen, windowKinds) >= windowFirst) startWindow(seen);
+                if(windowStarted && !full && (kind & storedKinds()) && !append(name, size, kind)) full = large = true;
+                size_t k = kindIndex(kind);
+                seen[k]++;
+                if(seen[k] > total[k]) total[k] = seen[k];
+                if((seen[0]+seen[1]+seen[2]) % BATCH == 0) version++;
+            }
+            unlock();
+        }
+        f.close();
+    }
+    dir.close();
+    lock();
+    if(!reload) {
+        if(!windowStarted) startWindow(seen);     // the window is past the end
+        memcpy(total, seen, sizeof(total));
+        complete = true;
+        loadMs = millis()-loadStart;
+        version++;
+        DC_DEBUGF("%s: %u entries in %u ms, %u from %u in the window\n", dirPath.c_str(), 
+            seen[0]+seen[1]+seen[2], loadMs, nEntries, windowStart);
+    }
+    unlock();
+}
+
+void DirCache::startWindow(const size_t seen[3]) {
+    windowStarted = true;
+    memcpy(before, seen, sizeof(before));
+    windowStart = seen[0]+seen[1]+seen[2];
+    if(windowStart!=0) large = true;
+}
+
+bool DirCache::append(const char* name, uint32_t size, uint8_t kind) {
+    size_t len = strlen(name)+1;
+    if(nEntries==MAX_ENTRIES || poolLen+len > POOL_SIZE) return false;
+    memcpy(pool+poolLen, name, len);
+    entries[nEntries++] = Entry{size, (uint16_t)poolLen, kind};
+    poolLen += len;
+    return true;
+}
+
+void DirCache::sortEntries(Sort sort) {
+    for(size_t i=0; i<nEntries; i++) order[i] = i;
+    std::sort(order, order+nEntries, [this, sort](uint16_t a, uint16_t b) {
+        const Entry &ea = entries[a], &eb = entries[b];
+        if((ea.kind & DIR) != (eb.kind & DIR)) return (ea.kind & DIR) != 0;
+        if(sort==BY_SIZE && ea.size!=eb.size) return ea.size > eb.size;    // largest first
+        return strcasecmp(pool+ea.name, pool+eb.name) < 0;
+    });
+    sortedCount = nEntries;
+    sortedBy = sort;
+}
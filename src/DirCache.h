@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+#include <algorithm>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include "TaskMonitor.h"
+
+/**
+ * Listing of one SD directory, read by its own task (see loaderLoop()) and shared by FileChooser and the /fs page.
+ *
+ * open() returns right away; entries show up a batch at a time while the task reads on, and getVersion()
+ * changes with every batch, so a listing can be redrawn as it fills. Names are kept in one pool with a small
+ * Entry per file, so a large directory costs no String or File per entry. Sidecars (see GcbWriter) are left out.
+ * A directory that does not fit (isLarge()) is held a window at a time and listed in directory order:
+ * the task always reads it to the end, so count() is right, and want() has it read again from a little before
+ * a page outside the window, keeping only the kinds asked for. The SD library cannot seek in a directory,
+ * so that takes as long as reading up to there.
+ * Only one directory is cached: the LCD and the web browsing different ones take turns. Either takes it
+ * with open() and want() when its user asks for a page, never when it just redraws.
+ * Call invalidate() when a file is written or removed, the directory is read again if it is the cached one.
+ */
+class DirCache {
+public:
+
+    static const size_t MAX_ENTRIES = 1000;
+    static const size_t POOL_SIZE = 16*1024;
+    static const size_t BATCH = 16;     ///< entries read between two publishes
+    static const size_t WINDOW_BACK = 64;   ///< entries a moved window starts before the wanted page
+
+    enum Kind: uint8_t { DIR = 1, GCODE = 2, OTHER = 4, ALL = DIR|GCODE|OTHER };
+    enum Sort: uint8_t { BY_NAME, BY_SIZE };    ///< directories come first either way
+
+    struct Entry {
+        uint32_t size;
+        uint16_t name;      ///< offset in the name pool
+        uint8_t kind;
+    };
+
+    static DirCache& get();
+
+    DirCache();
+
+    /** Loader task body, never returns */
+    void loaderLoop();
+    void setLoaderTask(TaskHandle_t t) { loaderTask = t; }
+    TaskLoad & getLoad() { return load; }
+
+    /// Makes path the cached directory and has it read, unless it is cached already. Any task.
+    void open(const String &path);
+    /// The directory of file changed; it is read again if it is the cached one
+    void invalidate(const String &file);
+
+    /// Entries first..first+n of the given kinds are (or will be, once read) in the cache
+    bool covers(uint8_t kinds, size_t first, size_t n) { lock(); bool c = coversLocked(kinds, first, n); unlock(); return c; }
+    /// Has the window moved over entries first..first+n of the given kinds, unless it covers them; @return covers()
+    bool want(uint8_t kinds, size_t first, size_t n);
+
+    String getPath() { lock(); String p = path; unlock(); return p; }
+    /// All entries are read
+    bool isComplete() { return complete; }
+    /// The directory does not fit: it is held a window at a time and listed in directory order, not sorted
+    bool isLarge() { return large; }
+    /// path is not a directory
+    bool isFailed() { return failed; }
+    /// Changes whenever entries are added or the cached directory changes
+    uint32_t getVersion() { return version; }
+    /// Time the (last) read of the directory took so far
+    uint32_t getLoadMs() { return complete ? loadMs : millis() - loadStart; }
+
+    /// Entries of the given kinds in the directory, read so far; not only those in the window
+    size_t count(uint8_t kinds) {
+        lock();
+        size_t n = sum(total, kinds);
+        unlock();
+        return n;
+    }
+
+    /**
+     * Calls f(name, entry) for up to n entries of the given kinds, starting at the first-th, in sort order
+     * (in directory order when isLarge()). Only entries in the window are visited, see covers().
+     * The cache is locked meanwhile, f should only copy what it needs.
+     * @return entries visited
+     */
+    template<typename F>
+    size_t list(uint8_t kinds, Sort sort, size_t first, size_t n, F f) {
+        lock();
+        bool sorted = !isLarge();
+        if(sorted && (sortedCount!=nEntries || sortedBy!=sort)) sortEntries(sort);
+        size_t k = sorted ? 0 : sum(before, kinds), visited = 0;
+        for(size_t i=0; i<nEntries && visited<n; i++) {
+            const Entry &e = entries[sorted ? order[i] : i];
+            if(!(e.kind & kinds)) continue;
+            if(k++ < first) continue;
+            f(pool + e.name, e);
+            visited++;
+        }
+        unlock();
+        return visited;
+    }
+
+private:
+
+    SemaphoreHandle_t mutex;
+    StaticSemaphore_t mutexBuf;
+    TaskHandle_t loaderTask = nullptr;
+    TaskLoad load;
+
+    String path;            ///< cached directory
+    volatile bool reload = false;   ///< path has to be read (again)
+    volatile bool complete = false;
+    volatile bool full = false;     ///< an entry did not fit into the window
+    volatile bool large = false;    ///< see isLarge(), kept while the window moves
+    volatile bool failed = false;
+    volatile uint32_t version = 0;
+    uint32_t loadStart = 0;
+    uint32_t loadMs = 0;
+
+    /// window: entries from the one after windowFirst entries of windowKinds on; only those kinds, unless it starts at 0
+    uint8_t windowKinds = ALL;
+    size_t windowFirst = 0;
+    bool windowStarted = false;
+    size_t windowStart = 0;         ///< entries of all kinds before the window, once started
+    size_t before[3] = {};          ///< entries of each kind before the window, once started
+    size_t total[3] = {};           ///< entries of each kind in the directory, as far as known
+
+    Entry entries[MAX_ENTRIES];
+    uint16_t order[MAX_ENTRIES];    ///< entries sorted
+    char pool[POOL_SIZE];
+    size_t nEntries = 0;
+    size_t poolLen = 0;
+    size_t sortedCount = 0;
+    Sort sortedBy = BY_NAME;
+
+    uint8_t storedKinds() { return windowFirst==0 ? ALL : windowKinds; }
+    static uint8_t kindIndex(uint8_t kind) { return kind==DIR ? 0 : kind==GCODE ? 1 : 2; }
+    static size_t sum(const size_t counts[3], uint8_t kinds) {
+        return (kinds & DIR ? counts[0] : 0) + (kinds & GCODE ? counts[1] : 0) + (kinds & OTHER ? counts[2] : 0);
+    }
+
+    void lock() { xSemaphoreTake(mutex, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(mutex); }
+
+    bool coversLocked(uint8_t kinds, size_t first, size_t n);
+    /// Drops the entries and has dirPath read, into a window from the first-th entry of kinds on; call locked
+    void restart(const String &dirPath, uint8_t kinds = ALL, size_t first = 0);
+    void readDir(const String &dirPath);
+    /// The entries after seen ones go into the window; call locked
+    void startWindow(const size_t seen[3]);
+    bool append(const char* name, uint32_t size, uint8_t kind);
+    void sortEntries(Sort sort);
+};
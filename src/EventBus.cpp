@@ -0,0 +1,77 @@
+#include "EventBus.h"
+
+// constructed on first use, producers and subscribers are static objects too
+EventBus& EventBus::getBus() { 
+    static EventBus bus;
+    return bus; 
+}
+
+EventBus::Subscriber EventBus::subscribe(uint32_t topicMask, TaskHandle_t task) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Subscriber ret = NONE;
+    if(nSubscribers < MAX_SUBSCRIBERS) {
+        Sub &s = subscribers[nSubscribers];
+        s.topics = topicMask;
+        s.queue = xQueueCreate(QUEUE_LEN, sizeof(Event));
+        s.task = task;
+        ret = nSubscribers++;
+    }
+    xSemaphoreGive(lock);
+    return ret;
+}
+
+void EventBus::publish(Topic t, int32_t value) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    publishLocked(t, value);
+    xSemaphoreGive(lock);
+}
+
+void EventBus::publishIfChanged(Topic t, uint32_t fingerprint, uint32_t &lastFingerprint, int32_t value) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(fingerprint==lastFingerprint) {
+        topics[(uint8_t)t].stats.unchanged++;
+    } else {
+        lastFingerprint = fingerprint;
+        publishLocked(t, value);
+    }
+    xSemaphoreGive(lock);
+}
+
+void EventBus::publishLocked(Topic t, int32_t value) {
+    TopicState &ts = topics[(uint8_t)t];
+    ts.stats.published++;
+    if(ts.minIntervalMs!=0 && millis() - ts.lastDeliveredAt < ts.minIntervalMs) {
+        // keep only the newest, flush() delivers it
+        if(pending.fetch_or(mask(t)) & mask(t)) ts.stats.limited++;
+        ts.pendingValue = value;
+        return;
+    }
+    pending.fetch_and(~mask(t));
+    deliver(t, value);
+}
+
+void EventBus::deliver(Topic t, int32_t value) {
+    TopicState &ts = topics[(uint8_t)t];
+    ts.lastDeliveredAt = millis();
+    ts.stats.delivered++;
+    Event e{t, value};
+    for(size_t i=0; i<nSubscribers; i++) {
+        Sub &s = subscribers[i];
+        if((s.topics & mask(t)) == 0) continue;
+        if(xQueueSend(s.queue, &e, 0) != pdTRUE) ts.stats.overflows++;
+        if(s.task!=nullptr) xTaskNotifyGive(s.task);
+    }
+}
+
+void EventBus::flushPending() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint32_t now = millis();
+    for(uint8_t i=0; i<(uint8_t)Topic::COUNT; i++) {
+        Topic t = (Topic)i;
+        TopicState &ts = topics[i];
+        if((pending.load() & mask(t)) == 0 || now - ts.lastDeliveredAt < ts.minIntervalMs) continue;
+        pending.fetch_and(~mask(t));
+        deliver(t, ts.pendingValue);
+    }
+    xSemaphoreGive(lock);
+}
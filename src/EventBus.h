@@ -0,0 +1,124 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <atomic>
+
+enum class Topic: uint8_t {
+    JOB_STATE,      ///< file set, started, paused, finished or cancelled
+    JOB_PROGRESS,   ///< value: completion, per mille
+    DEVICE_STATUS,  ///< position, state, temperatures or firmware info changed; value: device index
+    DEVICE_ERROR,   ///< error response, alarm or timeout; never rate limited; value: device index
+    WEB_STATUS,     ///< value: 1 when an upload starts or ends
+    COUNT
+};
+
+struct Event {
+    Topic topic;
+    int32_t value;
+};
+
+/**
+ * Publish/subscribe between tasks.
+ *
+ * Every subscriber has its own FreeRTOS queue and reads it from its own task with receive(),
+ * so publishing never runs consumer code. Per topic, the bus drops events whose fingerprint
+ * did not change (see publishIfChanged()) and holds back events that come faster than the
+ * topic's rate limit; the last held back event is delivered by flush() when the interval is over.
+ * Held back events of different devices are merged too, so the value of a rate limited topic is only a hint.
+ */
+class EventBus {
+public:
+
+    static const size_t MAX_SUBSCRIBERS = 4;
+    static const size_t QUEUE_LEN = 8;
+
+    typedef int8_t Subscriber;
+    static const Subscriber NONE = -1;
+
+    struct TopicStats {
+        uint32_t published;
+        uint32_t delivered;
+        uint32_t unchanged;     ///< dropped, same fingerprint as the last one
+        uint32_t limited;       ///< merged into a held back event
+        uint32_t overflows;     ///< not delivered, a subscriber queue was full
+    };
+
+    static EventBus& getBus();
+
+    static constexpr uint32_t mask(Topic t) { return 1UL << (uint8_t)t; }
+    static const uint32_t ALL_TOPICS = (1UL << (uint8_t)Topic::COUNT) - 1;
+
+    /** FNV-1a, chain calls to fingerprint several fields */
+    static uint32_t hash(const void* data, size_t len, uint32_t h = 2166136261UL) {
+        const uint8_t *p = (const uint8_t*)data;
+        for(size_t i=0; i<len; i++) h = (h ^ p[i]) * 16777619UL;
+        return h;
+    }
+    template<typename T>
+    static uint32_t hash(const T &v, uint32_t h = 2166136261UL) { return hash(&v, sizeof(v), h); }
+
+    EventBus() { 
+        lock = xSemaphoreCreateMutexStatic(&lockBuf); 
+        setRateLimit(Topic::JOB_PROGRESS, 250);
+        setRateLimit(Topic::DEVICE_STATUS, 100);   // Grbl reports every 50ms while moving
+    }
+
+    /**
+     * Call at startup, before any events are published.
+     * @param task notified with xTaskNotifyGive() on every event, can be nullptr if the subscriber polls
+     * @return NONE if there are too many subscribers
+     */
+    Subscriber subscribe(uint32_t topics, TaskHandle_t task = nullptr);
+
+    /// Next event for the subscriber, false if there is none
+    bool receive(Subscriber s, Event &e) {
+        if(s==NONE) return false;
+        return xQueueReceive(subscribers[s].queue, &e, 0) == pdTRUE;
+    }
+
+    /// Events of the topic at most once per minIntervalMs, 0 to deliver all
+    void setRateLimit(Topic t, uint16_t minIntervalMs) { topics[(uint8_t)t].minIntervalMs = minIntervalMs; }
+
+    void publish(Topic t, int32_t value = 0);
+    /** 
+     * Like publish(), but dropped if fingerprint is the same as lastFingerprint, which is then updated.
+     * The producer keeps lastFingerprint, so that several devices can publish on one topic.
+     */
+    void publishIfChanged(Topic t, uint32_t fingerprint, uint32_t &lastFingerprint, int32_t value = 0);
+
+    /// Delivers held back events whose interval is over; call periodically from a producer task
+    void flush() { if(pending.load(std::memory_order_relaxed) != 0) flushPending(); }
+
+    const TopicStats & getStats(Topic t) { return topics[(uint8_t)t].stats; }
+
+private:
+
+    struct TopicState {
+        uint16_t minIntervalMs;
+        uint32_t lastDeliveredAt;
+        int32_t pendingValue;
+        TopicStats stats;
+    };
+
+    struct Sub {
+        uint32_t topics;
+        QueueHandle_t queue;
+        TaskHandle_t task;
+    };
+
+    TopicState topics[(uint8_t)Topic::COUNT] = {};
+    Sub subscribers[MAX_SUBSCRIBERS];
+    size_t nSubscribers = 0;
+    std::atomic<uint32_t> pending{0};   ///< topics with a held back event
+
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lockBuf;
+
+    void publishLocked(Topic t, int32_t value);
+    void deliver(Topic t, int32_t value);
+    void flushPending();
+};
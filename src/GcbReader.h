@@ -0,0 +1,166 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+
+#include "GcodeModal.h"
+#include "TimeEstimator.h"
+
+/**
+ * Sidecar of a G-code file, `<file>.gcb`, written by GcbWriter when the file is uploaded.
+ *
+ * Layout: GcbHeader, the line records, then the index.
+ * A record is a length byte followed by the line without comments, whitespace or line end.
+ * A record takes as many bytes as the line does on the wire (the length byte stands in for the '\n'),
+ * so record offsets double as the bytes sent to the device so far.
+ * The index has a GcbIndexEntry for every indexStride-th line, a checkpoint to resume a job from.
+ */
+struct GcbHeader {
+    char magic[4];
+    uint32_t sourceSize;    ///< size of the G-code file, a sidecar of another size is stale
+    uint32_t lines;
+    uint32_t moves;         ///< G0-G3 lines and lines of bare axis words
+    uint32_t dataSize;      ///< bytes of records; the index follows them
+    uint16_t indexStride;
+    uint16_t entrySize;     ///< sizeof(GcbIndexEntry) of the writer
+    float seconds;          ///< estimated run time, see TimeEstimator
+    MotionLimits limits;    ///< the estimate is for these
+};
+
+struct GcbIndexEntry {
+    uint32_t dataOffset;    ///< of the line's record, from the first record
+    uint32_t sourceOffset;  ///< of the line in the G-code file
+    uint32_t moves;         ///< moves before the line
+    GcodeModal modal;       ///< state before the line
+    float seconds;          ///< estimated time before the line
+};
+
+static const char GCB_MAGIC[4] = {'G', 'C', 'B', '5'};
+
+/**
+ * Reads the records of a sidecar BLOCK bytes at a time, like LineReader does for text.
+ *
+ * The returned line is NOT terminated; it is valid until the next readLine().
+ */
+template<size_t BLOCK = 2048>
+class GcbReader {
+public:
+
+    static const int END = -1;
+    static const int BAD_FILE = -2;     ///< truncated record
+
+    /// @return false if f is not a sidecar
+    bool begin(File f) {
+        file = f;
+        if(!file || file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) return false;
+        if(memcmp(header.magic, GCB_MAGIC, sizeof(GCB_MAGIC))!=0 || header.entrySize < sizeof(GcbIndexEntry) ) return false;
+        rewind(0, 0);
+        bytesRead = 0;
+        linesRead = 0;
+        readUs = 0;
+        busyUs = 0;
+        return true;
+    }
+
+    const GcbHeader & getHeader() const { return header; }
+
+    /** @return line length, END after the last line or BAD_FILE */
+    int readLine(char* &line) {
+        uint32_t t = micros();
+        int ret = nextLine(line);
+        if(ret>=0) linesRead++;
+        busyUs += micros()-t;
+        return ret;
+    }
+
+    /// Continues reading at line n (0-based) through the index; false if there is no such line
+    bool seekLine(uint32_t n) {
+        if(n > header.lines || header.indexStride==0) return false;
+        uint32_t k = n / header.indexStride;
+        GcbIndexEntry e;
+        if(!readEntry(k, e)) return false;
+        rewind(k * header.indexStride, e.dataOffset);
+        char *line;
+        while(lineNo < n)
+            if(nextLine(line) < 0) return false;
+        return true;
+    }
+
+    /// Index entry k, for line k*indexStride
+    bool readEntry(uint32_t k, GcbIndexEntry &e) {
+        uint32_t n = (header.lines + header.indexStride - 1) / header.indexStride;
+        if(k >= n) return false;
+        if(!file.seek(sizeof(header) + header.dataSize + k*header.entrySize)) return false;
+        if(file.read((uint8_t*)&e, sizeof(e)) != sizeof(e)) return false;
+        dataPos = SIZE_MAX; // the file position is gone, the next fill() seeks back
+        return true;
+    }
+
+    /// Index of the next line
+    uint32_t getLineNo() const { return lineNo; }
+    /// Record bytes consumed by returned lines
+    size_t position() const { return consumed; }
+
+    /// SD read speed, time spent in File::read() only
+    uint32_t getBytesPerSec() const { return readUs==0 ? 0 : 1000000ULL * bytesRead / readUs; }
+    /// How fast lines could be supplied, time spent in readLine()
+    uint32_t getLinesPerSec() const { return busyUs==0 ? 0 : 1000000ULL * linesRead / busyUs; }
+
+private:
+
+    File file;
+    GcbHeader header;
+    char buf[BLOCK + 256];
+    size_t start, end;
+    size_t dataPos;     ///< record offset of buf[end], SIZE_MAX if the file was seeked elsewhere
+    uint32_t lineNo;
+
+    size_t consumed;
+    size_t bytesRead;
+    size_t linesRead;
+    uint32_t readUs;
+    uint32_t busyUs;
+
+    void rewind(uint32_t line, uint32_t dataOffset) {
+        start = end = 0;
+        lineNo = line;
+        consumed = dataOffset;
+        dataPos = SIZE_MAX;
+    }
+
+    int nextLine(char* &line) {
+        if(lineNo >= header.lines) return END;
+        if(end-start < 1 || end-start < 1u + (uint8_t)buf[start]) {
+            fill();
+            if(end-start < 1 || end-start < 1u + (uint8_t)buf[start]) return BAD_FILE;
+        }
+        uint8_t len = buf[start];
+        line = buf+start+1;
+        start += 1+len;
+        consumed += 1+len;
+        lineNo++;
+        return len;
+    }
+
+    void fill() {
+        if(start!=0) {
+            memmove(buf, buf+start, end-start);
+            end -= start;
+            start = 0;
+        }
+        if(dataPos==SIZE_MAX) {
+            dataPos = consumed + end;
+            if(!file.seek(sizeof(header) + dataPos)) return;
+        }
+        if(dataPos >= header.dataSize) return;
+        size_t n = header.dataSize - dataPos;
+        if(n > BLOCK) n = BLOCK;
+        uint32_t t = micros();
+        n = file.read((uint8_t*)buf+end, n);
+        readUs += micros()-t;
+        end += n;
+        dataPos += n;
+        bytesRead += n;
+    }
+
+};
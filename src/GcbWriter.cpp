@@ -0,0 +1,147 @@
+#include "GcbWriter.h"
+
+#define GW_DEBUGF(...) // { Serial.printf(__VA_ARGS__); }
+
+bool GcbWriter::isGCode(const char* path) {
+    if(isSidecar(path)) return false;
+    const char* s = strrchr(path, '/');
+    const char* p = strrchr(path, '.');
+    if(p==nullptr || (s!=nullptr && p<s)) return true; // files without extension can be printed
+    p++;
+    return strcasecmp(p, "gcode")==0 || strcasecmp(p, "nc")==0 || strcasecmp(p, "gc")==0 || strcasecmp(p, "gco")==0;
+}
+
+void GcbWriter::removeSidecar(const String &path) {
+    String p = sidecarPath(path);
+    if(SD.exists(p)) SD.remove(p);
+}
+
+bool GcbWriter::begin(const String &path, const MotionLimits &limits) {
+    if(isActive()) abort();
+    this->path = sidecarPath(path);
+    if(SD.exists(this->path)) SD.remove(this->path);
+    out = SD.open(this->path, FILE_WRITE);
+    if(!out) return false;
+    indexFile = SD.open(this->path + ".tmp", FILE_WRITE);
+    if(!indexFile) { out.close(); SD.remove(this->path); return false; }
+
+    header = {};
+    srcPos = lineStart = 0;
+    stripper.reset();
+    estimator.begin(limits);
+    header.limits = limits;
+    outLen = indexLen = 0;
+    failed = false;
+    write(&header, sizeof(header)); // placeholder until finish()
+    return true;
+}
+
+void GcbWriter::feed(const uint8_t *data, size_t n) {
+    if(!isActive() || failed) return;
+    for(size_t i=0; i<n; i++, srcPos++) {
+        char c = data[i];
+        if(c=='\n' || c=='\r') {
+            endLine();
+            lineStart = srcPos+1;
+            continue;
+        }
+        stripper.put(c);
+    }
+}
+
+bool GcbWriter::isMove(const char* line, size_t len) {
+    char c = toupper(line[0]);
+    if(c=='X' || c=='Y' || c=='Z') return true;  // modal motion
+    if(c!='G') return false;
+    size_t i = 1;
+    int code = 0;
+    for(; i<len && isdigit(line[i]); i++) code = code*10 + line[i]-'0';
+    return i>1 && code<=3 && (i==len || line[i]!='.');
+}
+
+void GcbWriter::endLine() {
+    const char* line = stripper.line();
+    size_t len = stripper.length();
+    if(stripper.isTooLong()) {
+        GW_DEBUGF("Line at %u is too long\n", lineStart);
+        failed = true;
+        return;
+    }
+    if(len==0) { stripper.reset(); return; }
+    if(header.lines % INDEX_STRIDE == 0) {
+        indexBuf[indexLen++] = GcbIndexEntry{header.dataSize, lineStart, header.moves,
+                estimator.getModal(), estimator.getSeconds()};
+        if(indexLen==INDEX_BUF) flushIndex();
+    }
+    if(isMove(line, len)) header.moves++;
+    estimator.update(line, len);
+    uint8_t l = len;
+    write(&l, 1);
+    write(line, len);
+    header.dataSize += 1+len;
+    header.lines++;
+    stripper.reset();
+}
+
+void GcbWriter::write(const void *data, size_t n) {
+    const uint8_t *p = (const uint8_t*)data;
+    while(n>0) {
+        size_t k = OUT_BUF - outLen;
+        if(k>n) k = n;
+        memcpy(outBuf+outLen, p, k);
+        outLen += k;
+        p += k;
+        n -= k;
+        if(outLen==OUT_BUF) flushOut();
+    }
+}
+
+void GcbWriter::flushOut() {
+    if(outLen>0 && out.write(outBuf, outLen) != outLen) failed = true;
+    outLen = 0;
+}
+
+void GcbWriter::flushIndex() {
+    size_t n = indexLen*sizeof(GcbIndexEntry);
+    if(indexLen>0 && indexFile.write((uint8_t*)indexBuf, n) != n) failed = true;
+    indexLen = 0;
+}
+
+bool GcbWriter::finish() {
+    if(!isActive()) return false;
+    if(!failed) endLine();  // last line without a line end
+    flushIndex();
+    indexFile.close();
+    if(!failed) {
+        // append the index through outBuf
+        indexFile = SD.open(path + ".tmp", FILE_READ);
+        size_t n;
+        while(indexFile && (n = indexFile.read(outBuf+outLen, OUT_BUF-outLen)) > 0 ) {
+            outLen += n;
+            if(outLen==OUT_BUF) flushOut();
+        }
+        if(indexFile) indexFile.close(); else failed = true;
+        flushOut();
+    }
+    if(!failed) {
+        memcpy(header.magic, GCB_MAGIC, sizeof(GCB_MAGIC));
+        header.sourceSize = srcPos;
+        header.indexStride = INDEX_STRIDE;
+        header.entrySize = sizeof(GcbIndexEntry);
+        header.seconds = estimator.finish();
+        if(!out.seek(0) || out.write((uint8_t*)&header, sizeof(header)) != sizeof(header)) failed = true;
+    }
+    out.close();
+    SD.remove(path + ".tmp");
+    if(failed) SD.remove(path);
+    GW_DEBUGF("%s: %u lines, %u moves, %u of %u bytes, %.0f s\n", path.c_str(), header.lines, header.moves, header.dataSize, srcPos, header.seconds);
+    return !failed;
+}
+
+void GcbWriter::abort() {
+    if(!isActive()) return;
+    indexFile.close();
+    out.close();
+    SD.remove(path + ".tmp");
+    SD.remove(path);
+}
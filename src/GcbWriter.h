@@ -0,0 +1,77 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+
+#include "GcbReader.h"
+#include "GcodeStripper.h"
+#include "TimeEstimator.h"
+
+/**
+ * Converts a G-code file into its sidecar (see GcbReader) while the file is being written.
+ *
+ * Lines are stripped by GcodeStripper, empty ones are dropped. The modal state and the estimated
+ * time are followed through the file and saved at every checkpoint.
+ * The index goes to a temporary file and is appended by finish(), then the header is filled in.
+ */
+class GcbWriter {
+public:
+
+    static const size_t OUT_BUF = 4096;
+    static const uint16_t INDEX_STRIDE = 64;
+    static const size_t INDEX_BUF = 32;
+
+    static String sidecarPath(const String &path) { return path + ".gcb"; }
+    static bool isSidecar(const String &path) { return isSidecar(path.c_str()); }
+    static bool isSidecar(const char* path) {
+        size_t n = strlen(path);
+        return n>=4 && strcmp(path+n-4, ".gcb")==0;
+    }
+    /// Files worth converting
+    static bool isGCode(const String &path) { return isGCode(path.c_str()); }
+    static bool isGCode(const char* path);
+    static void removeSidecar(const String &path);
+
+    /// Starts the sidecar for the G-code file at path, to be run on a machine with the given limits
+    bool begin(const String &path, const MotionLimits &limits);
+    /// Next bytes of the G-code file
+    void feed(const uint8_t *data, size_t len);
+    /**
+     * Completes the sidecar.
+     * @return false if the file could not be converted (a line is too long for CommandPool), the sidecar is removed then
+     */
+    bool finish();
+    /// Drops the sidecar
+    void abort();
+
+    bool isActive() { return (bool)out; }
+    uint32_t getLines() { return header.lines; }
+    uint32_t getMoves() { return header.moves; }
+    uint32_t getDataSize() { return header.dataSize; }
+    float getSeconds() { return header.seconds; }
+
+private:
+
+    File out;
+    File indexFile;
+    String path;
+    bool failed;
+
+    GcbHeader header;
+    uint32_t srcPos;
+    uint32_t lineStart;     ///< source offset of the current line
+
+    GcodeStripper stripper;
+    TimeEstimator estimator;
+
+    uint8_t outBuf[OUT_BUF];
+    size_t outLen;
+    GcbIndexEntry indexBuf[INDEX_BUF];
+    size_t indexLen;
+
+    void endLine();
+    bool isMove(const char* line, size_t len);
+    void write(const void *data, size_t n);
+    void flushOut();
+    void flushIndex();
+};
@@ -0,0 +1,149 @@
+#include "GcodeModal.h"
+#include "GcodeStripper.h"
+
+#include <stdarg.h>
+
+/// Plain decimal number; no exponent, "X1E2" is X1 and E2
+static bool parseNumber(const char* &p, const char* end, float &val) {
+    const char* s = p;
+    bool neg = false;
+    if(p<end && (*p=='-' || *p=='+')) { neg = *p=='-'; p++; }
+    float v = 0, scale = 0;
+    bool digits = false;
+    for(; p<end; p++) {
+        if(*p>='0' && *p<='9') {
+            digits = true;
+            if(scale==0) v = v*10 + (*p-'0');
+            else { v += (*p-'0') * scale; scale /= 10; }
+        } else if(*p=='.' && scale==0) scale = 0.1f;
+        else break;
+    }
+    if(!digits) { p = s; return false; }
+    val = neg ? -v : v;
+    return true;
+}
+
+bool GcodeWords::parse(const char* line, size_t len) {
+    has = 0;
+    gCount = 0;
+    m = -1;
+    if(len==0 || line[0]=='$') return false;
+    const char* p = line;
+    const char* end = line+len;
+    while(p<end) {
+        char c = toupper(*p++);
+        if(c<'A' || c>'Z') continue;
+        float val;
+        if(!parseNumber(p, end, val)) continue;
+        switch(c) {
+            case 'G': if(gCount<MAX_G) g[gCount++] = (int16_t)lroundf(val*10); break;
+            case 'M':
+                m = (int16_t)val;
+                if(GcodeStripper::isMessageCode(m)) return true; // the rest is text
+                break;
+            case 'X': value[X] = val; has |= 1u << X; break;
+            case 'Y': value[Y] = val; has |= 1u << Y; break;
+            case 'Z': value[Z] = val; has |= 1u << Z; break;
+            case 'E': value[E] = val; has |= 1u << E; break;
+            case 'F': value[F] = val; has |= 1u << F; break;
+            case 'S': value[S] = val; has |= 1u << S; break;
+            case 'P': value[P] = val; has |= 1u << P; break;
+            case 'I': value[I] = val; has |= 1u << I; break;
+            case 'J': value[J] = val; has |= 1u << J; break;
+        }
+    }
+    return true;
+}
+
+bool GcodeModal::isPositional(const GcodeWords &w) {
+    for(uint8_t i=0; i<w.gCount; i++) {
+        int g = w.g[i];
+        if(g%10!=0) return false;  // G38.2 and the like
+        g /= 10;
+        if(g==4 || g==10 || g==28 || g==30 || g==53 || g==92) return false;
+    }
+    return true;
+}
+
+void GcodeModal::update(const GcodeWords &w) {
+    for(uint8_t i=0; i<w.gCount; i++) {
+        if(w.g[i]%10!=0) continue;
+        int g = w.g[i]/10;
+        if(g<=3) motion = g;
+        else if(g>=17 && g<=19) plane = g;
+        else if(g==20) flags |= INCHES;
+        else if(g==21) flags &= ~INCHES;
+        else if(g>=54 && g<=59) wcs = g;
+        else if(g==90) flags &= ~RELATIVE;
+        else if(g==91) flags |= RELATIVE;
+    }
+    // M codes other than the spindle ones use S for something else (temperatures...)
+    bool spindleS = w.m<0 || (w.m>=3 && w.m<=5);
+    if(w.m>=3 && w.m<=5) spindle = w.m;
+    else if(w.m==82) flags &= ~E_RELATIVE;
+    else if(w.m==83) flags |= E_RELATIVE;
+    if(w.hasParam(GcodeWords::S)) {
+        if(w.m==104 || w.m==109) hotendTemp = w.value[GcodeWords::S];
+        else if(w.m==140 || w.m==190) bedTemp = w.value[GcodeWords::S];
+    }
+    if(w.hasParam(GcodeWords::F)) feed = w.value[GcodeWords::F];
+    bool positional = isPositional(w);
+    if(w.hasParam(GcodeWords::S) && spindleS && positional) spindleSpeed = w.value[GcodeWords::S];
+    if(w.hasParam(GcodeWords::E) && (positional || w.hasG(92))) {
+        float v = w.value[GcodeWords::E];
+        // G92 sets it; Marlin takes E relative with G91 too
+        if(w.hasG(92) || !(flags & (RELATIVE|E_RELATIVE))) { e = v; flags |= E_KNOWN; }
+        else if(flags & E_KNOWN) e += v;
+    }
+    if(!positional) return;
+    bool zKnown = flags & Z_KNOWN;
+    for(int i=0; i<3; i++) {
+        if(!w.hasParam((GcodeWords::Param)i)) continue;
+        uint8_t known = X_KNOWN << i;
+        float v = w.value[i];
+        if(flags & RELATIVE) { if(flags & known) pos[i] += v; }
+        else { pos[i] = v; flags |= known; }
+    }
+    if(flags & Z_KNOWN) maxZ = zKnown ? fmaxf(maxZ, pos[2]) : pos[2];
+}
+
+static void appendf(char* buf, size_t size, size_t &n, const char* fmt, ...) {
+    if(n>=size) return;
+    va_list args;
+    va_start(args, fmt);
+    n += vsnprintf(buf+n, size-n, fmt, args);
+    va_end(args);
+}
+
+size_t GcodeModal::preamble(char* buf, size_t size, bool machineRetract) const {
+    size_t n = 0;
+    appendf(buf, size, n, (flags & INCHES) ? "G20\n" : "G21\n");
+    if(plane!=17) appendf(buf, size, n, "G%u\n", plane);
+    if(wcs!=0) appendf(buf, size, n, "G%u\n", wcs);
+    if(spindle==3 || spindle==4) appendf(buf, size, n, "M%u S%g\n", spindle, spindleSpeed);
+    else if(spindle==5) appendf(buf, size, n, "M5\n");
+    appendf(buf, size, n, "G90\n");
+    // up clear of the work, over to the resume point, then down to it at the programmed feed
+    if(machineRetract) appendf(buf, size, n, "G53 G0 Z0\n");
+    else if(flags & Z_KNOWN) appendf(buf, size, n, "G0 Z%.4f\n", maxZ);
+    if(bedTemp>0) appendf(buf, size, n, "M190 S%g\n", bedTemp);
+    if(hotendTemp>0) appendf(buf, size, n, "M109 S%g\n", hotendTemp);
+    if(flags & (X_KNOWN|Y_KNOWN)) {
+        appendf(buf, size, n, "G0");
+        if(flags & X_KNOWN) appendf(buf, size, n, " X%.4f", pos[0]);
+        if(flags & Y_KNOWN) appendf(buf, size, n, " Y%.4f", pos[1]);
+        appendf(buf, size, n, "\n");
+    }
+    if(flags & Z_KNOWN) {
+        if(feed>0) appendf(buf, size, n, "G1 Z%.4f F%g\n", pos[2], feed);
+        else appendf(buf, size, n, "G0 Z%.4f\n", pos[2]);
+    }
+    if(flags & RELATIVE) appendf(buf, size, n, "G91\n");
+    if(flags & E_RELATIVE) appendf(buf, size, n, "M83\n");
+    else if(flags & E_KNOWN) appendf(buf, size, n, "G92 E%.5f\n", e);
+    if(motion<=1) {
+        if(feed>0) appendf(buf, size, n, "G%u F%g\n", motion, feed);
+        else appendf(buf, size, n, "G%u\n", motion);
+    } else if(feed>0) appendf(buf, size, n, "F%g\n", feed);
+    return n<size ? n : 0;
+}
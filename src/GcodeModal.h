@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * Words of one stripped G-code line (see GcodeStripper), as far as GcodeModal and TimeEstimator need them.
+ * Numbers are plain decimals: "X1E2" is X1 and E2, not X100.
+ */
+struct GcodeWords {
+
+    enum Param: uint8_t { X, Y, Z, E, F, S, P, I, J, N_PARAMS };
+    static const size_t MAX_G = 4;
+
+    float value[N_PARAMS];
+    uint16_t has;           ///< bit per Param
+    int16_t g[MAX_G];       ///< G codes times 10, G38.2 is 382
+    uint8_t gCount;
+    int16_t m;              ///< M code, -1 if there is none
+
+    /// @return false for lines that are not G-code (messages, Grbl '$' commands)
+    bool parse(const char* line, size_t len);
+
+    bool hasParam(Param p) const { return has & (1u << p); }
+    bool hasG(int code) const {
+        for(uint8_t i=0; i<gCount; i++) if(g[i]==code*10) return true;
+        return false;
+    }
+};
+
+/**
+ * Modal state of a G-code program, followed line by line: what a machine has to be told
+ * before the program can continue from the middle (see Job::resumeFrom()).
+ *
+ * Lines are expected stripped (see GcodeStripper). Positions are the last programmed ones in the
+ * work coordinates; moves that take coordinates as parameters (G28, G53, G92...) leave them alone.
+ * It is stored at every checkpoint of the sidecar index, so it is kept plain.
+ */
+struct GcodeModal {
+
+    enum Flags: uint8_t { RELATIVE = 1, INCHES = 2, X_KNOWN = 4, Y_KNOWN = 8, Z_KNOWN = 16, E_RELATIVE = 32, E_KNOWN = 64 };
+
+    float pos[3];           ///< X, Y, Z, valid with the *_KNOWN flags
+    float maxZ;             ///< highest Z so far, valid with Z_KNOWN
+    float e;                ///< extruder position, as G92 and absolute E words set it; valid with E_KNOWN
+    float hotendTemp;       ///< last M104/M109 target, 0 until one is given
+    float bedTemp;          ///< last M140/M190 target
+    float feed;             ///< 0 until F is given
+    float spindleSpeed;     ///< last S, except on M codes that use S for something else
+    uint8_t flags;
+    uint8_t motion;         ///< G0..G3
+    uint8_t plane;          ///< G17..G19
+    uint8_t wcs;            ///< G54..G59, 0 until one is selected
+    uint8_t spindle;        ///< M3, M4 or M5, 0 until one is given
+
+    void reset() {
+        *this = GcodeModal{};
+        plane = 17;
+    }
+
+    void update(const char* line, size_t len) {
+        GcodeWords w;
+        if(w.parse(line, len)) update(w);
+    }
+    void update(const GcodeWords &w);
+
+    /// Axis words of w are a position (and not parameters, as with G28, G53, G92...)
+    static bool isPositional(const GcodeWords &w);
+
+    /**
+     * Lines that bring a machine to this state, each ending with '\n'; @return length, 0 if buf is too small
+     * The tool goes up before moving over to the position: to the top of Z with machineRetract (`G53 G0 Z0`, Grbl),
+     * to the highest Z of the program so far otherwise. Printers wait for their temperatures up there (M190, M109)
+     * and get the extruder position back (G92 E) for absolute extrusion.
+     */
+    size_t preamble(char* buf, size_t size, bool machineRetract) const;
+};
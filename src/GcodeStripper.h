@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "CommandPool.h"
+
+/**
+ * Removes comments (';' and '()') and whitespace from one G-code line, a character at a time.
+ *
+ * Spaces in messages and file names (M23, M28, M30, M32, M117, M118) are collapsed to one instead.
+ * GcbWriter and Job both strip lines with it, so a file and its sidecar count the same lines.
+ */
+class GcodeStripper {
+public:
+
+    static const size_t MAX_LINE = CommandPool::MAX_LINE;
+
+    /// Strips line in place; @return the new length, or -1 if it is still longer than MAX_LINE
+    static int strip(char* line, size_t len) {
+        GcodeStripper s;
+        for(size_t i=0; i<len; i++) s.put(line[i]);
+        if(s.tooLong) return -1;
+        memcpy(line, s.buf, s.len);
+        line[s.len] = 0;
+        return s.len;
+    }
+
+    static bool isMessageCode(int m) {
+        return m==23 || m==28 || m==30 || m==32 || m==117 || m==118;
+    }
+
+    GcodeStripper() { reset(); }
+
+    void reset() {
+        state = CODE;
+        keepSpaces = pendingSpace = tooLong = false;
+        len = 0;
+    }
+
+    /// Next character of the line, without the line end
+    void put(char c) {
+        switch(state) {
+            case PAREN_COMMENT:
+                if(c==')') state = CODE;
+                break;
+            case LINE_COMMENT:
+                break;
+            case CODE:
+                if(c==';') state = LINE_COMMENT;
+                else if(c=='(') state = PAREN_COMMENT;
+                else if(c==' ' || c=='\t') {
+                    if(!keepSpaces && isMessage()) keepSpaces = true;
+                    if(keepSpaces && len>0) pendingSpace = true;
+                } else {
+                    if(pendingSpace) { append(' '); pendingSpace = false; }
+                    append(c);
+                }
+                break;
+        }
+    }
+
+    const char* line() const { return buf; }
+    size_t length() const { return len; }
+    bool isTooLong() const { return tooLong; }
+
+private:
+
+    enum State: uint8_t { CODE, PAREN_COMMENT, LINE_COMMENT };
+
+    State state;
+    bool keepSpaces;
+    bool pendingSpace;
+    bool tooLong;
+    char buf[MAX_LINE];
+    size_t len;
+
+    void append(char c) {
+        if(len < sizeof(buf)) buf[len++] = c; else tooLong = true;
+    }
+
+    bool isMessage() {
+        if(len<2 || (buf[0]!='M' && buf[0]!='m')) return false;
+        int code = 0;
+        for(size_t i=1; i<len; i++) {
+            if(!isdigit(buf[i])) return false;
+            code = code*10 + buf[i]-'0';
+        }
+        return isMessageCode(code);
+    }
+};
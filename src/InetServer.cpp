@@ -5,7 +5,14 @@
 #include <WiFi.h>
 #include <AsyncJson.h>
 
+#include "EventBus.h"
+#include "TaskMonitor.h"
+#include "UploadWriter.h"
+#include "DirCache.h"
 #include "Job.h"
+#include "ResumePoint.h"
+#include "DeviceRegistry.h"
+#include "ui/Display.h"
 
 #define API_VERSION     "0.1"
 #define SKETCH_VERSION  "0.0.1"
@@ -13,7 +20,6 @@
 
 WebServer* WebServer::inst = nullptr;
 
-extern HardwareSerial PrinterSerial; // dirty hack
 
 void WebServer::config(JsonObjectConst cfg ) {
 
@@ -67,7 +73,7 @@ void WebServer::begin() {
             Serial.printf("telnetServer onData: %s\n", t);
             GCodeDevice *dev = GCodeDevice::getDevice();
             if(dev==nullptr) return;
-            PrinterSerial.write((uint8_t*)data, len);
+            dev->getSerial()->write((uint8_t*)data, len);
         } );
         cli->onTimeout( [](void* t, AsyncClient* cli_, uint32_t tm) { Serial.print("telnetServer onTimeout "); cli_->remoteIP().printTo(Serial); Serial.println("");}  );
         cli->onError( [](void* t, AsyncClient* cli_, uint16_t e) { Serial.print("telnetServer onError "); cli_->remoteIP().printTo(Serial); Serial.println("");}  );
@@ -79,7 +85,7 @@ void WebServer::begin() {
     telnetServer.begin();
 
     running = true;
-    notify_observers( WebServerStatusEvent{0} );
+    EventBus::getBus().publish(Topic::WEB_STATUS);
 
 }
 
@@ -88,7 +94,7 @@ void WebServer::stop() {
         server.end();
         telnetServer.end();
         running = false;
-        notify_observers( WebServerStatusEvent{0} );
+        EventBus::getBus().publish(Topic::WEB_STATUS);
     }
 }
 
@@ -144,11 +150,13 @@ void WebServer::registerOptoPrintApi() {
             if(i!=0) baudsString += ", ";
             baudsString += String(DeviceDetector::serialBauds[i]);
         }
+        GCodeDevice *dev = GCodeDevice::getDevice();
+        uint32_t baud = dev==nullptr ? 0 : dev->getBaudRate();
         request->send(200, "application/json", "{\r\n"
                 "  \"current\": {\r\n"
                 "    \"state\": \"" + getStateText() + "\",\r\n"
                 "    \"port\": \"Serial\",\r\n"
-                "    \"baudrate\": " + DeviceDetector::serialBaud + ",\r\n"
+                "    \"baudrate\": " + baud + ",\r\n"
                 "    \"printerProfile\": \"Default\"\r\n"
                 "  },\r\n"
                 "  \"options\": {\r\n"
@@ -235,6 +243,17 @@ void WebServer::registerOptoPrintApi() {
         }
     );    
     server.addHandler(fileOp).setFilter( [](AsyncWebServerRequest *req){ return req->url().length()>filesPrefixLen; } ); 
+
+    server.on("/api/files/local", HTTP_DELETE, [](AsyncWebServerRequest *req) {
+        String file = extractPath(req->url(), filesPrefixLen);
+        Serial.printf("DELETE %s\n", file.c_str() );
+        Job *job = Job::getJob();
+        if(job->isValid() && job->getFilename()==file) { req->send(409, "text/plain", "File is being printed"); return; }
+        if(!SD.exists(file) || !SD.remove(file)) { req->send(404, "text/plain", "No such file"); return; }
+        GcbWriter::removeSidecar(file);
+        DirCache::get().invalidate(file);
+        req->send(204, "text/plain", "");
+    }).setFilter( [](AsyncWebServerRequest *req){ return req->url().length()>filesPrefixLen; } );
     
 
     server.on("/api/job", HTTP_GET, [this](AsyncWebServerRequest * request) {
@@ -246,11 +265,16 @@ void WebServer::registerOptoPrintApi() {
             request->send(500, "text/plain", "");
         }
         int32_t printTime=0, printTimeLeft = INT32_MAX;
+        int32_t estimatedTime = job->getEstimatedSeconds();
+        // from the sidecar's estimate (see TimeEstimator), extrapolated from progress without one
+        bool analysis = estimatedTime > 0;
         if (job->isRunning() ) {
             printTime = job->getPrintDuration() / 1000;
             float p = job->getCompletion();
-            printTimeLeft = (p > 0) ? printTime / p * (1-p) : INT32_MAX;
+            if(analysis) printTimeLeft = job->getEstimatedSecondsLeft();
+            else printTimeLeft = (p > 0) ? printTime / p * (1-p) : INT32_MAX;
         }
+        if(!analysis) estimatedTime = printTime + printTimeLeft;
         
         request->send(200, "application/json", "{\r\n"
                 "  \"job\": {\r\n"
@@ -259,7 +283,7 @@ void WebServer::registerOptoPrintApi() {
                 "      \"origin\": \"local\",\r\n"
                 "      \"size\": " + String(job->getFileSize() ) + "\r\n"
                 "    },\r\n"
-                "    \"estimatedPrintTime\": \"" + String(printTime + printTimeLeft) + "\" \r\n"
+                "    \"estimatedPrintTime\": \"" + String(estimatedTime) + "\" \r\n"
                 //"    \"filament\": {\r\n"
                 //"      \"length\": \"" + filementLength + "\",\r\n"
                 //"      \"volume\": \"" + filementVolume + "\"\r\n"
@@ -271,7 +295,7 @@ void WebServer::registerOptoPrintApi() {
                 //"    \"filepos\": 0,\r\n"
                 "    \"printTime\": " + String(printTime) + ",\r\n"
                 "    \"printTimeLeft\": " + String(printTimeLeft) + ",\r\n"
-                "    \"printTimeLeftOrigin\": \"linear\"\r\n"
+                "    \"printTimeLeftOrigin\": \"" + (analysis ? "analysis" : "linear") + "\"\r\n"
                 "  },\r\n"
                 "  \"state\": \"" + getStateText(job) + "\"\r\n"
                 "}");
@@ -416,7 +440,7 @@ String WebServer::extractPath(String sdir, int prefixLen) {
 }
 
 void WebServer::handleUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
-    static File file;
+    UploadWriter &writer = UploadWriter::get();
 
     if (index==0) { // first chunk
         uploadedFilePath = filename;
@@ -427,23 +451,31 @@ void WebServer::handleUpload(AsyncWebServerRequest *request, String filename, si
 
         Serial.printf("Uploading to file %s\n", filename.c_str() );
 
-        if(SD.exists(uploadedFilePath)) SD.remove(uploadedFilePath);
-        file = SD.open(uploadedFilePath, "w"); // create or truncate file
-        if(!file) { request->send(400, "text/plain", "Could not open file"); return; }
-        downloading = true;  notify_observers( WebServerStatusEvent{1} );
+        MotionLimits limits;
+        if(GCodeDevice::getDevice()) limits = GCodeDevice::getDevice()->getMotionLimits(); else limits.setDefaults();
+        if(!writer.begin(uploadedFilePath, GcbWriter::isGCode(uploadedFilePath) ? &limits : nullptr)) { request->send(400, "text/plain", "Could not open file"); return; }
+        downloading = true;  EventBus::getBus().publish(Topic::WEB_STATUS, 1);
 
     }
 
-    if(!file) return;
+    if(!writer.isActive()) return;
 
     //Serial.printf("uploading pos %d if size %d to %s\n", index, len, uploadedFullname.c_str() );
-    file.write(data, len);
+    if(!writer.append(data, len)) {
+        writer.finish();
+        DirCache::get().invalidate(uploadedFilePath);
+        downloading = false;  EventBus::getBus().publish(Topic::WEB_STATUS, 1);
+        request->send(500, "text/plain", "Could not write file");
+        return;
+    }
 
     if (final) { // last chunk
-        Serial.printf("uploaded\n");
         uploadedFileSize = index + len;
-        file.close();
-        downloading = false;  notify_observers( WebServerStatusEvent{1} );
+        bool ok = writer.finish();
+        DirCache::get().invalidate(uploadedFilePath);
+        Serial.printf("uploaded %u bytes at %u KB/s%s\n", uploadedFileSize, writer.getBytesPerSec()/1024, ok ? "" : ", write failed");
+        downloading = false;  EventBus::getBus().publish(Topic::WEB_STATUS, 1);
+        if(!ok) request->send(500, "text/plain", "Could not write file");
     }
 }
 
@@ -458,6 +490,7 @@ void WebServer::registerWebBrowser() {
     static const char fsPrefix[] = "/fs";
     static const char fsPrefixSlash[] = "/fs/";
     static const char fsPrefixLength = strlen(fsPrefixSlash);
+    static const size_t FS_PAGE = 50;   // entries per page of a listing
 
     server.on("/", HTTP_GET, [](AsyncWebServerRequest * request) {
         Serial.printf("Requested /, redirecting to /fs\n" );
@@ -471,12 +504,40 @@ void WebServer::registerWebBrowser() {
         
         Serial.println("listing dir "+sdir);
         File dir = SD.open(sdir);
-
-        if(!dir || !dir.isDirectory()) { dir.close(); request->send(404, "text/plain", "No such file"); return; }
-
-        String resp; resp.reserve(2048);
-        resp += "<html><body>\n<h1>Listing of \""+sdir+"\"</h1>\n<form method='post' enctype='multipart/form-data'><input type='file' name='f'><input type='submit'></form>\n<ul>\n";
-
+        bool isDir = dir && dir.isDirectory();
+        dir.close();
+        if(!isDir) { request->send(404, "text/plain", "No such file"); return; }
+
+        // the listing comes from DirCache, a page at a time; while it is still read, the page reloads itself.
+        // Reloads leave the cache alone, the LCD may have taken it for another directory meanwhile
+        DirCache &cache = DirCache::get();
+        int page = request->hasParam("page") ? request->getParam("page")->value().toInt() : 0;
+        if(page<0) page = 0;
+        bool bySize = request->hasParam("sort") && request->getParam("sort")->value()=="size";
+        String query = bySize ? "&sort=size" : "";
+        bool reload = request->hasParam("reload");
+        if(!reload) {
+            cache.open(sdir);
+            cache.want(DirCache::ALL, page*FS_PAGE, FS_PAGE);
+        }
+        bool covered = cache.getPath()==sdir && cache.covers(DirCache::ALL, page*FS_PAGE, FS_PAGE);
+        if(reload && !covered && (cache.getPath()!=sdir || cache.isComplete())) {
+            request->send(200, "text/html", "<html><body>The display took the listing over, <a href='?page="
+                + String(page) + query + "'>list this page again</a></body></html>");
+            return;
+        }
+        bool complete = cache.isComplete() && covered;
+        size_t count = cache.count(DirCache::ALL);
+
+        String resp; resp.reserve(2048 + FS_PAGE*128);
+        resp += "<html><head>";
+        if(!complete) resp += "<meta http-equiv='refresh' content='1; url=?page="+String(page)+query+"&reload=1'>";
+        resp += "</head><body>\n<h1>Listing of \""+sdir+"\"</h1>\n<form method='post' enctype='multipart/form-data'><input type='file' name='f'><input type='submit'></form>\n";
+        resp += String(count) + (cache.isComplete() ? " entries" : " entries so far") 
+            + (cache.isLarge() ? ", too many to sort: in directory order" : "");
+        resp += ", sort by <a href='?page=0'>name</a> <a href='?page=0&sort=size'>size</a>\n<ul>\n";
+
+        String dirPrefix = sdir.length()>1 ? sdir+"/" : sdir;
         if(sdir.length()>1) {
             int p=sdir.lastIndexOf('/'); 
             resp += "<li><a href=\"";
@@ -484,19 +545,19 @@ void WebServer::registerWebBrowser() {
             resp += sdir.substring(0,p);
             resp += "\">../</a></li>\n";
         }
-        File f;
-        while( f = dir.openNextFile() ) {
-            String fname = f.name(); 
-            int p = fname.lastIndexOf('/'); fname = fname.substring(p+1);
-            if(f.isDirectory())
-                resp += "<li><a href=\"/fs"+String(f.name())+"/\">"+fname+"</a></li>\n";
+        if(covered) cache.list(DirCache::ALL, bySize ? DirCache::BY_SIZE : DirCache::BY_NAME, page*FS_PAGE, FS_PAGE, 
+                [&](const char* name, const DirCache::Entry &e) {
+            String path = dirPrefix + name;
+            if(e.kind & DirCache::DIR)
+                resp += "<li><a href=\"/fs"+path+"/\">"+name+"</a></li>\n";
             else 
-                resp += "<li><a href=\"/fs"+String(f.name())+"\">"+fname+"</a> "+f.size()+"B "+
-                        +"[<a href=\"/api2/print?file="+String(f.name())+"\">print</a>]</li>\n";
-            f.close();
-        }
-        dir.close();
-        resp += "\n</ul>\n</body></html>";
+                resp += "<li><a href=\"/fs"+path+"\">"+name+"</a> "+e.size+"B "+
+                        +"[<a href=\"/api2/print?file="+path+"\">print</a>]</li>\n";
+        });
+        resp += "\n</ul>\n";
+        if(page>0) resp += "<a href='?page="+String(page-1)+query+"'>previous</a> ";
+        if((page+1)*FS_PAGE < count) resp += "<a href='?page="+String(page+1)+query+"'>next</a>";
+        resp += "\n</body></html>";
         request->send(200, "text/html", resp);
     });
     
@@ -539,6 +600,105 @@ void WebServer::registerWebBrowser() {
         req->send(200, "text/plain", "ok");
     } );
 
+    server.on("/api2/resume", HTTP_GET, [](AsyncWebServerRequest * req) {
+        // file and line default to where the job of the selected device was stopped
+        String file;
+        uint32_t line = 0;
+        ResumePoint::load(DeviceRegistry::get().getSelectedIndex(), file, line);
+        if(req->hasParam("file")) file = req->getParam("file")->value();
+        if(req->hasParam("line")) line = req->getParam("line")->value().toInt();
+        Serial.printf("GET %s, file=%s, line=%u\n", req->url().c_str(), file.c_str(), line );
+        if(file.length()==0) {
+            req->send(400, "text/plain", "no file parameter and nothing to resume");
+            return;
+        }
+        if(GCodeDevice::getDevice()==nullptr) {
+            req->send(409, "text/plain", "no device");
+            return;
+        }
+        Job *job = Job::getJob();
+        if(job->isRunning() ) { 
+            req->send(409, "text/plain", "Job is running");
+            return;
+        }
+        job->setFile(file);
+        if(!job->isValid() ){ 
+            req->send(400, "text/plain", "File not found or invalid");
+            return;
+        }
+        if(!job->resumeFrom(line)) {
+            job->cancel();
+            req->send(400, "text/plain", "No such line, or the file has no index yet");
+            return;
+        }
+        job->start();
+        req->send(200, "application/json", "{ \"file\": \"" + file + "\", \"line\": " + String(line) + " }");
+    } );
+
+    server.on("/api2/stats", HTTP_GET, [](AsyncWebServerRequest * req) {
+        // streamed: tasks and topics grow the output, a fixed buffer would truncate it
+        AsyncResponseStream *resp = req->beginResponseStream("application/json");
+        Job *job = Job::getJob();
+        const Display::FrameStats &f = Display::getDisplay()->getFrameStats();
+        resp->printf("{\r\n"
+            "  \"display\": { \"frames\": %u, \"frameUs\": %u, \"avgFrameUs\": %u, \"maxFrameUs\": %u, "
+                "\"droppedFrames\": %u, \"coalesced\": %u, \"spiBytes\": %u },\r\n"
+            "  \"job\": { \"msSinceLastFeed\": %u, \"maxFeedGapMs\": %u, \"starved\": %u, \"line\": %u, \"lines\": %u, "
+                "\"estimatedS\": %.0f, \"estimatedLeftS\": %.0f }",
+            f.frames, f.lastFrameUs, f.avgFrameUs, f.maxFrameUs, f.droppedFrames, f.coalesced, f.totalSpiBytes,
+            job->getMsSinceLastFeed(), job->getMaxFeedGapMs(), job->getStarvedCount(), job->getLineNo(), job->getLineCount(),
+            job->getEstimatedSeconds(), job->getEstimatedSecondsLeft() );
+        GCodeDevice *dev = GCodeDevice::getDevice();
+        if(dev!=nullptr) {
+            const GCodeDevice::StatusStats &st = dev->getStatusStats();
+            const GCodeDevice::WakeStats &ws = dev->getWakeStats();
+            resp->printf(",\r\n"
+                "  \"device\": { \"statusLatencyUs\": %u, \"maxStatusLatencyUs\": %u, \"linesPerWrite\": %.2f, "
+                    "\"idlePercent\": %u, \"wakeLatencyUs\": %u, \"maxWakeLatencyUs\": %u",
+                st.avgLatencyUs, st.maxLatencyUs, dev->getLinesPerWrite(), 
+                100 - dev->getLoad().getStats().busyPercent, ws.avgLatencyUs, ws.maxLatencyUs );
+            if(DeviceDetector::typeOf(dev)==DeviceDetector::TYPE_GRBL) {
+                // null until a status report with Bf: came, e.g. while $10 lacks the buffer bit
+                GrblDevice *grbl = static_cast<GrblDevice*>(dev);
+                if(grbl->getPlannerFill() < 0) resp->printf(
+                    ", \"plannerFill\": null, \"avgPlannerFill\": null, \"bufferReportOff\": %s",
+                    grbl->isBufferReportOff() ? "true" : "false" );
+                else resp->printf(", \"plannerFill\": %.2f, \"avgPlannerFill\": %.2f",
+                    grbl->getPlannerFill(), grbl->getAvgPlannerFill() );
+            }
+            resp->print(" }");
+        }
+        static const char* TOPICS[] = {"jobState", "jobProgress", "deviceStatus", "deviceError", "webStatus"};
+        static_assert(sizeof(TOPICS)/sizeof(*TOPICS)==(size_t)Topic::COUNT, "a name per topic");
+        resp->print(",\r\n  \"events\": {");
+        for(uint8_t t=0; t<(uint8_t)Topic::COUNT; t++) {
+            const EventBus::TopicStats &es = EventBus::getBus().getStats((Topic)t);
+            resp->printf("%s\r\n    \"%s\": { \"published\": %u, \"delivered\": %u, "
+                "\"unchanged\": %u, \"limited\": %u, \"overflows\": %u }", t==0 ? "" : ",", 
+                TOPICS[t], es.published, es.delivered, es.unchanged, es.limited, es.overflows );
+        }
+        const UploadWriter::Stats &us = UploadWriter::get().getStats();
+        resp->printf("\r\n  },\r\n"
+            "  \"upload\": { \"active\": %s, \"bytes\": %u, \"ms\": %u, \"mbPerSec\": %.2f, \"sdMbPerSec\": %.2f, "
+                "\"stalls\": %u, \"stallMs\": %u, \"bufSize\": %u, \"ok\": %s, \"transcoded\": %s, \"lines\": %u, "
+                "\"transcodeMs\": %u },\r\n",
+            UploadWriter::get().isActive() ? "true" : "false", us.bytes, us.elapsedMs, 
+            UploadWriter::get().getBytesPerSec() / 1048576.0f, UploadWriter::get().getWriteBytesPerSec() / 1048576.0f,
+            us.stalls, us.stallMs, us.bufSize, us.ok ? "true" : "false", us.transcoded ? "true" : "false",
+            us.lines, us.transcodeMs );
+        resp->print("  \"tasks\": [");
+        TaskMonitor &tm = TaskMonitor::get();
+        for(size_t i=0; i<tm.size(); i++) {
+            const TaskMonitor::Entry &t = tm[i];
+            const TaskLoad::Stats &ts = t.load->getStats();
+            resp->printf("%s\r\n    { \"name\": \"%s\", \"core\": %d, \"priority\": %u, \"busyPercent\": %u, "
+                "\"maxRunUs\": %u, \"lateWakes\": %u, \"maxLateUs\": %u }", i==0 ? "" : ",",
+                t.name, t.core, t.priority, ts.busyPercent, ts.maxRunUs, ts.lateWakes, ts.maxLateUs );
+        }
+        resp->print("\r\n  ]\r\n}");
+        req->send(resp);
+    } );
+
     server.on("/api2/cmd", HTTP_GET, [](AsyncWebServerRequest * req) {
         if(!req->hasParam("gcode")) {
             Serial.printf("GET %s\n", req->url().c_str() );
@@ -5,20 +5,15 @@
 #include <AsyncTCP.h>
 #include <ArduinoJson.h>   // for implementing a subset of the OctoPrint API
 
-#include <etl/observer.h>
 #include <etl/set.h>
 
-struct WebServerStatusEvent { int statusField; };
-
-typedef etl::observer<const WebServerStatusEvent&> WebServerObserver;
-
-class WebServer : public etl::observable<WebServerObserver, 3> {
+class WebServer {
 public:
     WebServer(uint16_t port=80): server(port), telnetServer(23), port(port) {
         inst = this;
     }
 
-    ~WebServer() { clear_observers(); }
+    ~WebServer() {}
 
     void config(JsonObjectConst cfg = JsonObjectConst() );
 
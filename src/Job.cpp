@@ -1,34 +1,172 @@
 #include "Job.h"
+#include "DeviceRegistry.h"
 
-Job Job::job;
-
-//void Job::setJob(Job* _job) { job = *_job; }
-
-Job * Job::getJob() { return &job; }
+Job * Job::getJob() { return DeviceRegistry::get().getSelectedJob(); }
 
 #define J_DEBUGF(...) // { Serial.printf(__VA_ARGS__); }
 #define J_DEBUGS(s)   // { Serial.println(s); }
 
-void Job::readNextLine() {
-    if(gcodeFile.available()==0) { 
-        stop();
-        return; 
+bool Job::readNextLine(char* &line, int &len) {
+    if(preamblePos < preambleLen) {
+        line = preamble + preamblePos;
+        len = strchr(line, '\n') - line;
+        preamblePos += len+1;
+        return false;
     }
-    while( gcodeFile.available()>0 ) {
-        int rd = gcodeFile.read();
-        filePos++;  if(filePos%200==0) notify_observers(JobStatusEvent{0}); // every Nth byte
-        if(rd=='\n' || rd=='\r') {
-            if(curLinePos!=0) break; // if it's an empty string or LF after last CR, just continue reading
-        } else {
-            if(curLinePos<MAX_LINE) curLine[curLinePos++] = rd;
-            else { 
-                stop(); 
-                J_DEBUGF("Line length exceeded\n");
-                break; 
+    len = useGcb ? gcb.readLine(line) : reader.readLine(line);
+    if(len > 0 && !useGcb) {
+        len = GcodeStripper::strip(line, len);
+        if(len < 0) len = reader.LINE_TOO_LONG;
+    }
+    return true;
+}
+
+void Job::endIndex(bool complete) {
+    indexing = false;
+    if(complete) indexer.finish(); else indexer.abort();
+}
+
+bool Job::prefetch() {
+    bool worked = false;
+    CommandPool &pool = CommandPool::getPool();
+    CommandHandle h = CommandPool::NONE;
+    xSemaphoreTake(fileLock, portMAX_DELAY);
+    if(indexing && !gcodeFile) {
+        // stopped before the end: the rest of the file goes to the sidecar only, a block per call
+        if(!reader.skipBlock()) {
+            endIndex(true);
+            reader.close();
+        }
+        xSemaphoreGive(fileLock);
+        return true;
+    }
+    Line *l;
+    while(gcodeFile && !readerDone && (l = lines.back()) != nullptr) {
+        if(h==CommandPool::NONE) {
+            if(pool.getFree() <= POOL_RESERVE) break;
+            h = pool.alloc();
+            if(h==CommandPool::NONE) break;
+        }
+        char* line;
+        int len;
+        bool fromFile = readNextLine(line, len);
+        l->status = 0;
+        l->cmd = CommandPool::NONE;
+        if(len >= 0) {
+            if(len==0) continue;
+            if(len > (int)CommandPool::MAX_LINE) l->status = reader.LINE_TOO_LONG;
+        } else l->status = len;
+
+        if(l->status == 0) {
+            memcpy(pool.text(h), line, len);    // sidecar lines are not terminated
+            pool.text(h)[len] = 0;
+            pool.setLength(h, len);
+            l->cmd = h;
+            h = CommandPool::NONE;
+            l->seconds = estimator.getSeconds();
+            if(fromFile) {
+                readLines++;
+                if(timed) estimator.update(line, len);
             }
+        } else {
+            J_DEBUGF("EOF, read %d bytes/s, %d lines/s\n", getReadBytesPerSec(), getReadLinesPerSec() );
+            readerDone = true;
+            if(indexing) endIndex(l->status == reader.END);
+        }
+        l->filePos = readerPosition();
+        l->lineNo = readLines;
+        l->gen = gen;
+        lines.push();
+        worked = true;
+    }
+    xSemaphoreGive(fileLock);
+    pool.free(h);
+    if(worked && starved) wakeDevice();
+    return worked;
+}
+
+bool Job::resumeFrom(uint32_t n) {
+    if(running) return false;
+    xSemaphoreTake(fileLock, portMAX_DELAY);
+    bool ok = gcodeFile && useGcb && n < gcb.getHeader().lines;
+    if(ok) {
+        // state at the checkpoint before n, then the lines from there on
+        uint16_t stride = gcb.getHeader().indexStride;
+        GcbIndexEntry e = {};
+        ok = gcb.readEntry(n / stride, e) && gcb.seekLine(n / stride * stride);
+        estimator.begin(gcb.getHeader().limits, e.modal, e.seconds);
+        char* line;
+        int len;
+        while(ok && gcb.getLineNo() < n) {
+            len = gcb.readLine(line);
+            if(len < 0) ok = false; else estimator.update(line, len);
+        }
+        preambleLen = ok && n>0 ? estimator.getModal().preamble(preamble, sizeof(preamble),
+            dev!=nullptr && DeviceDetector::typeOf(dev)==DeviceDetector::TYPE_GRBL) : 0;
+        preamblePos = 0;
+    }
+    if(ok) {
+        readLines = n;
+        readerDone = false;
+        gen++;
+        filePos = readerPosition();
+        lineNo = n;
+        estElapsed = estimator.getSeconds();
+    }
+    xSemaphoreGive(fileLock);
+    if(ok && readerTask!=nullptr) xTaskNotifyGive(readerTask);
+    J_DEBUGF("Resuming at line %u: %s\n", n, ok ? "ok" : "failed");
+    return ok;
+}
+
+void Job::dropStaleLines() {
+    if(curLine!=nullptr && curLine->gen != gen) {
+        CommandPool::getPool().free(curLine->cmd);
+        lines.pop();
+        curLine = nullptr;
+    }
+    Line *l;
+    while( (l = lines.front()) != nullptr && l->gen != gen) {
+        CommandPool::getPool().free(l->cmd);
+        lines.pop();
+    }
+}
+
+bool Job::takeNextLine() {
+    dropStaleLines();
+    Line *l = lines.front();
+    if(l==nullptr) {
+        if(!starved) {
+            starvedCount++;
+            if(readerTask!=nullptr) xTaskNotifyGive(readerTask);
         }
+        starved = true;
+        return false;
+    }
+    starved = false;
+
+    if(l->status == reader.END) {
+        lines.pop();
+        filePos = fileSize;
+        EventBus::getBus().publish(Topic::JOB_PROGRESS, 1000);
+        stop();
+        return false;
+    }
+
+    size_t prevPos = filePos;
+    filePos = l->filePos;
+    if(fileSize != 0) {
+        uint32_t permille = 1000ULL * filePos / fileSize;
+        if(permille != 1000ULL * prevPos / fileSize) EventBus::getBus().publish(Topic::JOB_PROGRESS, permille);
+    }
+    if(l->status != 0) {
+        lines.pop();
+        stop();
+        J_DEBUGF("Line length exceeded or sidecar truncated\n");
+        return false;
     }
-    curLine[curLinePos]=0;
+    curLine = l;
+    return true;
 }
 
 bool Job::scheduleNextCommand(GCodeDevice *dev) {
@@ -38,46 +176,43 @@ bool Job::scheduleNextCommand(GCodeDevice *dev) {
     }
 
     if(paused) return false;
+
+    if(curLine!=nullptr && curLine->gen != gen) dropStaleLines();
     
-    if(curLinePos==0) {
-        readNextLine();
-        if(!running) return false;    // don't run next time
-
-        char* pos = strchr(curLine, ';');
-        if(pos!=NULL) {*pos = 0; curLinePos = pos-curLine; }
-
-        bool empty=false;//true;
-        //for(int i=0; i<curLinePos; i++) if(!isspace(curLine[i])) empty=false;
-
-        if(curLinePos==0 || empty) { return true; } // can seek next
-
-        #ifdef ADD_LINENUMBERS
-            char out[MAX_LINE+1];
-            snprintf(out, MAX_LINE, "N%d %s", ++curLineNum, curLine);
-            uint8_t checksum = 0, count = strlen(out);
-            while (count) checksum ^= out[--count];
-            snprintf(curLine, MAX_LINE, "%s*%d", out, checksum);
-            curLinePos = strlen(curLine);
-        #endif
+    if(curLine==nullptr) {
+        if(!takeNextLine()) return false;
     }
 
-    if(dev->canSchedule(curLinePos)) {        
-        
-        J_DEBUGF("  J queueing line '%s', len %d\n", curLine, curLinePos );
-
-        bool queued = dev->scheduleCommand(curLine, curLinePos);
-        assert(queued);
-
-        curLinePos = 0;
+    J_DEBUGF("  J queueing line '%s'\n", CommandPool::getPool().text(curLine->cmd) );
+
+    if(dev->scheduleCommand(curLine->cmd)) {
+        lineNo = curLine->lineNo;
+        estElapsed = curLine->seconds;
+        uint32_t now = millis();
+        if(now - lastFeedAt > maxFeedGap) maxFeedGap = now - lastFeedAt;
+        lastFeedAt = now;
+        curLine = nullptr;
+        lines.pop();
+        if(readerTask!=nullptr && lines.size() <= RING_LINES/2) xTaskNotifyGive(readerTask);
         return true; //can try next command
 
     } else return false; // stop trying for now
 }
 
 void Job::loop() {
+    Event e;
+    while(EventBus::getBus().receive(events, e)) {
+        if(e.topic==Topic::DEVICE_ERROR && e.value==deviceId && isValid() ) {
+            Serial.println("Device error, canceling job");
+            cancel();
+        }
+    }
+
+    // a stopped job leaves its lines in the ring, they hold CommandPool slots
+    dropStaleLines();
+
     if(!running || paused) return;
 
-    GCodeDevice * dev = GCodeDevice::getDevice();
     if(dev==nullptr) return;
 
     while( scheduleNextCommand(dev) ) {}
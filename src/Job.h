@@ -2,17 +2,16 @@
 
 #include <Arduino.h>
 #include <SD.h>
-#include <etl/observer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 
 #include "devices/GCodeDevice.h"
-
-
-//#define ADD_LINENUMBERS 
-
-//struct JobStatusEvent{  int status;  };
-typedef int JobStatusEvent;
-
-typedef etl::observer<JobStatusEvent> JobObserver;
+#include "EventBus.h"
+#include "LineReader.h"
+#include "GcbReader.h"
+#include "GcbWriter.h"
+#include "SpscRing.h"
 
 
 /**
@@ -33,57 +32,138 @@ typedef etl::observer<JobStatusEvent> JobObserver;
  *   [valid&running&paused]-+------------+
  *    
  * ```
+ *
+ * The file is read by a separate reader task (see prefetch()), which fills a ring of lines 
+ * with comments and empty lines already removed. loop() only takes lines from the ring,
+ * so SD latency does not hold up feeding the device.
+ * If the file has an up to date sidecar (see GcbWriter), lines are read from it instead,
+ * already stripped and with an index to seek by; otherwise the sidecar is built during the first pass.
+ * With a sidecar a job can start in the middle of the file, see resumeFrom(), and its run time is known, 
+ * see getEstimatedSeconds().
+ * Lines are read straight into CommandPool slots, and their handles are passed on to the device.
  */
-class Job : public DeviceObserver, public etl::observable<JobObserver, 3> {
+class Job {
 
 public:
 
+    /// Job of the selected device, see DeviceRegistry
     static Job* getJob();
-    //static void setJob(Job* job);
 
-    ~Job() { if(gcodeFile) gcodeFile.close(); clear_observers(); }
+    Job() { 
+        fileLock = xSemaphoreCreateMutexStatic(&fileLockBuf); 
+        events = EventBus::getBus().subscribe(EventBus::mask(Topic::DEVICE_ERROR) );
+    }
+    ~Job() { closeFiles(); }
 
+    /// Feeds the device from the line ring, cancels on device errors. Call from the device task.
     void loop();
 
+    /** 
+     * Reads lines of the current file into the ring until it is full. Call from the reader task.
+     * @return false if there was nothing to do, the task can wait for a notification then.
+     */
+    bool prefetch();
+    /// The device task should not sleep: lines are waiting to be handed to the device. Call from the device task.
+    bool hasLinesReady() { return running && !paused && (curLine!=nullptr || lines.front()!=nullptr); }
+    /// Task to notify when the ring has space again
+    void setReaderTask(TaskHandle_t task) { readerTask = task; }
+    /// Device the job is sent to and its DeviceRegistry index, for its error events
+    void setDevice(GCodeDevice *d, uint8_t id) { dev = d; deviceId = id; }
+    GCodeDevice* getDevice() { return dev; }
+
     void setFile(String file) { 
-        if(gcodeFile) gcodeFile.close();
+        xSemaphoreTake(fileLock, portMAX_DELAY);
+        closeFiles();
 
         gcodeFile = SD.open(file);
         if(gcodeFile) fileSize = gcodeFile.size();
+        useGcb = false;
+        if(gcodeFile && GcbWriter::isGCode(file) ) {
+            gcbFile = SD.open(GcbWriter::sidecarPath(file));
+            useGcb = gcb.begin(gcbFile) && gcb.getHeader().sourceSize == fileSize;
+            if(!useGcb && gcbFile) gcbFile.close();
+            if(!useGcb) indexing = indexer.begin(file, getMotionLimits());
+        }
+        // an estimate made for other limits is no good, progress goes by file position then
+        timed = useGcb && gcb.getHeader().seconds > 0 && gcb.getHeader().limits == getMotionLimits();
+        estimator.begin(getMotionLimits());
+        estElapsed = 0;
+        if(!useGcb) reader.begin(gcodeFile, indexing ? &indexer : nullptr);
+        readLines = 0;
+        preambleLen = preamblePos = 0;
+        readerDone = false;
+        gen++;  // lines of the previous file still in the ring are dropped by the consumer
+        xSemaphoreGive(fileLock);
+        if(readerTask!=nullptr) xTaskNotifyGive(readerTask);
+
         filePos = 0;
+        lineNo = 0;
         running = false; 
         paused = false;
         cancelled = false;
-        notify_observers(JobStatusEvent{0}); 
-        curLineNum = 0;
+        notifyState(); 
+        starvedCount = 0;
+        starved = false;
+        maxFeedGap = 0;
         startTime=0;
         endTime=0;
     }
 
-    void notification(const DeviceStatusEvent& e) override {
-        if(e.statusField==1 && isValid() ) {
-            Serial.println("Device error, canceling job");
-            cancel();
-        }
-    }
+    /**
+     * Makes the job start at line n of the file instead of the beginning, after the lines that 
+     * restore the modal state the file had there (see GcodeModal). Lines count as in the sidecar, see getLineNo().
+     * Call after setFile(), before start().
+     * @return false if the file has no sidecar yet or no such line
+     */
+    bool resumeFrom(uint32_t n);
 
-    void start() { startTime = millis(); paused=false; running=true;  notify_observers(JobStatusEvent{0}); }
-    void cancel() { cancelled=true; stop(); notify_observers(JobStatusEvent{0});  }
+    void start() { startTime = millis(); lastFeedAt = startTime; maxFeedGap = 0; paused=false; running=true;  notifyState(); wakeDevice(); }
+    void cancel() { cancelled=true; stop(); notifyState();  }
     bool isRunning() {  return running; }
     bool isCancelled() { return cancelled; }
 
     void pause() { setPaused(true);  }
     void resume() { setPaused(false); }
-    void setPaused(bool v) { paused = v; notify_observers(JobStatusEvent{0}); }
+    void setPaused(bool v) { paused = v; if(!v) { lastFeedAt = millis(); wakeDevice(); } notifyState(); }
     bool isPaused() { return paused; }
 
-    float getCompletion() { if(isValid()) return 1.0 * filePos/fileSize; else return 0; }
+    /// By estimated time if there is an estimate, by file position otherwise
+    float getCompletion() { 
+        if(!isValid()) return 0;
+        if(timed) return estElapsed / gcb.getHeader().seconds;
+        return fileSize==0 ? 0 : 1.0 * filePos/fileSize; 
+    }
     size_t getFilePos() { if(isValid()) return filePos; else return 0;}
     size_t getFileSize() { if(isValid()) return fileSize; else return 0;}
     bool isValid() { return (bool)gcodeFile; }
     String getFilename() { if(isValid()) return gcodeFile.name(); else return ""; }
     uint32_t getPrintDuration() { return (endTime!=0 ? endTime : millis())-startTime; }
 
+    /// Lines of the file handed to the device so far; comments and empty lines do not count
+    uint32_t getLineNo() { return lineNo; }
+    /// The sidecar is being built from this (or the last) file
+    bool isIndexing() { return indexing; }
+    /// Lines in the file, 0 while unknown (no sidecar yet)
+    uint32_t getLineCount() { return isValid() && useGcb ? gcb.getHeader().lines : 0; }
+
+    /// Estimated run time of the file, 0 if there is none for the device (no sidecar, or one made for other limits)
+    float getEstimatedSeconds() { return isValid() && timed ? gcb.getHeader().seconds : 0; }
+    /// Estimated time from the line last handed to the device to the end, negative if there is no estimate
+    float getEstimatedSecondsLeft() { return isValid() && timed ? max(0.0f, gcb.getHeader().seconds - estElapsed) : -1; }
+
+    /// SD read throughput of the current (or last) job
+    uint32_t getReadBytesPerSec() { return useGcb ? gcb.getBytesPerSec() : reader.getBytesPerSec(); }
+    /// Lines/s the file reader could supply, compare to what the device consumes
+    uint32_t getReadLinesPerSec() { return useGcb ? gcb.getLinesPerSec() : reader.getLinesPerSec(); }
+    /// The current (or last) job is read from the sidecar
+    bool isUsingSidecar() { return useGcb; }
+    /// Times the device had room for a line but the reader had none ready
+    uint32_t getStarvedCount() { return starvedCount; }
+    /// Time since a line was last handed to the device, 0 when not running
+    uint32_t getMsSinceLastFeed() { return running && !paused ? millis() - lastFeedAt : 0; }
+    /// Longest time between two lines handed to the device in the current (or last) job
+    uint32_t getMaxFeedGapMs() { return maxFeedGap; }
+
 private:
 
     File gcodeFile;
@@ -92,10 +172,46 @@ private:
     uint32_t startTime;
     uint32_t endTime;
     static const int MAX_LINE = 100;
-    char curLine[MAX_LINE+1];
-    size_t curLinePos;
+    static const size_t READ_BLOCK = 2048;
+    LineReader<READ_BLOCK, MAX_LINE> reader;
+    File gcbFile;
+    GcbReader<READ_BLOCK> gcb;
+    bool useGcb = false;
+    GcbWriter indexer;          // builds the sidecar while a file without one is read
+    bool indexing = false;
+    TimeEstimator estimator;    // follows the lines read from the sidecar
+    bool timed = false;         // the sidecar's estimate is for the device's limits
+    float estElapsed;           // estimated time before the line last handed to the device
+    static const size_t PREAMBLE_SIZE = 256;
+    char preamble[PREAMBLE_SIZE];   // lines sent before a resumed job, see resumeFrom()
+    uint16_t preambleLen = 0;
+    uint16_t preamblePos = 0;
+    uint32_t readLines;         // file lines put into the ring
+    uint32_t lineNo;            // file lines handed to the device
+    bool readerDone;
+    SemaphoreHandle_t fileLock; // files and readers are shared between the reader task and setFile()/stop()
+    StaticSemaphore_t fileLockBuf;
+    TaskHandle_t readerTask = nullptr;
+    GCodeDevice *dev = nullptr;
+    uint8_t deviceId = 0;
 
-    size_t curLineNum;
+    struct Line {
+        CommandHandle cmd;  // NONE for the end markers below
+        int status;         // 0, or LineReader END/LINE_TOO_LONG or GcbReader END/BAD_FILE
+        uint32_t filePos;   // file position after this line
+        uint32_t lineNo;    // file lines up to and including this one
+        float seconds;      // estimated time before this line
+        uint32_t gen;
+    };
+    static const size_t RING_LINES = 32;
+    static const size_t POOL_RESERVE = 16; // CommandPool slots the reader leaves for UI and web commands
+    SpscRing<Line, RING_LINES> lines;
+    std::atomic<uint32_t> gen;  // bumped on every setFile()
+    Line *curLine;              // taken from the ring, not yet scheduled
+    uint32_t starvedCount;
+    bool starved;
+    uint32_t lastFeedAt;
+    uint32_t maxFeedGap;
 
     //float percentage = 0;
     bool running;
@@ -106,13 +222,41 @@ private:
         paused = false;
         running = false; 
         endTime=millis();
+        xSemaphoreTake(fileLock, portMAX_DELAY);
+        if(indexing) gcodeFile = File(); // the reader keeps it open to read the rest into the sidecar, see prefetch()
+        else closeFiles();
+        gen++;  // the device task frees the lines left in the ring, see dropStaleLines()
+        xSemaphoreGive(fileLock);
+        wakeDevice();
+        notifyState(); 
+    }
+    void closeFiles() {
+        if(indexing) { indexer.abort(); indexing = false; }
         if(gcodeFile) gcodeFile.close();
-        notify_observers(JobStatusEvent{0}); 
+        if(gcbFile) gcbFile.close();
     }
-    void readNextLine();
-    bool scheduleNextCommand(GCodeDevice *dev);
+    /// Position in the G-code file, for progress
+    uint32_t readerPosition() { 
+        if(!useGcb) return reader.position(); 
+        const GcbHeader &h = gcb.getHeader();
+        return h.dataSize==0 ? fileSize : 1ULL * gcb.position() * fileSize / h.dataSize;
+    }
+    EventBus::Subscriber events;
 
+    MotionLimits getMotionLimits() {
+        MotionLimits l;
+        if(dev!=nullptr) l = dev->getMotionLimits(); else l.setDefaults();
+        return l;
+    }
 
-    static Job job;
+    void notifyState() { EventBus::getBus().publish(Topic::JOB_STATE); }
+    void wakeDevice() { if(dev!=nullptr) dev->wake(); }
+
+    bool takeNextLine();
+    /// Frees lines of a stopped or replaced file; the ring's consumer side, so device task only
+    void dropStaleLines();
+    bool readNextLine(char* &line, int &len);
+    void endIndex(bool complete);
+    bool scheduleNextCommand(GCodeDevice *dev);
 
 };
\ No newline at end of file
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+
+#include "GcbWriter.h"
+
+/**
+ * Splits a file into lines, reading it BLOCK bytes at a time (keep it a multiple of 512, the SD sector size).
+ *
+ * Lines are terminated in place; the returned pointer is valid until the next readLine().
+ * CR, LF and CRLF all end a line; empty lines are skipped.
+ * Every block read can also go to a GcbWriter, to build the sidecar of the file on the first pass.
+ */
+template<size_t BLOCK = 2048, size_t MAX_LINE = 100>
+class LineReader {
+public:
+
+    static const int END = -1;
+    static const int LINE_TOO_LONG = -2;
+
+    void begin(File f, GcbWriter *sink = nullptr) {
+        file = f;
+        this->sink = sink;
+        start = scan = end = 0;
+        eof = false;
+        skipLF = false;
+        consumed = 0;
+        bytesRead = 0;
+        linesRead = 0;
+        readUs = 0;
+        busyUs = 0;
+    }
+
+    /** @return line length, END at end of file or LINE_TOO_LONG */
+    int readLine(char* &line) {
+        uint32_t t = micros();
+        int ret;
+        do { ret = nextLine(line); } while(ret==0);
+        busyUs += micros()-t;
+        return ret;
+    }
+
+    /// Drops what is buffered and reads the next block for the sink only; false at end of file
+    bool skipBlock() {
+        start = scan = end = 0;
+        fill();
+        return !eof;
+    }
+
+    void close() { file.close(); }
+
+    /** Bytes of the file consumed by returned lines, including line endings */
+    size_t position() const { return consumed; }
+
+    size_t getBytesRead() const { return bytesRead; }
+    size_t getLinesRead() const { return linesRead; }
+    /// SD read speed, time spent in File::read() only
+    uint32_t getBytesPerSec() const { return readUs==0 ? 0 : 1000000ULL * bytesRead / readUs; }
+    /// How fast lines could be supplied, time spent in readLine()
+    uint32_t getLinesPerSec() const { return busyUs==0 ? 0 : 1000000ULL * linesRead / busyUs; }
+
+private:
+
+    File file;
+    GcbWriter *sink;
+    char buf[BLOCK + MAX_LINE + 1];
+    size_t start, scan, end;
+    bool eof;
+    bool skipLF;
+
+    size_t consumed;
+    size_t bytesRead;
+    size_t linesRead;
+    uint32_t readUs;
+    uint32_t busyUs;
+
+    int nextLine(char* &line) {
+        while(true) {
+            if(skipLF && start<end) {
+                skipLF = false;
+                if(buf[start]=='\n') { start++; consumed++; }
+                if(scan<start) scan = start;
+            }
+            for(; scan<end; scan++) {
+                char c = buf[scan];
+                if(c=='\n' || c=='\r') {
+                    buf[scan] = 0;
+                    line = buf+start;
+                    int len = scan-start;
+                    consumed += len+1;
+                    start = ++scan;
+                    skipLF = c=='\r';
+                    if(len!=0) linesRead++;
+                    return len;
+                }
+            }
+            if(end-start > MAX_LINE) return LINE_TOO_LONG;
+            if(eof) {
+                if(start==end) return END;
+                buf[end] = 0;
+                line = buf+start;
+                int len = end-start;
+                consumed += len;
+                start = scan = end;
+                linesRead++;
+                return len;
+            }
+            fill();
+        }
+    }
+
+    void fill() {
+        // move the incomplete line to the front, then read a whole block after it
+        if(start!=0) {
+            memmove(buf, buf+start, end-start);
+            end -= start;
+            scan -= start;
+            start = 0;
+        }
+        uint32_t t = micros();
+        size_t n = file.read((uint8_t*)buf+end, BLOCK);
+        readUs += micros()-t;
+        if(n==0) eof = true;
+        if(sink!=nullptr) sink->feed((uint8_t*)buf+end, n);
+        end += n;
+        bytesRead += n;
+    }
+
+};
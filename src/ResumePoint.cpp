@@ -0,0 +1,57 @@
+#include "ResumePoint.h"
+#include "DeviceRegistry.h"
+
+#include <Preferences.h>
+
+static uint32_t lastSave[DeviceRegistry::MAX_DEVICES];
+static uint32_t savedLine[DeviceRegistry::MAX_DEVICES];
+static bool wasRunning[DeviceRegistry::MAX_DEVICES];
+
+static void key(char* buf, size_t size, const char* name, size_t i) { snprintf(buf, size, "%s%u", name, (unsigned)i); }
+
+static void save(size_t i, Job *job, bool withFile) {
+    Preferences prefs;
+    prefs.begin("resume", false);
+    char k[8];
+    if(withFile) { key(k, sizeof(k), "file", i); prefs.putString(k, job->getFilename()); }
+    key(k, sizeof(k), "line", i);
+    prefs.putUInt(k, job->getLineNo());
+    prefs.end();
+    lastSave[i] = millis();
+    savedLine[i] = job->getLineNo();
+}
+
+void ResumePoint::update(size_t i, Job *job) {
+    if(job->isRunning()) {
+        if(!wasRunning[i]) save(i, job, true);
+        else if(millis() - lastSave[i] >= SAVE_INTERVAL && job->getLineNo() != savedLine[i]) save(i, job, false);
+        wasRunning[i] = true;
+    } else if(wasRunning[i]) {
+        wasRunning[i] = false;
+        if(job->isCancelled()) save(i, job, false);
+        else clear(i);
+    }
+}
+
+bool ResumePoint::load(size_t i, String &file, uint32_t &line) {
+    Preferences prefs;
+    prefs.begin("resume", true);
+    char k[8];
+    key(k, sizeof(k), "file", i);
+    file = prefs.getString(k, "");
+    key(k, sizeof(k), "line", i);
+    line = prefs.getUInt(k, 0);
+    prefs.end();
+    return file.length() != 0;
+}
+
+void ResumePoint::clear(size_t i) {
+    Preferences prefs;
+    prefs.begin("resume", false);
+    char k[8];
+    key(k, sizeof(k), "file", i);
+    prefs.remove(k);
+    key(k, sizeof(k), "line", i);
+    prefs.remove(k);
+    prefs.end();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "Job.h"
+
+/**
+ * Where the job of each device got to, kept in NVS (namespace "resume"), so that a job stopped
+ * by an alarm or a power loss can be continued with Job::resumeFrom().
+ *
+ * The line is the last one handed to the device; lines still in its planner may not have run.
+ * The point is dropped when a job runs to its end.
+ */
+class ResumePoint {
+public:
+
+    static const uint32_t SAVE_INTERVAL = 10000;   ///< ms between saves while a job runs, to spare the flash
+
+    /// Call periodically for the job of device i, from its reader task
+    static void update(size_t i, Job *job);
+    /// @return false if device i has no saved point
+    static bool load(size_t i, String &file, uint32_t &line);
+    static void clear(size_t i);
+
+};
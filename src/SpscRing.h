@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * Lock-free ring of N slots for exactly one producer task and one consumer task.
+ *
+ * Slots are used in place: the producer fills back() and publishes it with push(),
+ * the consumer reads front() and hands it back with pop(). N must be a power of two.
+ * The producer side is forced inline, so an IRAM_ATTR ISR can use it without calling into flash.
+ */
+template<typename T, size_t N>
+class SpscRing {
+    static_assert( (N & (N-1)) == 0, "SpscRing size must be a power of two");
+public:
+
+    SpscRing(): head(0), tail(0) {}
+
+    /// Producer side: slot to fill, nullptr if the ring is full
+    __attribute__((always_inline)) T* back() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) == N) return nullptr;
+        return &slots[h & (N-1)];
+    }
+    __attribute__((always_inline)) void push() { head.store(head.load(std::memory_order_relaxed)+1, std::memory_order_release); }
+
+    /// Consumer side: oldest filled slot, nullptr if the ring is empty
+    T* front() {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(head.load(std::memory_order_acquire) == t) return nullptr;
+        return &slots[t & (N-1)];
+    }
+    void pop() { tail.store(tail.load(std::memory_order_relaxed)+1, std::memory_order_release); }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool empty() const { return size()==0; }
+    static constexpr size_t capacity() { return N; }
+
+private:
+    T slots[N];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
@@ -0,0 +1,18 @@
+#include "TaskMonitor.h"
+
+TaskMonitor& TaskMonitor::get() {
+    static TaskMonitor monitor;
+    return monitor;
+}
+
+bool TaskMonitor::add(const char* name, int8_t core, uint8_t priority, TaskLoad *load) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    size_t i = count.load(std::memory_order_relaxed);
+    bool ret = i < MAX_TASKS;
+    if(ret) {
+        entries[i] = Entry{name, core, priority, load};
+        count.store(i+1, std::memory_order_release);
+    }
+    xSemaphoreGive(lock);
+    return ret;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <atomic>
+
+/**
+ * CPU use of one task, measured by the task itself.
+ *
+ * The task blocks through notifyTake(), queueReceive() or delay(), and everything outside of them counts as busy.
+ * A timed wait that ends more than a tick after its timeout is a late wake: the task was ready,
+ * but something else held its core.
+ */
+class TaskLoad {
+public:
+
+    static const uint32_t WINDOW_US = 1000000;
+
+    struct Stats {
+        uint8_t busyPercent;    ///< during the last second
+        uint32_t maxRunUs;      ///< longest stretch without blocking during the last second
+        uint32_t lateWakes;
+        uint32_t maxLateUs;
+    };
+
+    /// ulTaskNotifyTake() with accounting
+    uint32_t notifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+        uint32_t start = beginWait();
+        uint32_t ret = ulTaskNotifyTake(clearOnExit, ticks);
+        endWait(start, ticks, ret!=0);
+        return ret;
+    }
+
+    /// xQueueReceive() with accounting
+    BaseType_t queueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+        uint32_t start = beginWait();
+        BaseType_t ret = xQueueReceive(q, item, ticks);
+        endWait(start, ticks, ret==pdTRUE);
+        return ret;
+    }
+
+    /// vTaskDelay() with accounting
+    void delay(TickType_t ticks) {
+        uint32_t start = beginWait();
+        vTaskDelay(ticks);
+        endWait(start, ticks, false);
+    }
+
+    const Stats & getStats() { return stats; }
+
+private:
+
+    Stats stats = {};
+    uint32_t windowStart = 0;
+    uint32_t waitUs = 0;
+    uint32_t maxRunUs = 0;
+    uint32_t lastWaitEnd = 0;
+
+    uint32_t beginWait() {
+        uint32_t now = micros();
+        if(windowStart==0) windowStart = lastWaitEnd = now;
+        if(now - lastWaitEnd > maxRunUs) maxRunUs = now - lastWaitEnd;
+        return now;
+    }
+
+    void endWait(uint32_t start, TickType_t ticks, bool notified) {
+        uint32_t now = micros();
+        uint32_t waited = now - start;
+        waitUs += waited;
+        lastWaitEnd = now;
+        if(!notified && ticks!=portMAX_DELAY) {
+            uint32_t dueUs = (ticks + 1) * portTICK_PERIOD_MS * 1000;
+            if(waited > dueUs) {
+                stats.lateWakes++;
+                if(waited - dueUs > stats.maxLateUs) stats.maxLateUs = waited - dueUs;
+            }
+        }
+        uint32_t elapsed = now - windowStart;
+        if(elapsed >= WINDOW_US) {
+            stats.busyPercent = waitUs >= elapsed ? 0 : 100ULL * (elapsed - waitUs) / elapsed;
+            stats.maxRunUs = maxRunUs;
+            windowStart = now;
+            waitUs = 0;
+            maxRunUs = 0;
+        }
+    }
+};
+
+
+/**
+ * The firmware's own tasks with their placement and load, for the web API.
+ */
+class TaskMonitor {
+public:
+
+    static const size_t MAX_TASKS = 8;
+
+    struct Entry {
+        const char* name;
+        int8_t core;
+        uint8_t priority;
+        TaskLoad *load;
+    };
+
+    static TaskMonitor& get();
+
+    TaskMonitor() { lock = xSemaphoreCreateMutexStatic(&lockBuf); }
+
+    /// Any task; false if there are too many
+    bool add(const char* name, int8_t core, uint8_t priority, TaskLoad *load);
+
+    size_t size() { return count.load(std::memory_order_acquire); }
+    const Entry & operator[](size_t i) { return entries[i]; }
+
+private:
+
+    Entry entries[MAX_TASKS];
+    std::atomic<size_t> count{0};
+
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lockBuf;
+};
@@ -0,0 +1,116 @@
+#include "TimeEstimator.h"
+
+void TimeEstimator::begin(const MotionLimits &limits, const GcodeModal &modal, float seconds) {
+    this->limits = limits;
+    this->modal = modal;
+    this->seconds = seconds;
+    pending = {};
+    entrySpeed = 0;
+    float unit = (modal.flags & GcodeModal::INCHES) ? 25.4f : 1;
+    for(int i=0; i<3; i++) pos[i] = (modal.flags & (GcodeModal::X_KNOWN << i)) ? modal.pos[i]*unit : 0;
+    pos[3] = 0;
+}
+
+void TimeEstimator::update(const char* line, size_t len) {
+    GcodeWords w;
+    if(!w.parse(line, len)) return;
+    modal.update(w);    // units, distance mode and feed of a line apply to its own move
+    float unit = (modal.flags & GcodeModal::INCHES) ? 25.4f : 1;
+
+    if(w.hasG(4)) {
+        flush(0);
+        if(w.hasParam(GcodeWords::P)) seconds += w.value[GcodeWords::P] / ((limits.flags & MotionLimits::DWELL_SECONDS) ? 1 : 1000);
+        if(w.hasParam(GcodeWords::S)) seconds += w.value[GcodeWords::S];
+        return;
+    }
+    if(w.hasG(92)) {
+        for(int i=0; i<4; i++) if(w.hasParam((GcodeWords::Param)i)) pos[i] = w.value[i]*unit;
+        return;
+    }
+    if(w.hasG(28)) {
+        flush(0);
+        bool all = (w.has & 7) == 0;
+        for(int i=0; i<3; i++) if(all || w.hasParam((GcodeWords::Param)i)) pos[i] = 0;
+        return;
+    }
+    if(!GcodeModal::isPositional(w) || (w.has & 15) == 0) return;
+
+    bool relative = modal.flags & GcodeModal::RELATIVE;
+    bool relativeE = relative || (modal.flags & GcodeModal::E_RELATIVE);
+    float target[4];
+    for(int i=0; i<4; i++) {
+        if(!w.hasParam((GcodeWords::Param)i)) { target[i] = pos[i]; continue; }
+        float v = w.value[i]*unit;
+        target[i] = (i<3 ? relative : relativeE) ? pos[i]+v : v;
+    }
+    bool arc = modal.motion>=2 && (w.hasParam(GcodeWords::I) || w.hasParam(GcodeWords::J));
+    addMove(target, arc, w);
+}
+
+void TimeEstimator::addMove(const float target[4], bool arc, const GcodeWords &w) {
+    float d[4];
+    for(int i=0; i<4; i++) d[i] = target[i]-pos[i];
+    float xyz = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    float length = xyz;
+    if(arc) {
+        float unit = (modal.flags & GcodeModal::INCHES) ? 25.4f : 1;
+        float cx = pos[0] + (w.hasParam(GcodeWords::I) ? w.value[GcodeWords::I]*unit : 0);
+        float cy = pos[1] + (w.hasParam(GcodeWords::J) ? w.value[GcodeWords::J]*unit : 0);
+        float r = hypotf(pos[0]-cx, pos[1]-cy);
+        float sweep = atan2f(target[1]-cy, target[0]-cx) - atan2f(pos[1]-cy, pos[0]-cx);
+        if(modal.motion==2) { if(sweep>=0) sweep -= 2*(float)M_PI; }  // clockwise
+        else if(sweep<=0) sweep += 2*(float)M_PI;
+        length = hypotf(fabsf(sweep)*r, d[2]);
+    }
+    if(length==0) length = fabsf(d[3]);    // extruder only
+    for(int i=0; i<4; i++) pos[i] = target[i];
+    if(length==0) return;
+
+    Move m;
+    for(int i=0; i<3; i++) m.dir[i] = xyz==0 ? 0 : d[i]/xyz;
+    // the feed along the move, cut so that no axis goes over its own limits
+    float unit = (modal.flags & GcodeModal::INCHES) ? 25.4f : 1;
+    m.speed = modal.motion==0 || modal.feed<=0 ? INFINITY : modal.feed*unit/60;
+    m.accel = INFINITY;
+    for(int i=0; i<4; i++) {
+        float share = fabsf(d[i]) / length;
+        if(share<=0) continue;
+        m.speed = fminf(m.speed, limits.maxRate[i]/share);
+        m.accel = fminf(m.accel, limits.maxAccel[i]/share);
+    }
+    if(isinf(m.speed)) m.speed = limits.maxRate[0];     // full circle
+    if(isinf(m.accel)) m.accel = limits.maxAccel[0];
+    m.length = length;
+    flush(junctionSpeed(m));
+    pending = m;
+}
+
+float TimeEstimator::junctionSpeed(const Move &next) {
+    if(pending.length==0) return 0;
+    // Grbl: the corner is taken as an arc that deviates JUNCTION_DEVIATION from it, at centripetal acceleration
+    float cosTheta = -(pending.dir[0]*next.dir[0] + pending.dir[1]*next.dir[1] + pending.dir[2]*next.dir[2]);
+    float vmax = fminf(pending.speed, next.speed);
+    if(cosTheta > 0.999999f) return 0;     // reversal, or a move without XYZ
+    if(cosTheta < -0.999999f) return vmax;  // straight on
+    float sinHalf = sqrtf(0.5f*(1-cosTheta));
+    float a = fminf(pending.accel, next.accel);
+    return fminf(vmax, sqrtf(a * JUNCTION_DEVIATION * sinHalf / (1-sinHalf)));
+}
+
+void TimeEstimator::flush(float exitSpeed) {
+    if(pending.length==0) { entrySpeed = 0; return; }
+    float a = pending.accel, l = pending.length, v = pending.speed;
+    float v0 = entrySpeed;
+    float v1 = fminf(exitSpeed, sqrtf(v0*v0 + 2*a*l));
+    v0 = fminf(v0, sqrtf(v1*v1 + 2*a*l));
+    float accelDist = (v*v - v0*v0) / (2*a);
+    float decelDist = (v*v - v1*v1) / (2*a);
+    if(accelDist + decelDist <= l) seconds += (v-v0)/a + (v-v1)/a + (l-accelDist-decelDist)/v;
+    else {
+        // triangle: no time at the feed
+        float peak = sqrtf((2*a*l + v0*v0 + v1*v1) / 2);
+        seconds += (peak-v0)/a + (peak-v1)/a;
+    }
+    pending.length = 0;
+    entrySpeed = v1;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "GcodeModal.h"
+
+/**
+ * Speed and acceleration limits of a machine per axis (X, Y, Z, E),
+ * from Grbl `$110`-`$122` or Marlin `M203`/`M201` (see GCodeDevice::getMotionLimits()).
+ */
+struct MotionLimits {
+
+    enum Flags: uint32_t { DWELL_SECONDS = 1 };    ///< G4 P is seconds (Grbl), not milliseconds (Marlin)
+
+    float maxRate[4];       ///< mm/s
+    float maxAccel[4];      ///< mm/s²
+    uint32_t flags;
+
+    /// Until the device reports its own: a middling printer or router
+    void setDefaults() {
+        const float rate[4] = {100, 100, 10, 50};
+        const float accel[4] = {500, 500, 100, 1000};
+        memcpy(maxRate, rate, sizeof(rate));
+        memcpy(maxAccel, accel, sizeof(accel));
+        flags = 0;
+    }
+
+    bool operator==(const MotionLimits &o) const { return memcmp(this, &o, sizeof(o))==0; }
+    bool operator!=(const MotionLimits &o) const { return !(*this==o); }
+};
+
+
+/**
+ * Running time of a G-code program on a machine with the given limits, line by line.
+ *
+ * Every move is a trapezoid: it accelerates from its entry speed towards its feed and decelerates
+ * to its exit speed. The speed at a corner follows Grbl's junction deviation and is cut to what
+ * acceleration allows within the move, so a move is timed once the next one is known.
+ * There is no look-ahead past that, runs of tiny segments come out a bit optimistic.
+ * Arcs count with their length in the XY plane; homing takes no time.
+ */
+class TimeEstimator {
+public:
+
+    static constexpr float JUNCTION_DEVIATION = 0.01f;   ///< mm, Grbl's default $11
+
+    void begin(const MotionLimits &limits) {
+        GcodeModal m;
+        m.reset();
+        begin(limits, m, 0);
+    }
+    /// Continues from a checkpoint: the modal state and the time before its line
+    void begin(const MotionLimits &limits, const GcodeModal &modal, float seconds);
+
+    /// Next stripped line (see GcodeStripper)
+    void update(const char* line, size_t len);
+
+    /// Time of the lines so far, but for the last move, which is timed with the next one
+    float getSeconds() const { return seconds; }
+    /// Times the last move too, ending at rest; @return time of all the lines
+    float finish() { flush(0); return seconds; }
+
+    const GcodeModal & getModal() const { return modal; }
+
+private:
+
+    struct Move {
+        float length;       ///< mm, 0 if there is none pending
+        float speed;        ///< mm/s, cruise
+        float accel;        ///< mm/s²
+        float dir[3];       ///< unit vector in XYZ, 0 for extruder only moves
+    };
+
+    MotionLimits limits;
+    GcodeModal modal;
+    float pos[4];           ///< mm
+    double seconds;
+    Move pending;
+    float entrySpeed;       ///< of the pending move
+
+    void addMove(const float target[4], bool arc, const GcodeWords &w);
+    float junctionSpeed(const Move &next);
+    void flush(float exitSpeed);
+};
@@ -0,0 +1,152 @@
+#include "UploadWriter.h"
+
+#define UW_DEBUGF(...) // { Serial.printf(__VA_ARGS__); }
+
+UploadWriter& UploadWriter::get() {
+    static UploadWriter writer;
+    return writer;
+}
+
+UploadWriter::UploadWriter() {
+    fullQueue = xQueueCreate(N_BUFS+1, sizeof(Block));    // room for every buffer and the CLOSE
+    freeQueue = xQueueCreate(N_BUFS, sizeof(uint8_t));
+    doneQueue = xQueueCreate(1, sizeof(bool));
+}
+
+bool UploadWriter::allocBuffers() {
+    for(size_t size = MAX_BUF_SIZE; size >= MIN_BUF_SIZE; size /= 2) {
+        size_t i;
+        for(i=0; i<N_BUFS; i++)
+            if( (bufs[i] = (uint8_t*)malloc(size)) == nullptr) break;
+        if(i==N_BUFS) { bufSize = size; return true; }
+        freeBuffers();
+    }
+    return false;
+}
+
+void UploadWriter::freeBuffers() {
+    for(uint8_t* &b: bufs) { free(b); b = nullptr; }
+    bufSize = 0;
+}
+
+bool UploadWriter::begin(const String &path, const MotionLimits *transcodeLimits) {
+    if(active) finish();
+    if(writerTask==nullptr) return false;
+
+    if(SD.exists(path)) SD.remove(path);
+    GcbWriter::removeSidecar(path);
+    file = SD.open(path, FILE_WRITE); // create or truncate file
+    if(!file) return false;
+    if(!allocBuffers()) {
+        UW_DEBUGF("No memory for upload buffers\n");
+        file.close();
+        return false;
+    }
+    transcode = transcodeLimits!=nullptr && transcoder.begin(path, *transcodeLimits);
+    xQueueReset(freeQueue);
+    for(uint8_t i=0; i<N_BUFS; i++) xQueueSend(freeQueue, &i, 0);
+    cur = -1;
+    curLen = 0;
+    failed = false;
+    active = true;
+    stats = {};
+    stats.bufSize = bufSize;
+    writeUs = 0;
+    transcodeUs = 0;
+    startMs = millis();
+    return true;
+}
+
+bool UploadWriter::takeBuffer() {
+    uint8_t b;
+    if(xQueueReceive(freeQueue, &b, 0) != pdTRUE) {
+        // both buffers are with the writer; not returning holds back the TCP ack
+        uint32_t t = millis();
+        stats.stalls++;
+        bool ok = xQueueReceive(freeQueue, &b, pdMS_TO_TICKS(APPEND_TIMEOUT)) == pdTRUE;
+        stats.stallMs += millis() - t;
+        if(!ok) return false;
+    }
+    cur = b;
+    curLen = 0;
+    return true;
+}
+
+void UploadWriter::sendBuffer() {
+    Block b{ (uint8_t)cur, (uint32_t)curLen };
+    cur = -1;
+    xQueueSend(fullQueue, &b, portMAX_DELAY);
+}
+
+bool UploadWriter::append(const uint8_t *data, size_t len) {
+    if(!active || failed) return false;
+    stats.bytes += len;
+    while(len > 0) {
+        if(cur<0 && !takeBuffer()) {
+            UW_DEBUGF("Upload stalled for %u ms, giving up\n", APPEND_TIMEOUT);
+            failed = true;
+            return false;
+        }
+        size_t n = bufSize - curLen;
+        if(n > len) n = len;
+        memcpy(bufs[cur] + curLen, data, n);
+        curLen += n;
+        data += n;
+        len -= n;
+        if(curLen == bufSize) sendBuffer();
+    }
+    return true;
+}
+
+bool UploadWriter::finish() {
+    if(!active) return false;
+    if(cur>=0) {
+        if(curLen>0) sendBuffer();
+        else { uint8_t b = cur; xQueueSend(freeQueue, &b, 0); cur = -1; }
+    }
+    Block close{ 0, CLOSE };
+    xQueueSend(fullQueue, &close, portMAX_DELAY);
+    bool transcoded;
+    xQueueReceive(doneQueue, &transcoded, portMAX_DELAY);
+    // the writer takes blocks in order, so every buffer is back by now
+    freeBuffers();
+    active = false;
+    stats.elapsedMs = millis() - startMs;
+    stats.ok = !failed;
+    stats.transcoded = transcode && transcoded;
+    stats.lines = stats.transcoded ? transcoder.getLines() : 0;
+    stats.transcodeMs = transcodeUs / 1000;
+    UW_DEBUGF("Upload of %u bytes took %u ms, %u ms writing\n", stats.bytes, stats.elapsedMs, stats.writeMs);
+    return stats.ok;
+}
+
+void UploadWriter::writerLoop() {
+    Block b;
+    while(1) {
+        if(load.queueReceive(fullQueue, &b, portMAX_DELAY) != pdTRUE) continue;
+        if(b.len == CLOSE) {
+            file.close();
+            bool transcoded = false;
+            if(transcode) {
+                uint32_t t = micros();
+                if(failed) transcoder.abort();
+                else transcoded = transcoder.finish();
+                transcodeUs += micros() - t;
+            }
+            xQueueSend(doneQueue, &transcoded, portMAX_DELAY);
+            continue;
+        }
+        if(!failed) {
+            uint32_t t = micros();
+            if(file.write(bufs[b.buf], b.len) != b.len) failed = true;
+            writeUs += micros() - t;
+            stats.writeMs = writeUs / 1000;
+        }
+        if(transcode && !failed) {
+            uint32_t t = micros();
+            transcoder.feed(bufs[b.buf], b.len);
+            transcodeUs += micros() - t;
+        }
+        xQueueSend(freeQueue, &b.buf, portMAX_DELAY);
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "TaskMonitor.h"
+#include "GcbWriter.h"
+
+/**
+ * Writes uploaded files to SD from its own task.
+ *
+ * The web server hands over TCP segment sized, unaligned chunks; they are collected into
+ * buffers of up to MAX_BUF_SIZE (a multiple of the 512 byte sector), and the writer task writes
+ * each buffer whole, so the card gets aligned multi-sector writes instead of read-modify-write cycles.
+ * While all buffers wait for the card, append() blocks: the chunk is not acknowledged,
+ * and the TCP receive window closes until the writer catches up.
+ * G-code files are converted to their sidecar (see GcbWriter) by the writer task as they are written.
+ */
+class UploadWriter {
+public:
+
+    static const size_t MAX_BUF_SIZE = 16*1024;
+    static const size_t MIN_BUF_SIZE = 8*1024;     ///< if the heap has no room for the larger buffers
+    static const size_t N_BUFS = 2;
+    static const uint32_t APPEND_TIMEOUT = 3000;   ///< ms; a card that stalls longer fails the upload
+
+    struct Stats {
+        uint32_t bytes;
+        uint32_t elapsedMs;     ///< from begin() to the file being closed
+        uint32_t writeMs;       ///< time spent in File::write()
+        uint32_t stalls;        ///< append() calls that had to wait for a buffer
+        uint32_t stallMs;
+        uint16_t bufSize;
+        bool ok;
+        bool transcoded;        ///< a sidecar was written
+        uint32_t lines;         ///< of the sidecar
+        uint32_t transcodeMs;
+    };
+
+    static UploadWriter& get();
+
+    UploadWriter();
+
+    /** Writer task body, never returns */
+    void writerLoop();
+    void setWriterTask(TaskHandle_t t) { writerTask = t; }
+    TaskLoad & getLoad() { return load; }
+
+    /**
+     * Creates (or truncates) path and allocates the buffers.
+     * An upload that was never finished (the client went away) is closed first.
+     * A stale sidecar of path is removed; with transcodeLimits, a new one is written along,
+     * timed for a machine with these limits.
+     */
+    bool begin(const String &path, const MotionLimits *transcodeLimits = nullptr);
+    /// false if the upload failed; the rest of it is then dropped
+    bool append(const uint8_t *data, size_t len);
+    /// Writes what is left and closes the file; false if anything could not be written
+    bool finish();
+
+    bool isActive() { return active; }
+
+    /// Current upload, or the last one
+    const Stats & getStats() { return stats; }
+    /// Upload speed so far, bytes per second
+    uint32_t getBytesPerSec() { 
+        uint32_t ms = active ? millis() - startMs : stats.elapsedMs;
+        return ms==0 ? 0 : 1000ULL * stats.bytes / ms; 
+    }
+    /// Card write speed alone
+    uint32_t getWriteBytesPerSec() { return stats.writeMs==0 ? 0 : 1000ULL * stats.bytes / stats.writeMs; }
+
+private:
+
+    struct Block {
+        uint8_t buf;
+        uint32_t len;   ///< CLOSE to close the file
+    };
+    static const uint32_t CLOSE = 0xFFFFFFFF;
+
+    File file;
+    uint8_t *bufs[N_BUFS] = {};
+    size_t bufSize = 0;
+    int8_t cur = -1;        ///< buffer being filled by append()
+    size_t curLen = 0;
+    bool active = false;
+    volatile bool failed = false;
+    uint32_t startMs;
+    uint32_t writeUs;
+    uint32_t transcodeUs;
+    bool transcode;
+    GcbWriter transcoder;
+
+    QueueHandle_t fullQueue;    ///< to the writer
+    QueueHandle_t freeQueue;    ///< back from the writer
+    QueueHandle_t doneQueue;    ///< file closed
+    TaskHandle_t writerTask = nullptr;
+    TaskLoad load;
+
+    Stats stats = {};
+
+    bool allocBuffers();
+    void freeBuffers();
+    bool takeBuffer();
+    void sendBuffer();
+};
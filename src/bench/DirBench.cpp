@@ -0,0 +1,120 @@
+#include <Arduino.h>
+#include <SD.h>
+#include <vector>
+
+#include "DirBench.h"
+#include "../DirCache.h"
+
+
+static void loaderLoop(void*) {
+    DirCache::get().loaderLoop();
+}
+
+static bool touch(const String &path) {
+    if(SD.exists(path)) return true;
+    File f = SD.open(path, FILE_WRITE);
+    if(!f) return false;
+    f.print("G0 X0\n");
+    f.close();
+    return true;
+}
+
+/// Waits until the cache has entries (or is read completely); @return false on timeout
+static bool waitFor(DirCache &cache, bool complete, uint32_t timeoutMs) {
+    uint32_t until = millis() + timeoutMs;
+    while(millis() < until) {
+        if(complete ? cache.isComplete() : cache.count(DirCache::ALL)>0) return true;
+        delay(1);
+    }
+    return false;
+}
+
+bool runDirBench(uint32_t files) {
+    String dirPath = "/dir_bench" + String(files);
+    const char* DIR_PATH = dirPath.c_str();
+    SD.mkdir(DIR_PATH);
+    uint32_t expected = 0;
+    for(uint32_t i=0; i<files; i++) {
+        // every 4th a sidecar, left out of the listing; every 3rd not G-code
+        String name = String(DIR_PATH) + "/f" + String(i) + (i%3==0 ? ".txt" : ".nc") + (i%4==0 ? ".gcb" : "");
+        if(!touch(name)) { fprintf(stderr, "Could not create %s\n", name.c_str()); return false; }
+        if(i%4!=0) expected++;
+    }
+    SD.remove(String(DIR_PATH) + "/new.nc");
+
+    DirCache &cache = DirCache::get();
+    TaskHandle_t task;
+    xTaskCreatePinnedToCore(loaderLoop, "Dir", 4096, nullptr, 1, &task, 0);
+    cache.setLoaderTask(task);
+
+    uint32_t start = micros();
+    cache.open(DIR_PATH);
+    uint32_t openUs = micros() - start;
+    bool ok = waitFor(cache, false, 5000);
+    uint32_t firstUs = micros() - start;
+    ok = ok && waitFor(cache, true, 30000);
+    uint32_t completeUs = micros() - start;
+    size_t count = cache.count(DirCache::ALL);
+    size_t gcode = cache.count(DirCache::GCODE);
+
+    // a page from the middle, by size then by name: the first call sorts; a large directory reads a window around it
+    bool large = cache.isLarge();
+    start = micros();
+    bool covered = cache.want(DirCache::ALL, count/2, 50);
+    ok = ok && (covered || waitFor(cache, true, 30000));
+    uint32_t windowUs = micros() - start;
+    start = micros();
+    size_t n = cache.list(DirCache::ALL, DirCache::BY_SIZE, count/2, 50, [](const char*, const DirCache::Entry&) {});
+    uint32_t sortUs = micros() - start;
+    start = micros();
+    String prev;
+    bool sorted = true;
+    std::vector<String> page;
+    n = cache.list(DirCache::ALL, DirCache::BY_NAME, count/2, 50, [&](const char* name, const DirCache::Entry&) {
+        if(prev.length()>0 && strcasecmp(prev.c_str(), name) > 0) sorted = false;
+        prev = name;
+        page.push_back(name);
+    });
+    uint32_t pageUs = micros() - start;
+    // in directory order, the same entries as reading it
+    bool inOrder = true;
+    if(large) {
+        File dir = SD.open(DIR_PATH);
+        File f;
+        size_t i = 0;
+        while((f = dir.openNextFile())) {
+            String name = f.name();
+            name = name.substring(name.lastIndexOf('/')+1);
+            f.close();
+            if(name.endsWith(".gcb")) continue;
+            if(i>=count/2 && i-count/2 < page.size() && page[i-count/2]!=name) inOrder = false;
+            i++;
+        }
+        dir.close();
+    }
+
+    // the last G-code files, as the file chooser pages through them
+    ok = ok && (cache.want(DirCache::GCODE, gcode-5, 11) || waitFor(cache, true, 30000));
+    size_t tail = cache.list(DirCache::GCODE, DirCache::BY_NAME, gcode-5, 11, [](const char*, const DirCache::Entry&) {});
+
+    touch(String(DIR_PATH) + "/new.nc");
+    cache.invalidate(String(DIR_PATH) + "/new.nc");
+    ok = ok && waitFor(cache, true, 30000);
+    size_t countAfter = cache.count(DirCache::ALL);
+    SD.remove(String(DIR_PATH) + "/new.nc");
+
+    printf("dir_entries=%u gcode=%u open_us=%u first_entries_us=%u complete_ms=%u large=%u window_ms=%u sort_us=%u "
+        "page_us=%u page_entries=%u sorted=%u after_invalidate=%u\n",
+        (unsigned)count, (unsigned)gcode, openUs, firstUs, completeUs/1000, large, covered ? 0 : windowUs/1000, sortUs, 
+        pageUs, (unsigned)n, sorted, (unsigned)countAfter);
+
+    if(!ok) { fprintf(stderr, "Directory was not read in time\n"); return false; }
+    if(count!=expected) { fprintf(stderr, "%u entries, expected %u\n", (unsigned)count, (unsigned)expected); return false; }
+    if(large != (expected > DirCache::MAX_ENTRIES)) { fprintf(stderr, "large=%u for %u entries\n", large, (unsigned)count); return false; }
+    if(n != (count/2+50 <= count ? 50 : count-count/2)) { fprintf(stderr, "%u entries on the page\n", (unsigned)n); return false; }
+    if(!large && !sorted) { fprintf(stderr, "Page is not sorted\n"); return false; }
+    if(!inOrder) { fprintf(stderr, "Page is not in directory order\n"); return false; }
+    if(tail!=5) { fprintf(stderr, "%u G-code files at the end, expected 5\n", (unsigned)tail); return false; }
+    if(countAfter!=count+1) { fprintf(stderr, "New file not listed after invalidate()\n"); return false; }
+    return true;
+}
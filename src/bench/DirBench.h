@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Fills $SD_ROOT/dir_bench<N> with N files (G-code, other files and sidecars) and lists it through DirCache:
+ * time until the first entries show up, until the directory is read, and for a sorted page of it;
+ * beyond DirCache::MAX_ENTRIES, for reading the window around a page from the middle, checked against the directory order.
+ * Then adds a file and checks that invalidate() brings it in.
+ */
+bool runDirBench(uint32_t files);
@@ -0,0 +1,297 @@
+#include "FakeController.h"
+
+static bool isGrblRealtime(uint8_t c) {
+    return c=='?' || c=='!' || c=='~' || c==0x18 || c>=0x80;
+}
+
+static bool isMotion(const std::string &line) {
+    return line.compare(0, 2, "G0")==0 || line.compare(0, 2, "G1")==0 
+        || line.compare(0, 2, "G2")==0 || line.compare(0, 2, "G3")==0 
+        || line.compare(0, 3, "$J=")==0;
+}
+
+void FakeController::reset() {
+    memset(&stats, 0, sizeof(stats));
+    curLine.clear();
+    wireFreeAt = outWireFreeAt = 0;
+    rxLines.clear();
+    rxUsed = 0;
+    planner.clear();
+    lastOkAt = 0;
+    out.clear();
+    outPos = 0;
+    readLine.clear();
+    okReadAt = 0;
+    numberedLines = 0;
+    corruptedN = 0;
+    flushUntil = 0;
+    x = y = z = 0;
+    jogs.clear();
+    jogCanceled = false;
+}
+
+size_t FakeController::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t FakeController::write(const uint8_t *buf, size_t size) {
+    uint32_t now = micros();
+    for(size_t i=0; i<size; i++) {
+        uint8_t c = buf[i];
+        bool realtime = cfg.flavor==Flavor::GRBL && curLine.empty() && isGrblRealtime(c);
+        if(!realtime && curLine.empty() && okReadAt!=0) {
+            uint32_t dt = now - okReadAt;
+            stats.okToSendCount++;
+            stats.okToSendSumUs += dt;
+            if(dt>stats.okToSendMaxUs) stats.okToSendMaxUs = dt;
+            okReadAt = 0;
+        }
+        wireFreeAt = max(now, wireFreeAt) + byteTimeUs();
+        onByteReceived(c, wireFreeAt);
+    }
+    return size;
+}
+
+void FakeController::onByteReceived(uint8_t c, uint32_t at) {
+    if(cfg.flavor==Flavor::GRBL && curLine.empty() && isGrblRealtime(c)) {
+        if(c=='?') {
+            stats.statusRequests++;
+            respond(statusReport(), at + cfg.latencyUs);
+        } else if(c==0x85) cancelJog(at);
+        return;
+    }
+    switch(c) {
+        case '\r': break;
+        case '\n':
+            if(!curLine.empty()) onLineReceived(curLine, at);
+            curLine.clear();
+            break;
+        default: curLine += (char)c;
+    }
+}
+
+void FakeController::expireRxLines(uint32_t now) {
+    while(!rxLines.empty() && rxLines.front().okAt <= now) {
+        rxUsed -= rxLines.front().len;
+        rxLines.pop_front();
+    }
+}
+
+void FakeController::onLineReceived(const std::string &rawLine, uint32_t at) {
+    stats.lines++;
+    stats.bytes += rawLine.length()+1;
+
+    if(cfg.flavor==Flavor::MARLIN && at < flushUntil) {
+        stats.flushedLines++;
+        return;
+    }
+
+    expireRxLines(at);
+    rxUsed += rawLine.length()+1;
+    if(rxUsed > cfg.rxBufferSize) stats.rxOverflows++;
+    if(rxUsed > stats.maxRxUsed) stats.maxRxUsed = rxUsed;
+
+    std::string line = rawLine;
+    if(cfg.flavor==Flavor::MARLIN && !line.empty() && line[0]=='N') {
+        const char* err = checkLineNumber(line);
+        if(err!=nullptr) {
+            // rejected on reception, like Marlin's gcode_line_error(): error, RX buffer flushed, Resend, ok
+            uint32_t okAt = max(at + cfg.latencyUs, lastOkAt);
+            lastOkAt = okAt;
+            flushUntil = okAt;
+            rxLines.push_back(RxLine{ (uint32_t)rawLine.length()+1, okAt });
+            stats.resendRequests++;
+            char tmp[100];
+            snprintf(tmp, sizeof(tmp), "Error:%s, Last Line: %u", err, lastN);
+            respond(tmp, okAt);
+            snprintf(tmp, sizeof(tmp), "Resend: %u", lastN+1);
+            respond(tmp, okAt);
+            respond("ok", okAt);
+            return;
+        }
+    }
+
+    // lines are acknowledged in order; a motion line waits for a free planner block
+    uint32_t okAt = max(at, lastOkAt);
+    bool jog = cfg.flavor==Flavor::GRBL && line.compare(0, 3, "$J=")==0;
+    if(jog) {
+        if(jogCanceled) stats.jogsAfterCancel++;
+        addJog(line, okAt);
+    }
+    else if(cfg.lineTimeUs!=0 && isMotion(line)) {
+        while(!planner.empty() && planner.front() <= okAt) planner.pop_front();
+        if(planner.size() >= cfg.plannerBlocks) {
+            okAt = max(okAt, planner[planner.size()-cfg.plannerBlocks]);
+            while(!planner.empty() && planner.front() <= okAt) planner.pop_front();
+        }
+        uint32_t start = planner.empty() ? okAt : max(okAt, planner.back());
+        planner.push_back(start + cfg.lineTimeUs);
+    }
+    okAt = max(okAt, at + cfg.latencyUs);
+    lastOkAt = okAt;
+    rxLines.push_back(RxLine{ (uint32_t)rawLine.length()+1, okAt });
+
+    if(!jog) trackMove(line);
+
+    if(cfg.errorEvery!=0 && stats.lines % cfg.errorEvery == 0) {
+        stats.errors++;
+        respond(cfg.flavor==Flavor::GRBL ? "error:20" : "Error:Unknown command", okAt);
+        if(cfg.flavor==Flavor::MARLIN) respond("ok", okAt);
+        return;
+    }
+
+    char tmp[200];
+    if(cfg.flavor==Flavor::GRBL) {
+        if(line=="$I") {
+            snprintf(tmp, sizeof(tmp), "[VER:1.1h.20190825:]\r\n[OPT:V,%d,%d]", cfg.plannerBlocks, cfg.rxBufferSize);
+            respond(tmp, okAt);
+        } else if(line=="$$") {
+            respond("$10=3\r\n$110=3000.000\r\n$111=3000.000\r\n$112=600.000\r\n"
+                "$120=200.000\r\n$121=200.000\r\n$122=50.000", okAt);
+        }
+        respond("ok", okAt);
+    } else {
+        if(line.compare(0, 4, "M115")==0) {
+            respond("FIRMWARE_NAME:Marlin 2.0.9 (Github) SOURCE_CODE_URL:github.com/MarlinFirmware/Marlin "
+                "PROTOCOL_VERSION:1.0 MACHINE_TYPE:Fake EXTRUDER_COUNT:1 UUID:cede2a2f-41a2-4748-9b12-c55c62f367ff\r\n"
+                "Cap:AUTOREPORT_TEMP:1\r\nCap:PROGRESS:0\r\nCap:BUILD_PERCENT:0", okAt);
+            respond("ok", okAt);
+        } else if(line.compare(0, 4, "M503")==0) {
+            respond("echo:; Maximum feedrates (units/s):\r\necho:  M203 X300.00 Y300.00 Z5.00 E25.00\r\n"
+                "echo:; Maximum Acceleration (units/s2):\r\necho:  M201 X3000.00 Y3000.00 Z100.00 E10000.00", okAt);
+            respond("ok", okAt);
+        } else if(line.compare(0, 4, "M105")==0) {
+            respond("ok T:25.00 /0.00 B:24.00 /0.00 @:0 B@:0", okAt);
+        } else if(line.compare(0, 4, "M114")==0) {
+            snprintf(tmp, sizeof(tmp), "X:%.2f Y:%.2f Z:%.2f E:0.00 Count X:0 Y:0 Z:0", x, y, z);
+            respond(tmp, okAt);
+            respond("ok", okAt);
+        } else {
+            respond("ok", okAt);
+        }
+    }
+}
+
+/** Validates `N<n> cmd*<checksum>` and strips it down to cmd. @return error text or nullptr */
+const char* FakeController::checkLineNumber(std::string &line) {
+    size_t star = line.rfind('*');
+    if(star==std::string::npos) return "No Checksum with line number";
+    uint8_t checksum = 0;
+    for(size_t i=0; i<star; i++) checksum ^= line[i];
+    uint32_t n = strtoul(line.c_str()+1, nullptr, 10);
+    bool m110 = line.find("M110")!=std::string::npos;
+    if(m110) {
+        size_t n2 = line.find('N', line.find("M110"));
+        if(n2!=std::string::npos) n = strtoul(line.c_str()+n2+1, nullptr, 10);
+    }
+    if(n != lastN+1 && !m110) return "Line Number is not Last Line Number+1";
+    numberedLines++;
+    bool corrupt = cfg.corruptEvery!=0 && numberedLines % cfg.corruptEvery == 0;
+    if(cfg.corruptTwice && corrupt) corruptedN = n;
+    else if(cfg.corruptTwice && corruptedN!=0 && n==corruptedN) { corrupt = true; corruptedN = 0; }
+    if(corrupt || checksum != strtoul(line.c_str()+star+1, nullptr, 10)) return "checksum mismatch";
+    lastN = n;
+    size_t space = line.find(' ');
+    line = space<star ? line.substr(space+1, star-space-1) : std::string();
+    return nullptr;
+}
+
+void FakeController::trackMove(const std::string &line) {
+    if(!isMotion(line)) return;
+    const char* s = line.c_str();
+    const char* p;
+    if((p = strchr(s, 'X')) != nullptr) x = atof(p+1);
+    if((p = strchr(s, 'Y')) != nullptr) y = atof(p+1);
+    if((p = strchr(s, 'Z')) != nullptr) z = atof(p+1);
+}
+
+// $J=G91 F1000 X0.100
+void FakeController::addJog(const std::string &line, uint32_t at) {
+    const char* s = line.c_str();
+    const char* p = strchr(s, 'F');
+    float feed = p!=nullptr ? atof(p+1) : 0;
+    for(uint8_t axis=0; axis<3; axis++) {
+        p = strchr(s+3, "XYZ"[axis]);
+        if(p==nullptr || feed<=0) continue;
+        float d = atof(p+1);
+        uint32_t start = jogs.empty() ? at : max(at, jogs.back().end);
+        jogs.push_back(JogBlock{start, start + (uint32_t)(fabsf(d) * 60e6f / feed), axis, d});
+        break;
+    }
+}
+
+// drops blocks not started yet and decelerates the current one
+void FakeController::cancelJog(uint32_t at) {
+    jogCanceled = true;
+    while(!jogs.empty() && jogs.back().start >= at) jogs.pop_back();
+    if(jogs.empty() || jogs.back().end <= at) return;
+    JogBlock &b = jogs.back();
+    float v = fabsf(b.dist) * 1e6f / (b.end - b.start);   // mm/s
+    float done = b.dist * (at - b.start) / (b.end - b.start);
+    float stopDist = v*v / (2*cfg.jogAccel);
+    float left = fabsf(b.dist - done);
+    if(stopDist < left) {
+        // constant speed up to the stopping point, close enough for the final position
+        b.dist = done + (b.dist>0 ? stopDist : -stopDist);
+        b.end = b.start + (uint32_t)(fabsf(b.dist) * 1e6f / v);
+    }
+}
+
+void FakeController::jogPosition(uint32_t now, float pos[3]) const {
+    pos[0] = x; pos[1] = y; pos[2] = z;
+    for(const JogBlock &b: jogs) {
+        if(b.start >= now) break;
+        float f = b.end <= now ? 1 : 1.0f * (now - b.start) / (b.end - b.start);
+        pos[b.axis] += b.dist * f;
+    }
+}
+
+std::string FakeController::statusReport() const {
+    char tmp[100];
+    uint32_t now = micros();
+    const char* state = planner.empty() || planner.back() <= now ? "Idle" : "Run";
+    if(!jogs.empty() && jogs.back().end > now) state = "Jog";
+    float pos[3];
+    jogPosition(now, pos);
+    int blocks = 0, rx = 0;
+    for(uint32_t end: planner) if(end > now) blocks++;
+    for(const auto &l: rxLines) if(l.okAt > now) rx += l.len;
+    snprintf(tmp, sizeof(tmp), "<%s|MPos:%.3f,%.3f,%.3f|Bf:%d,%d|FS:0,0>", state, pos[0], pos[1], pos[2], 
+        max(0, cfg.plannerBlocks-blocks), max(0, cfg.rxBufferSize-rx) );
+    return tmp;
+}
+
+void FakeController::respond(const std::string &text, uint32_t at) {
+    std::string t = text + "\r\n";
+    outWireFreeAt = max(at, outWireFreeAt) + byteTimeUs()*t.length();
+    out.push_back(Response{outWireFreeAt, t});
+}
+
+int FakeController::available() {
+    uint32_t now = micros();
+    int n = 0;
+    for(const auto &r: out) {
+        if((int32_t)(r.readyAt - now) > 0) break;
+        n += r.text.length();
+    }
+    return n - outPos;
+}
+
+int FakeController::peek() {
+    if(available()<=0) return -1;
+    return (uint8_t)out.front().text[outPos];
+}
+
+int FakeController::read() {
+    if(available()<=0) return -1;
+    char c = out.front().text[outPos++];
+    if(outPos == out.front().text.length()) {
+        out.pop_front();
+        outPos = 0;
+    }
+    if(c=='\n') {
+        if(readLine.compare(0, 2, "ok")==0 || readLine.compare(0, 5, "error")==0) okReadAt = micros();
+        readLine.clear();
+    } else if(c!='\r') readLine += c;
+    return (uint8_t)c;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <deque>
+#include <string>
+
+/**
+ * Scripted Grbl/Marlin controller on the other end of a simulated UART.
+ *
+ * Lines written by GCodeDevice are "transmitted" at the configured baud rate,
+ * land in a controller RX buffer, and are acknowledged once they fit into the planner
+ * (after `latencyUs`). Each planner block takes `lineTimeUs` to execute.
+ * Responses become readable only when their simulated time has come.
+ */
+class FakeController : public Stream {
+public:
+
+    enum class Flavor { GRBL, MARLIN };
+
+    struct Config {
+        Flavor flavor = Flavor::GRBL;
+        uint32_t baud = 0;              ///< simulated wire speed in both directions; 0 is instant
+        uint32_t latencyUs = 200;       ///< from line fully received to 'ok'
+        uint32_t lineTimeUs = 0;        ///< execution time of one planner block
+        uint16_t rxBufferSize = 128;    ///< Grbl serial RX buffer
+        uint16_t plannerBlocks = 15;
+        uint32_t errorEvery = 0;        ///< answer every Nth line with an error
+        uint32_t corruptEvery = 0;      ///< Marlin: treat every Nth numbered line as garbled on the wire (checksum mismatch)
+        bool corruptTwice = false;      ///< Marlin: garble such a line again the first time it is resent
+        float jogAccel = 500;           ///< Grbl: mm/s^2, for the stopping distance after a jog cancel
+    };
+
+    struct Stats {
+        uint32_t lines;
+        uint32_t bytes;
+        uint32_t statusRequests;
+        uint32_t errors;
+        uint32_t resendRequests;        ///< Marlin lines rejected with Resend:
+        uint32_t jogsAfterCancel;       ///< Grbl `$J=` lines received after the last jog cancel
+        uint32_t flushedLines;          ///< Marlin lines dropped unanswered with the RX buffer before a Resend:
+        uint32_t rxOverflows;           ///< lines that would not have fit into the RX buffer
+        uint32_t maxRxUsed;
+        uint32_t okToSendCount;
+        uint64_t okToSendSumUs;
+        uint32_t okToSendMaxUs;
+    };
+
+    FakeController(const Config &cfg): cfg(cfg), lastN(0) { reset(); }
+
+    void reset();
+
+    const Stats& getStats() const { return stats; }
+    const Config& getConfig() const { return cfg; }
+
+    /** True when everything sent has been acknowledged and all responses were read. */
+    bool isDrained() const { return out.empty() && curLine.empty(); }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+
+    int available() override;
+    int read() override;
+    int peek() override;
+
+private:
+
+    struct Response {
+        uint32_t readyAt;
+        std::string text;
+    };
+
+    struct RxLine {
+        uint32_t len;
+        uint32_t okAt;
+    };
+
+    /// `$J=` motion, executed at constant speed between start and end
+    struct JogBlock {
+        uint32_t start, end;
+        uint8_t axis;
+        float dist;
+    };
+
+    Config cfg;
+    Stats stats;
+
+    std::string curLine;
+    uint32_t wireFreeAt;        ///< when the device->controller wire finishes the last byte
+    uint32_t outWireFreeAt;     ///< same for controller->device
+    std::deque<RxLine> rxLines; ///< lines occupying the RX buffer until acknowledged
+    uint32_t rxUsed;
+    std::deque<uint32_t> planner; ///< completion times of queued blocks
+    uint32_t lastOkAt;
+    std::deque<Response> out;
+    size_t outPos;
+    std::string readLine;       ///< response line the device is currently reading
+    uint32_t okReadAt;          ///< when the device consumed the last 'ok', 0 if already accounted
+
+    uint32_t lastN;             ///< Marlin: last accepted line number
+    uint32_t numberedLines;
+    uint32_t corruptedN;        ///< Marlin: line number garbled by corruptEvery, 0 once it was garbled twice
+    uint32_t flushUntil;        ///< Marlin: lines received before this are dropped with the RX buffer
+
+    float x, y, z;
+    std::deque<JogBlock> jogs;
+    bool jogCanceled;
+
+    void addJog(const std::string &line, uint32_t at);
+    void cancelJog(uint32_t at);
+    void jogPosition(uint32_t now, float pos[3]) const;
+
+    uint32_t byteTimeUs() const { return cfg.baud==0 ? 0 : 10*1000000 / cfg.baud; }
+
+    void expireRxLines(uint32_t now);
+    void onByteReceived(uint8_t c, uint32_t at);
+    void onLineReceived(const std::string &rawLine, uint32_t at);
+    const char* checkLineNumber(std::string &line);
+    void respond(const std::string &text, uint32_t at);
+    std::string statusReport() const;
+    void trackMove(const std::string &line);
+};
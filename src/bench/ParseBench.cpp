@@ -0,0 +1,86 @@
+#include <Arduino.h>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "ParseBench.h"
+#include "../devices/MarlinResponse.h"
+#include "../devices/GrblStatus.h"
+
+// counts operator new calls while `counting` is set; the parser must not make any
+static std::atomic<uint32_t> allocations{0};
+static std::atomic<bool> counting{false};
+
+void* operator new(size_t size) {
+    if(counting) allocations++;
+    void* p = malloc(size==0 ? 1 : size);
+    if(p==nullptr) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+bool runParseBench(const char* corpusPath, uint32_t passes) {
+    FILE* f = fopen(corpusPath, "r");
+    if(f==nullptr) {
+        fprintf(stderr, "Could not open %s\n", corpusPath);
+        return false;
+    }
+    // tryParseResponse() gets NUL-terminated lines without the line end, so does the bench
+    std::vector<std::string> lines;
+    char buf[256];
+    while(fgets(buf, sizeof(buf), f)!=nullptr) {
+        size_t len = strcspn(buf, "\r\n");
+        buf[len] = 0;
+        if(len!=0) lines.emplace_back(buf, len);
+    }
+    fclose(f);
+    if(lines.empty()) {
+        fprintf(stderr, "%s is empty\n", corpusPath);
+        return false;
+    }
+
+    uint32_t temps = 0, positions = 0, oks = 0, m115 = 0, reports = 0;
+    float sink = 0;
+    char value[40];
+    GrblStatus status;
+    resetGrblStatus(status);
+
+    counting = true;
+    auto start = std::chrono::steady_clock::now();
+    for(uint32_t p=0; p<passes; p++) {
+        for(const std::string &l: lines) {
+            const char* s = l.c_str();
+            if(s[0]=='<') {
+                if(parseGrblStatus(s+1, status)) {
+                    reports++;
+                    sink += status.wpos[0] + status.ovFeed;
+                }
+                continue;
+            }
+            MarlinResponse r;
+            if(parseMarlinResponse(s, r) ) {
+                if(r.activeTool.valid || r.bed.valid) temps++;
+                if(r.hasPosition()) positions++;
+                sink += r.activeTool.actual + r.bed.target + r.x;
+            }
+            if(r.ok) oks++;
+            if(findM115Field(s, "FIRMWARE_NAME", value, sizeof(value)) || findM115Field(s, "Cap:AUTOREPORT_TEMP", value, sizeof(value)) ) {
+                m115++;
+                sink += value[0];
+            }
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    counting = false;
+
+    uint64_t total = (uint64_t)lines.size() * passes;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    printf("parse_lines=%u passes=%u ns_per_line=%.1f allocations=%u temps=%u positions=%u oks=%u m115=%u grbl_reports=%u sink=%d\n",
+        (uint32_t)lines.size(), passes, ns / total, allocations.load(), 
+        temps/passes, positions/passes, oks/passes, m115/passes, reports/passes, sink!=0 );
+    return allocations==0;
+}
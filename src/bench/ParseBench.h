@@ -0,0 +1,9 @@
+#pragma once
+
+/**
+ * Times parseMarlinResponse() (and findM115Field() on M115 lines) over a corpus of recorded 
+ * Marlin replies, one reply per line (src/bench/marlin_replies.txt), and parseGrblStatus() 
+ * over lines starting with `<` (src/bench/grbl_status.txt).
+ * Prints ns per line and the number of heap allocations made while parsing, which should be 0.
+ */
+bool runParseBench(const char* corpusPath, uint32_t passes);
@@ -0,0 +1,115 @@
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <message_buffer.h>
+
+#include "RingBench.h"
+#include "../CommandPool.h"
+#include "../CommandRing.h"
+
+static const char LINE[] = "G1 X12.345 Y67.890 F1200";
+static const size_t LINE_LEN = sizeof(LINE)-1;
+static const size_t BATCH = 16;    // lines queued before the consumer drains them, like Job::loop() filling buf1
+static const size_t QUEUE_BYTES = 512;
+static const size_t QUEUE_LINES = 32;
+
+// Each variant moves one line from producer to consumer, including getting the text back out.
+struct MessageBufferPath {
+    MessageBufferHandle_t buf = xMessageBufferCreate(QUEUE_BYTES);
+    char rx[CommandPool::MAX_LINE+1];
+    ~MessageBufferPath() { vMessageBufferDelete(buf); }
+    bool push() { return xMessageBufferSend(buf, LINE, LINE_LEN, 0) != 0; }
+    bool pop() { return xMessageBufferReceive(buf, rx, CommandPool::MAX_LINE, 0) != 0; }
+};
+
+struct QueuePath {
+    QueueHandle_t q = xQueueCreate(QUEUE_LINES, sizeof(CommandHandle));
+    ~QueuePath() { vQueueDelete(q); }
+    bool push() {
+        CommandHandle h = CommandPool::getPool().alloc(LINE, LINE_LEN);
+        if(xQueueSend(q, &h, 0) == pdTRUE) return true;
+        CommandPool::getPool().free(h);
+        return false;
+    }
+    bool pop() {
+        CommandHandle h;
+        if(xQueueReceive(q, &h, 0) != pdTRUE) return false;
+        CommandPool::getPool().free(h);
+        return true;
+    }
+};
+
+template<bool MULTI_PRODUCER>
+struct RingPath {
+    CommandRing<CommandHandle, QUEUE_LINES, MULTI_PRODUCER> ring;
+    bool push() {
+        CommandHandle h = CommandPool::getPool().alloc(LINE, LINE_LEN);
+        if(ring.push(h)) return true;
+        CommandPool::getPool().free(h);
+        return false;
+    }
+    bool pop() {
+        CommandHandle h;
+        if(!ring.pop(h)) return false;
+        CommandPool::getPool().free(h);
+        return true;
+    }
+};
+
+template<typename P>
+static void sameTask(const char* name, uint32_t iterations) {
+    P p;
+    uint32_t start = micros();
+    for(uint32_t i=0; i<iterations; i+=BATCH) {
+        for(size_t j=0; j<BATCH; j++) p.push();
+        for(size_t j=0; j<BATCH; j++) p.pop();
+    }
+    uint32_t us = micros()-start;
+    Serial.printf("ringbench=%s mode=same_task lines=%u ns_per_line=%.1f\n", name, iterations, 1000.0*us/iterations);
+}
+
+template<typename P>
+struct CrossTaskArgs {
+    P *p;
+    uint32_t iterations;
+    volatile bool done;
+};
+
+template<typename P>
+static void producerTask(void* arg) {
+    CrossTaskArgs<P> *a = (CrossTaskArgs<P>*)arg;
+    for(uint32_t i=0; i<a->iterations; ) {
+        if(a->p->push()) i++; else yield();
+    }
+    a->done = true;
+    vTaskDelete(NULL);
+}
+
+// producer on the other core, consumer here: the Job/web -> device task situation
+template<typename P>
+static void crossTask(const char* name, uint32_t iterations) {
+    P p;
+    CrossTaskArgs<P> args{&p, iterations, false};
+    uint32_t start = micros();
+    xTaskCreatePinnedToCore(producerTask<P>, "RingBenchTx", 2048, &args, 1, nullptr, 0);
+    uint32_t n = 0, emptyPolls = 0;
+    while(n < iterations) {
+        if(p.pop()) n++; else { emptyPolls++; yield(); }
+    }
+    uint32_t us = micros()-start;
+    while(!args.done) vTaskDelay(1);
+    Serial.printf("ringbench=%s mode=cross_task lines=%u ns_per_line=%.1f empty_polls=%u\n", name, iterations, 1000.0*us/iterations, emptyPolls);
+}
+
+void runRingBench(uint32_t iterations) {
+    sameTask<MessageBufferPath>("message_buffer", iterations);
+    sameTask<QueuePath>("queue_handle", iterations);
+    sameTask<RingPath<false>>("ring_spsc", iterations);
+    sameTask<RingPath<true>>("ring_mpsc", iterations);
+
+    crossTask<MessageBufferPath>("message_buffer", iterations);
+    crossTask<QueuePath>("queue_handle", iterations);
+    crossTask<RingPath<false>>("ring_spsc", iterations);
+    crossTask<RingPath<true>>("ring_mpsc", iterations);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+/**
+ * Micro-benchmark of the device command queues: the old FreeRTOS message buffer of
+ * line text, a FreeRTOS queue of handles and CommandRing (single and multi-producer),
+ * each with CommandPool alloc/copy/free where lines travel by handle.
+ *
+ * Runs the same on the host (bench --ring) and on the ESP32 (env lolin32_ringbench),
+ * printing one `key=value` line per variant to Serial.
+ */
+void runRingBench(uint32_t iterations);
@@ -0,0 +1,52 @@
+#include <Arduino.h>
+#include <SD.h>
+
+#include <vector>
+
+#include "UploadBench.h"
+#include "../UploadWriter.h"
+
+static const char* PATH = "/upload_bench.bin";
+
+static uint8_t pattern(uint32_t pos) { return (pos * 7 + (pos >> 9)) & 0xFF; }
+
+static void writerLoop(void*) {
+    UploadWriter::get().writerLoop();
+}
+
+bool runUploadBench(uint32_t kbytes, uint32_t chunk) {
+    UploadWriter &w = UploadWriter::get();
+    TaskHandle_t task;
+    xTaskCreatePinnedToCore(writerLoop, "Upload", 4096, nullptr, 2, &task, 0);
+    w.setWriterTask(task);
+
+    if(!w.begin(PATH)) {
+        fprintf(stderr, "Could not start upload to %s\n", PATH);
+        return false;
+    }
+    uint32_t total = kbytes * 1024;
+    std::vector<uint8_t> data(chunk);
+    bool ok = true;
+    for(uint32_t pos=0; pos<total && ok; pos+=chunk) {
+        uint32_t len = total-pos < chunk ? total-pos : chunk;
+        for(uint32_t i=0; i<len; i++) data[i] = pattern(pos+i);
+        ok = w.append(data.data(), len);
+    }
+    ok = w.finish() && ok;
+
+    File f = SD.open(PATH);
+    uint32_t size = f.size(), bad = 0, pos = 0;
+    size_t n;
+    while( (n = f.read(data.data(), data.size())) > 0 ) {
+        for(size_t i=0; i<n; i++) if(data[i] != pattern(pos+i)) bad++;
+        pos += n;
+    }
+    f.close();
+    SD.remove(PATH);
+
+    const UploadWriter::Stats &s = w.getStats();
+    printf("upload_bytes=%u chunk=%u buf_size=%u elapsed_ms=%u mb_per_s=%.2f sd_mb_per_s=%.2f stalls=%u stall_ms=%u file_size=%u bad_bytes=%u\n",
+        s.bytes, chunk, s.bufSize, s.elapsedMs, w.getBytesPerSec() / 1048576.0f, w.getWriteBytesPerSec() / 1048576.0f,
+        s.stalls, s.stallMs, size, bad);
+    return ok && size==total && bad==0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Feeds KB kilobytes to UploadWriter in chunks of the given size, the way the web server 
+ * hands over an upload, then reads the file back ($SD_ROOT/upload_bench.bin) and checks it.
+ * Prints upload and card write MB/s and how often the web side had to wait for the writer.
+ */
+bool runUploadBench(uint32_t kbytes, uint32_t chunk);
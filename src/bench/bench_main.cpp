@@ -0,0 +1,431 @@
+/*
+ * Host benchmark: GCodeDevice::loop() streaming to a FakeController.
+ *
+ *   pio run -e native && .pio/build/native/program [options]
+ *
+ * Options:
+ *   --marlin            simulate Marlin instead of Grbl
+ *   --lines N           number of synthetic G1 lines to stream (default 20000)
+ *   --file PATH         stream a G-code file through Job instead (relative to $SD_ROOT)
+ *   --baud B            simulated UART speed, 0 for an instant wire (default 0)
+ *   --latency US        controller 'ok' latency (default 200)
+ *   --line-time US      planner block execution time (default 0)
+ *   --rx-buffer N       Grbl RX buffer size (default 128)
+ *   --planner N         planner blocks (default 15)
+ *   --error-every N     answer every Nth line with an error (the device stops, as it would on a real job)
+ *   --corrupt-every N   Marlin: reject every Nth line with a checksum error, so that it is resent
+ *   --corrupt-twice     Marlin: with --corrupt-every, reject the resent line once more
+ *   --no-line-numbers   Marlin: send plain lines, without N and checksum
+ *   --min-lps X         exit with 1 if lines/s is below X
+ *   --max-latency US    exit with 1 if average ok-to-next-send latency is above US
+ *   --ring N            only run the command queue micro-benchmark (see RingBench.h) with N lines
+ *   --jog MS            Grbl: turn the encoder for MS ms (--jog-step mm every --jog-tick ms), then stop, 
+ *                       and report the jog stream (see JogEngine.h)
+ *   --parse FILE        only time the Marlin reply parser over FILE (see ParseBench.h), --passes N times (default 10000)
+ *   --devices N         stream --lines to N simulated controllers at once, each device in its own task (see DeviceRegistry.h)
+ *   --upload KB         only feed KB kilobytes through the SD upload pipeline (see UploadWriter.h) in
+ *                       --chunk N byte pieces (default 1436, a TCP segment), then verify the file
+ *   --dir N             only list a directory of N files through DirCache (see DirBench.h)
+ *   --transcode         convert --file to its sidecar first (see GcbWriter.h), so the job streams from it;
+ *                       without it the job builds the sidecar while it runs, and its size is reported
+ *   --resume N          with --transcode: start the job at line N (see Job::resumeFrom())
+ *   --block             sleep in GCodeDevice::waitForWork() between loop() passes, like the device task in main.cpp,
+ *                       and report the idle time and wake-up latency of the device task
+ *
+ * Prints one `key=value` line, so results can be kept and diffed as a regression baseline.
+ */
+
+#include <Arduino.h>
+#include <SD.h>
+
+#include "../devices/GCodeDevice.h"
+#include "../Job.h"
+#include "../DeviceRegistry.h"
+
+#include "FakeController.h"
+#include "RingBench.h"
+#include "ParseBench.h"
+#include "UploadBench.h"
+#include "DirBench.h"
+
+struct Options {
+    FakeController::Config cfg;
+    uint32_t lines = 20000;
+    const char* file = nullptr;
+    float minLps = 0;
+    uint32_t maxLatencyUs = 0;
+    uint32_t timeoutMs = 120000;
+    uint32_t ringLines = 0;
+    uint32_t jogMs = 0;
+    float jogStep = 0.1f;
+    uint32_t jogTickMs = 10;
+    const char* parseCorpus = nullptr;
+    uint32_t parsePasses = 10000;
+    bool lineNumbers = true;
+    uint32_t devices = 1;
+    bool block = false;
+    bool transcode = false;
+    int32_t resumeLine = -1;
+    uint32_t uploadKb = 0;
+    uint32_t dirFiles = 0;
+    uint32_t uploadChunk = 1436;
+};
+
+static bool blockingLoop = false;
+
+/// One pass of the device task; pending: the job has lines for it
+static void devicePass(GCodeDevice *dev, bool pending = false) {
+    dev->loop();
+    if(blockingLoop) dev->waitForWork(pending);
+}
+
+static bool parseArgs(int argc, char** argv, Options &o) {
+    for(int i=1; i<argc; i++) {
+        String a = argv[i];
+        bool hasVal = i+1<argc;
+        if(a=="--marlin") o.cfg.flavor = FakeController::Flavor::MARLIN;
+        else if(a=="--lines" && hasVal) o.lines = atol(argv[++i]);
+        else if(a=="--file" && hasVal) o.file = argv[++i];
+        else if(a=="--baud" && hasVal) o.cfg.baud = atol(argv[++i]);
+        else if(a=="--latency" && hasVal) o.cfg.latencyUs = atol(argv[++i]);
+        else if(a=="--line-time" && hasVal) o.cfg.lineTimeUs = atol(argv[++i]);
+        else if(a=="--rx-buffer" && hasVal) o.cfg.rxBufferSize = atol(argv[++i]);
+        else if(a=="--planner" && hasVal) o.cfg.plannerBlocks = atol(argv[++i]);
+        else if(a=="--error-every" && hasVal) o.cfg.errorEvery = atol(argv[++i]);
+        else if(a=="--corrupt-every" && hasVal) o.cfg.corruptEvery = atol(argv[++i]);
+        else if(a=="--corrupt-twice") o.cfg.corruptTwice = true;
+        else if(a=="--no-line-numbers") o.lineNumbers = false;
+        else if(a=="--min-lps" && hasVal) o.minLps = atof(argv[++i]);
+        else if(a=="--max-latency" && hasVal) o.maxLatencyUs = atol(argv[++i]);
+        else if(a=="--ring" && hasVal) o.ringLines = atol(argv[++i]);
+        else if(a=="--jog" && hasVal) o.jogMs = atol(argv[++i]);
+        else if(a=="--jog-step" && hasVal) o.jogStep = atof(argv[++i]);
+        else if(a=="--jog-tick" && hasVal) o.jogTickMs = atol(argv[++i]);
+        else if(a=="--parse" && hasVal) o.parseCorpus = argv[++i];
+        else if(a=="--passes" && hasVal) o.parsePasses = atol(argv[++i]);
+        else if(a=="--devices" && hasVal) o.devices = atol(argv[++i]);
+        else if(a=="--block") o.block = true;
+        else if(a=="--transcode") o.transcode = true;
+        else if(a=="--resume" && hasVal) o.resumeLine = atol(argv[++i]);
+        else if(a=="--upload" && hasVal) o.uploadKb = atol(argv[++i]);
+        else if(a=="--dir" && hasVal) o.dirFiles = atol(argv[++i]);
+        else if(a=="--chunk" && hasVal) o.uploadChunk = atol(argv[++i]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool runUntilDrained(GCodeDevice *dev, FakeController &ctl, uint32_t timeoutMs) {
+    uint32_t until = millis() + timeoutMs;
+    while(millis() < until) {
+        devicePass(dev);
+        if(ctl.isDrained() && dev->getSentQueueLength()==0 && dev->getQueueLength()==0) return true;
+    }
+    return false;
+}
+
+static size_t syntheticLine(char* line, size_t size, uint32_t i) {
+    float a = i * 0.01f;
+    return snprintf(line, size, "G1 X%.3f Y%.3f F1200", 10+5*cosf(a), 10+5*sinf(a));
+}
+
+struct Feed {
+    GCodeDevice *dev;
+    uint32_t lines;
+    std::atomic<bool> done;
+    std::atomic<bool> failed;
+};
+
+/// Schedules the synthetic lines from another task, as the UI and web do, so that they go through GCodeDevice::wake()
+static void feedLoop(void *arg) {
+    Feed &f = *(Feed*)arg;
+    char line[40];
+    for(uint32_t i=0; i<f.lines && !f.failed; i++) {
+        size_t len = syntheticLine(line, sizeof(line), i);
+        while(!f.dev->canSchedule(len)) {
+            if(f.dev->isInPanic()) { f.failed = true; break; }
+            vTaskDelay(1);
+        }
+        if(!f.failed && !f.dev->scheduleCommand(line, len)) f.failed = true;
+    }
+    f.done = true;
+    vTaskDelete(NULL);
+}
+
+static bool streamSynthetic(GCodeDevice *dev, uint32_t lines) {
+    if(blockingLoop) {
+        static Feed feed;
+        feed.dev = dev;
+        feed.lines = lines;
+        feed.done = false;
+        feed.failed = false;
+        xTaskCreatePinnedToCore(feedLoop, "Feed", 4096, &feed, 1, nullptr, 0);
+        while(!feed.done) devicePass(dev);
+        return !feed.failed;
+    }
+    char line[40];
+    for(uint32_t i=0; i<lines; i++) {
+        size_t len = syntheticLine(line, sizeof(line), i);
+        // same as Job::loop(): queue while there is room, then let the device run
+        while(!dev->canSchedule(len)) {
+            if(dev->isInPanic()) return false;
+            devicePass(dev);
+        }
+        if(!dev->scheduleCommand(line, len)) {
+            fprintf(stderr, "scheduleCommand failed after canSchedule\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool runJog(GCodeDevice *dev, FakeController &ctl, const Options &o) {
+    JogEngine *je = dev->getJogEngine();
+    if(je==nullptr) {
+        fprintf(stderr, "Device has no jog engine\n");
+        return false;
+    }
+    dev->enableStatusUpdates();
+    // let the first status report come, the engine measures overshoot from it
+    uint32_t until = millis() + 200;
+    while(millis() < until) devicePass(dev);
+
+    uint32_t start = millis(), nextTick = start, ticks = 0;
+    while(millis() - start < o.jogMs) {
+        if((int32_t)(millis() - nextTick) >= 0) {
+            je->onTick(0, o.jogStep, millis());
+            ticks++;
+            nextTick += o.jogTickMs;
+        }
+        devicePass(dev);
+    }
+    uint32_t stopAt = millis();
+    while(millis() - stopAt < 5000) {
+        devicePass(dev);
+        if(!je->isActive()) break;
+    }
+    uint32_t stopMs = millis() - stopAt;
+
+    const JogEngine::Stats &js = je->getStats();
+    printf("jog_ms=%u ticks=%u dialed_mm=%.3f segments=%u cancels=%u overshoot_mm=%.3f stop_to_idle_ms=%u jogs_after_cancel=%u\n",
+        o.jogMs, ticks, ticks*o.jogStep, js.segments, js.cancels, js.lastOvershoot, stopMs, ctl.getStats().jogsAfterCancel);
+    return !je->isActive() && ctl.getStats().jogsAfterCancel==0;
+}
+
+static void readerLoop(void*) {
+    // same as the reader task in main.cpp
+    Job *job = Job::getJob();
+    while(1) {
+        if(!job->prefetch()) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20));
+    }
+}
+
+/// Creates device i of the registry, the way main.cpp does after detection
+static GCodeDevice* createDevice(size_t i, FakeController &ctl, const Options &o) {
+    DeviceDetector::DeviceBuffer &buf = DeviceRegistry::get().getDeviceBuffer(i);
+    GCodeDevice *dev;
+    if(o.cfg.flavor==FakeController::Flavor::MARLIN) {
+        MarlinDevice *m = new (buf.data) MarlinDevice(&ctl);
+        m->setLineNumbers(o.lineNumbers);
+        dev = m;
+    } else dev = new (buf.data) GrblDevice(&ctl);
+    DeviceRegistry::get().setDevice(i, dev);
+    dev->begin();
+    return dev;
+}
+
+struct DeviceRun {
+    FakeController *ctl;
+    GCodeDevice *dev;
+    const Options *o;
+    TaskHandle_t done;
+    bool ok;
+    uint32_t elapsedUs;
+};
+
+static void deviceRunLoop(void *p) {
+    DeviceRun *r = static_cast<DeviceRun*>(p);
+    r->dev->setTask(xTaskGetCurrentTaskHandle());
+    uint32_t start = micros();
+    r->ok = streamSynthetic(r->dev, r->o->lines) && runUntilDrained(r->dev, *r->ctl, r->o->timeoutMs);
+    r->elapsedUs = micros() - start;
+    xTaskNotifyGive(r->done);
+}
+
+/// Several devices streaming at once, each from its own task like the device tasks in main.cpp
+static int runDevices(const Options &o) {
+    size_t n = o.devices < DeviceRegistry::MAX_DEVICES ? o.devices : DeviceRegistry::MAX_DEVICES;
+    DeviceRegistry::get().begin(n);
+    DeviceRun runs[DeviceRegistry::MAX_DEVICES];
+    for(size_t i=0; i<n; i++) {
+        FakeController *ctl = new FakeController(o.cfg);
+        GCodeDevice *dev = createDevice(i, *ctl, o);
+        if(!runUntilDrained(dev, *ctl, 1000)) {
+            fprintf(stderr, "Device %u did not settle after begin()\n", (unsigned)i);
+            return 1;
+        }
+        ctl->reset();
+        dev->enableStatusUpdates();
+        runs[i] = DeviceRun{ctl, dev, &o, xTaskGetCurrentTaskHandle(), false, 0};
+    }
+    uint32_t start = micros();
+    for(size_t i=0; i<n; i++) 
+        xTaskCreatePinnedToCore(deviceRunLoop, "DeviceTask", 4096, &runs[i], 1, nullptr, i==0 ? 1 : 0);
+    for(size_t i=0; i<n; i++) ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+    uint32_t elapsedUs = micros() - start;
+
+    uint32_t lines = 0;
+    bool ok = true;
+    printf("devices=%u", (unsigned)n);
+    for(size_t i=0; i<n; i++) {
+        const FakeController::Stats &s = runs[i].ctl->getStats();
+        lines += s.lines;
+        ok = ok && runs[i].ok && !runs[i].dev->isInPanic() && s.rxOverflows==0;
+        printf(" lines_per_s_%u=%.0f", (unsigned)i, s.lines * 1e6f / runs[i].elapsedUs);
+        if(o.block) printf(" idle_pct_%u=%u", (unsigned)i, 100 - runs[i].dev->getLoad().getStats().busyPercent);
+    }
+    float lps = lines * 1e6f / elapsedUs;
+    printf(" lines=%u elapsed_ms=%u lines_per_s=%.0f\n", lines, elapsedUs/1000, lps);
+
+    if(!ok) { fprintf(stderr, "A device failed or timed out\n"); return 1; }
+    if(o.minLps!=0 && lps<o.minLps) { fprintf(stderr, "lines/s below %.0f\n", o.minLps); return 1; }
+    return 0;
+}
+
+/// Writes the sidecar of path the way an upload does, timed for the limits dev reported
+static bool transcodeFile(const char* path, GCodeDevice *dev) {
+    File f = SD.open(path);
+    GcbWriter w;
+    if(!f || !w.begin(path, dev->getMotionLimits())) return false;
+    uint8_t buf[1436];
+    size_t n;
+    uint32_t start = micros();
+    while( (n = f.read(buf, sizeof(buf))) > 0) w.feed(buf, n);
+    f.close();
+    bool ok = w.finish();
+    uint32_t us = micros() - start;
+    printf("transcode_ms=%u gcb_lines=%u gcb_moves=%u gcb_bytes=%u est_s=%.0f\n", us/1000, w.getLines(), w.getMoves(), 
+        w.getDataSize(), w.getSeconds() );
+    return ok;
+}
+
+static bool streamFile(GCodeDevice *dev, const char* path, int32_t resumeLine, uint32_t timeoutMs) {
+    Job *job = Job::getJob();
+    TaskHandle_t readerTask;
+    xTaskCreatePinnedToCore(readerLoop, "JobReader", 4096, nullptr, 1, &readerTask, 0);
+    job->setReaderTask(readerTask);
+    job->setFile(path);
+    if(!job->isValid()) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+    if(resumeLine>=0 && !job->resumeFrom(resumeLine)) {
+        fprintf(stderr, "Could not resume %s at line %d\n", path, resumeLine);
+        return false;
+    }
+    if(job->getEstimatedSeconds() > 0) printf("est_s=%.1f est_left_s=%.1f\n", job->getEstimatedSeconds(), job->getEstimatedSecondsLeft() );
+    job->start();
+    uint32_t until = millis() + timeoutMs;
+    while(job->isRunning() && millis()<until) {
+        job->loop();
+        devicePass(dev, job->hasLinesReady());
+    }
+    job->loop();    // as the device task does on its next pass
+    return !job->isRunning();
+}
+
+int main(int argc, char** argv) {
+    Options o;
+    if(!parseArgs(argc, argv, o)) return 2;
+    blockingLoop = o.block;
+
+    if(o.ringLines!=0) {
+        runRingBench(o.ringLines);
+        return 0;
+    }
+
+    if(o.parseCorpus!=nullptr) return runParseBench(o.parseCorpus, o.parsePasses) ? 0 : 1;
+
+    SD.begin();
+
+    if(o.uploadKb!=0) return runUploadBench(o.uploadKb, o.uploadChunk) ? 0 : 1;
+
+    if(o.dirFiles!=0) return runDirBench(o.dirFiles) ? 0 : 1;
+
+    if(o.devices>1) return runDevices(o);
+
+    FakeController ctl(o.cfg);
+    bool marlin = o.cfg.flavor==FakeController::Flavor::MARLIN;
+    DeviceRegistry::get().begin(1);
+    GCodeDevice *dev = createDevice(0, ctl, o);
+    dev->setTask(xTaskGetCurrentTaskHandle());
+
+    // let the probe commands from begin() finish, they are not part of the measurement
+    if(!runUntilDrained(dev, ctl, 1000)) {
+        fprintf(stderr, "Device did not settle after begin()\n");
+        return 1;
+    }
+    ctl.reset();
+
+    if(o.jogMs!=0) return runJog(dev, ctl, o) ? 0 : 1;
+
+    dev->enableStatusUpdates();
+    uint32_t start = micros();
+    if(o.file!=nullptr && o.transcode && !transcodeFile(o.file, dev)) {
+        fprintf(stderr, "Could not transcode %s\n", o.file);
+        return 1;
+    }
+    bool ok = o.file!=nullptr ? streamFile(dev, o.file, o.resumeLine, o.timeoutMs) : streamSynthetic(dev, o.lines);
+    ok = ok && runUntilDrained(dev, ctl, o.timeoutMs);
+    uint32_t elapsedUs = micros() - start;
+
+    const FakeController::Stats &s = ctl.getStats();
+    float lps = s.lines * 1e6f / elapsedUs;
+    float avgLatency = s.okToSendCount==0 ? 0 : 1.0f * s.okToSendSumUs / s.okToSendCount;
+
+    printf("flavor=%s lines=%u bytes=%u elapsed_ms=%u lines_per_s=%.0f kbytes_per_s=%.1f "
+        "ok_to_send_avg_us=%.1f ok_to_send_max_us=%u rx_max=%u rx_overflows=%u errors=%u status_requests=%u",
+        marlin ? "marlin" : "grbl", s.lines, s.bytes, elapsedUs/1000, lps, s.bytes * 1e3f / elapsedUs,
+        avgLatency, s.okToSendMaxUs, s.maxRxUsed, s.rxOverflows, s.errors, s.statusRequests);
+    printf(" lines_per_write=%.2f bytes_per_write=%.1f", dev->getLinesPerWrite(), dev->getBytesPerWrite() );
+    const GCodeDevice::StatusStats &st = dev->getStatusStats();
+    printf(" status_latency_avg_us=%u status_latency_max_us=%u status_timeouts=%u", st.avgLatencyUs, st.maxLatencyUs, st.timeouts );
+    const EventBus::TopicStats &es = EventBus::getBus().getStats(Topic::DEVICE_STATUS);
+    printf(" status_events=%u status_events_delivered=%u", es.published + es.unchanged, es.delivered );
+    if(!marlin) printf(" planner_fill_avg=%.2f", static_cast<GrblDevice*>(dev)->getAvgPlannerFill() );
+    else printf(" resend_requests=%u flushed_lines=%u resent_lines=%u", s.resendRequests, s.flushedLines, static_cast<MarlinDevice*>(dev)->getResentLines() );
+    if(o.block) {
+        const GCodeDevice::WakeStats &ws = dev->getWakeStats();
+        const TaskLoad::Stats &ls = dev->getLoad().getStats();
+        printf(" idle_pct=%u max_run_us=%u late_wakes=%u wakes=%u wake_latency_avg_us=%u wake_latency_max_us=%u", 
+            100 - ls.busyPercent, ls.maxRunUs, ls.lateWakes, ws.wakes, ws.avgLatencyUs, ws.maxLatencyUs);
+    }
+    size_t poolInUse = 0;
+    if(o.file!=nullptr) {
+        Job *job = Job::getJob();
+        printf(" job_starved=%u read_lines_per_s=%u sidecar=%u job_lines=%u", job->getStarvedCount(), 
+            job->getReadLinesPerSec(), job->isUsingSidecar(), job->getLineNo() );
+        // a stopped job still reads the rest of the file into the sidecar
+        uint32_t until = millis() + 5000;
+        while(job->isIndexing() && millis()<until) delay(1);
+        File f = SD.open(GcbWriter::sidecarPath(o.file));
+        if(!o.transcode) printf(" indexed_bytes=%u", f ? (unsigned)f.size() : 0);
+        f.close();
+        GcbWriter::removeSidecar(o.file);
+        // the job is over and the device idle, every CommandPool slot should be back
+        poolInUse = CommandPool::SIZE - CommandPool::getPool().getFree();
+        printf(" pool_in_use=%u", (unsigned)poolInUse);
+    }
+    printf("\n");
+
+    if(poolInUse!=0) { fprintf(stderr, "CommandPool slots left in use\n"); return 1; }
+    if(dev->isInPanic()) { fprintf(stderr, "Device stopped on error\n"); return 1; }
+    if(!ok) { fprintf(stderr, "Timed out\n"); return 1; }
+    if(s.rxOverflows!=0) { fprintf(stderr, "Controller RX buffer overflowed\n"); return 1; }
+    if(o.minLps!=0 && lps<o.minLps) { fprintf(stderr, "lines/s below %.0f\n", o.minLps); return 1; }
+    if(o.maxLatencyUs!=0 && avgLatency>o.maxLatencyUs) { fprintf(stderr, "latency above %u us\n", o.maxLatencyUs); return 1; }
+    return 0;
+}
@@ -1,181 +1,176 @@
 #include "GCodeDevice.h"
+#include "../DeviceRegistry.h"
 
 #define XOFF  0x13
 #define XON   0x11
 
-#define MAX(a,b)  ( (a)>(b) ? (a) : (b) )
-static char deviceBuffer[MAX(sizeof(MarlinDevice), sizeof(GrblDevice))];
-
 const uint32_t DeviceDetector::serialBauds[] = { 115200, 250000, 57600 }; 
 
-uint32_t DeviceDetector::serialBaud = 0;
+void DeviceDetector::sendProbes(uint8_t types, Stream &serial) {
+    // one burst; each firmware answers the other one's probe with an error, drain() skips it
+    char probe[16] = "\n";
+    if(types & (1<<TYPE_GRBL)) strcat(probe, "$I\n");
+    if(types & (1<<TYPE_MARLIN)) strcat(probe, "M115\n");
+    serial.write((const uint8_t*)probe, strlen(probe));
+}
 
-void DeviceDetector::sendProbe(uint8_t i, Stream &serial) {
-    switch(i) {
-        case 0: 
-            serial.print("\n$I\n");
-            break;
-        case 1:
-            serial.print("\nM115\n");
-            break;
-    }
+int8_t DeviceDetector::matchResponse(const char* line, uint8_t types) {
+    if((types & (1<<TYPE_GRBL)) && strstr(line, "[VER:")!=nullptr) return TYPE_GRBL;
+    if((types & (1<<TYPE_MARLIN)) && strstr(line, "MACHINE_TYPE")!=nullptr) return TYPE_MARLIN;
+    return -1;
 }
 
-GCodeDevice* DeviceDetector::checkProbe(uint8_t i, String v, Stream &serial) {
-    if(i==0) {
-        if(v.indexOf("[VER:")!=-1 ) {
-            GD_DEBUGS("Detected GRBL device");
-            //devices.grbl = GrblDevice(&serial);
-            return new (deviceBuffer) GrblDevice(&serial);
-            //return (GCodeDevice*)deviceBuffer;
-        }
+void DeviceDetector::drain(Stream &serial) {
+    uint32_t start = millis(), lastByte = start;
+    while(millis()-lastByte < QUIET_TIME && millis()-start < RESPONSE_WINDOW) {
+        if(serial.available()==0) { vTaskDelay(1); continue; }
+        serial.read();
+        lastByte = millis();
     }
-    if(i==1) {
-        if(v.indexOf("MACHINE_TYPE") != -1) {
-            GD_DEBUGS("Detected Marlin device");
-            //devices.marlin = MarlinDevice(&serial);
-            return new (deviceBuffer) MarlinDevice(&serial);
-            //return (GCodeDevice*)deviceBuffer;
+}
+
+GCodeDevice* DeviceDetector::detectPrinterAttempt(HardwareSerial &printerSerial, uint32_t speed, uint8_t types, DeviceBuffer &buf) {
+    GD_DEBUGF("attempt speed %d, types %x\n", speed, types);
+    printerSerial.updateBaudRate(speed);
+    while(printerSerial.available()) printerSerial.read();
+    sendProbes(types, printerSerial);
+
+    // lines are checked as they come, the window ends early on a match
+    char line[200];
+    size_t len = 0;
+    int8_t type = -1;
+    uint32_t start = millis();
+    while(type<0 && millis()-start < RESPONSE_WINDOW) {
+        if(printerSerial.available()==0) { vTaskDelay(1); continue; }
+        char c = printerSerial.read();
+        if(c!='\n' && c!='\r') {
+            if(len<sizeof(line)-1) line[len++] = c;
+            continue;
         }
+        line[len] = 0;
+        GD_DEBUGF("Got response '%s'\n", line );
+        type = matchResponse(line, types);
+        len = 0;
     }
+    if(type<0) return nullptr;
 
-    return nullptr;
+    // the rest of the answers, so that the device does not take them for responses to its own commands
+    drain(printerSerial);
 
-    //return false;
-}
-
-GCodeDevice* DeviceDetector::detectPrinterAttempt(HardwareSerial &printerSerial, uint32_t speed, uint8_t type) {
-    serialBaud = speed;
-    for(uint8_t retry=0; retry<2; retry++) {
-        GD_DEBUGF("attempt %d, speed %d, type %d\n", retry, speed, type);
-        //PrinterSerial.end();
-        //PrinterSerial.begin(speed);
-        printerSerial.updateBaudRate(speed);
-        while(printerSerial.available()) printerSerial.read();
-        DeviceDetector::sendProbe(type, printerSerial);
-        //String v = readStringUntil(printerSerial, '\n', 1000); v.trim();
-        String v = readString(printerSerial, 1000);
-        GD_DEBUGF("Got response '%s'\n", v.c_str() );
-        if(v) {
-            //int t = v.indexOf('\n');
-            GCodeDevice * dev = DeviceDetector::checkProbe(type, v, printerSerial);
-            if(dev!=nullptr) return dev;
-        }
+    GCodeDevice *dev;
+    if(type==TYPE_GRBL) {
+        GD_DEBUGS("Detected GRBL device");
+        dev = new (buf.data) GrblDevice(&printerSerial);
+    } else {
+        GD_DEBUGS("Detected Marlin device");
+        dev = new (buf.data) MarlinDevice(&printerSerial);
     }
-    return nullptr;
+    dev->setBaudRate(speed);
+    return dev;
 }
 
 
-GCodeDevice* DeviceDetector::detectPrinter(HardwareSerial &printerSerial) {
+GCodeDevice* DeviceDetector::detectPrinter(HardwareSerial &printerSerial, DeviceBuffer &buf, uint32_t lastBaud, int8_t lastType) {
+    if(lastBaud!=0 && lastType>=0 && lastType<N_TYPES) {
+        GCodeDevice *dev = detectPrinterAttempt(printerSerial, lastBaud, 1<<lastType, buf);
+        if(dev!=nullptr) return dev;
+    }
     while(true) {
         for(uint32_t speed: serialBauds) {
-            for(int type=0; type<DeviceDetector::N_TYPES; type++) {
-                GCodeDevice *dev = detectPrinterAttempt(printerSerial, speed, type);
-                if(dev!=nullptr) return dev;
-            }
+            GCodeDevice *dev = detectPrinterAttempt(printerSerial, speed, ALL_TYPES, buf);
+            if(dev!=nullptr) return dev;
         }
     }    
-    
 }
 
-String readStringUntil(Stream &serial, char terminator, size_t timeout) {
-    String ret;
-    timeout += millis();
-    char c;
-    int len = serial.readBytes(&c, 1);
-    while(len>0 && c != terminator && millis()<timeout) {
-        ret += (char) c;
-        len = serial.readBytes(&c, 1);
-    }
-    return ret;
-}
-
-String readString(Stream &serial, size_t timeout, size_t earlyTimeout) {
-    String ret; ret.reserve(40);
-    timeout += millis();
-    earlyTimeout += millis();
-    while(millis()<timeout) {
-        if(serial.available()>0) {
-            ret += (char)serial.read();
-        }
-        if(millis()>earlyTimeout && ret.length()>0 ) break; // break early if something was read at all
-    }
-    return ret;
-}
-
-
-
 
 
 
-
-GCodeDevice *GCodeDevice::inst = nullptr;
-
 GCodeDevice *GCodeDevice::getDevice() {
-    return inst;
+    return DeviceRegistry::get().getSelected();
 }
-/*
-void GCodeDevice::setDevice(GCodeDevice *dev) {
-    device = dev;
+
+void GCodeDevice::waitForWork(bool pending) {
+    if(printerSerial->available() > 0) return;
+    bool room = !panic && sentCounter->getFreeLines()>0 && sentCounter->getFreeBytes() > MAX_GCODE_LINE;
+    if(room && (pending || getQueueLength()>0)) return;
+    uint32_t ms = RX_IDLE_POLL;
+    if(isAwaitingResponse()) ms = portTICK_PERIOD_MS;
+    else if(statusUpdatesEnabled && !statusInFlight) {
+        uint32_t elapsed = millis() - statusRequestedAt, interval = getStatusInterval();
+        if(elapsed >= interval) ms = 0;
+        else if(interval - elapsed < ms) ms = interval - elapsed;
+    }
+    TickType_t ticks = pdMS_TO_TICKS(ms);
+    if(ticks==0) ticks = 1;
+
+    bool woken = load.notifyTake(pdTRUE, ticks) != 0;
+    uint32_t now = micros();
+    if(woken) {
+        uint32_t at = wakeRequestedUs.exchange(0);
+        if(at!=0) {
+            uint32_t dt = now - at;
+            wakeStats.wakes++;
+            wakeStats.avgLatencyUs = wakeStats.wakes==1 ? dt : (wakeStats.avgLatencyUs*7 + dt) / 8;
+            if(dt > wakeStats.maxLatencyUs) wakeStats.maxLatencyUs = dt;
+        }
+    }
 }
-*/
 
 
 void GCodeDevice::sendCommands() {
 
     if(panic) return;
-    //bool loadedNewCmd=false;
 
     if(xoffEnabled && xoff) return;
 
+    // send as many lines as the device can take now, not one per loop(), in a single UART write
+    while( !panic && loadNextCommand() ) {
+        if( !trySendCommand() ) break;
+    }
+    flushTx();
+
+}
+
+bool GCodeDevice::loadNextCommand() {
+
     #ifdef ADD_LINECOMMENTS
-    static size_t nline=0;
+    CommandPool &pool = CommandPool::getPool();
+    char tmp[MAX_GCODE_LINE+1];
     #endif
 
-    if(curUnsentPriorityCmdLen == 0) {
+    if(curUnsentPriorityCmd == CommandPool::NONE) {
+        if(!buf0.pop(curUnsentPriorityCmd)) curUnsentPriorityCmd = CommandPool::NONE;
         #ifdef ADD_LINECOMMENTS
-            char tmp[MAX_GCODE_LINE+1];
-            curUnsentPriorityCmdLen = xMessageBufferReceive(buf0, tmp, MAX_GCODE_LINE, 0);
-            if(curUnsentPriorityCmdLen!=0) {
-                tmp[curUnsentPriorityCmdLen] = 0;
-                snprintf(curUnsentPriorityCmd, MAX_GCODE_LINE, "%s ;%d", tmp, nline++);
-                curUnsentPriorityCmdLen = strlen(curUnsentPriorityCmd);
+            else {
+                snprintf(tmp, MAX_GCODE_LINE, "%s ;%d", pool.text(curUnsentPriorityCmd), nline++);
+                strcpy(pool.text(curUnsentPriorityCmd), tmp);
+                pool.setLength(curUnsentPriorityCmd, strlen(tmp));
             }
-        #else
-            curUnsentPriorityCmdLen = xMessageBufferReceive(buf0, curUnsentPriorityCmd, MAX_GCODE_LINE, 0);
-            curUnsentPriorityCmd[curUnsentPriorityCmdLen]=0;
         #endif
     }
 
-    if(curUnsentPriorityCmdLen==0 && curUnsentCmdLen==0) {
+    if(curUnsentPriorityCmd == CommandPool::NONE && curUnsentCmd == CommandPool::NONE) {
+        if(!buf1.pop(curUnsentCmd)) curUnsentCmd = CommandPool::NONE;
         #ifdef ADD_LINECOMMENTS
-            char tmp[MAX_GCODE_LINE+1];
-            curUnsentCmdLen = xMessageBufferReceive(buf1, tmp, MAX_GCODE_LINE, 0);
-            if(curUnsentCmdLen!=0) {
-                tmp[curUnsentCmdLen] = 0;
-                snprintf(curUnsentCmd, MAX_GCODE_LINE, "%s ;%d", tmp, nline++);
-                curUnsentCmdLen = strlen(curUnsentCmd);
+            else {
+                snprintf(tmp, MAX_GCODE_LINE, "%s ;%d", pool.text(curUnsentCmd), nline++);
+                strcpy(pool.text(curUnsentCmd), tmp);
+                pool.setLength(curUnsentCmd, strlen(tmp));
             }
-        #else
-            curUnsentCmdLen = xMessageBufferReceive(buf1, curUnsentCmd, MAX_GCODE_LINE, 0);
-            curUnsentCmd[curUnsentCmdLen] = 0; 
         #endif
         //loadedNewCmd = true;
     }
 
-    if(curUnsentCmdLen==0 && curUnsentPriorityCmdLen==0) return;
-
-    trySendCommand();
+    return curUnsentCmd != CommandPool::NONE || curUnsentPriorityCmd != CommandPool::NONE;
 
 }
 
 
 void GCodeDevice::receiveResponses() {
 
-
-    static const size_t MAX_LINE = 200; // M115 is far longer than 100
-    static char resp[MAX_LINE+1];
-    static size_t respLen;
+    char *resp = rxLine;
+    size_t &respLen = rxLen;
 
     while (printerSerial->available()) {
         char ch = (char)printerSerial->read();
@@ -184,7 +179,7 @@ void GCodeDevice::receiveResponses() {
             case '\r': break;
             case XOFF: if(xoffEnabled) { xoff=true; break; }
             case XON: if(xoffEnabled) {xoff=false; break; }
-            default: if(respLen<MAX_LINE) resp[respLen++] = ch;
+            default: if(respLen<MAX_RESPONSE) resp[respLen++] = ch;
         }
         if(ch=='\n') {
             resp[respLen]=0;
@@ -209,20 +204,98 @@ bool startsWith(const char *str, const char *pre) {
     return strncmp(pre, str, strlen(pre)) == 0;
 }
 
-void MarlinDevice::trySendCommand() {
-    char* cmd  = curUnsentPriorityCmdLen!=0 ? &curUnsentPriorityCmd[0] :  &curUnsentCmd[0]; 
-    size_t * len = curUnsentPriorityCmdLen!=0 ? &curUnsentPriorityCmdLen : &curUnsentCmdLen ;
+bool MarlinDevice::trySendCommand() {
+    CommandHandle * cmd = curUnsentPriorityCmd!=CommandPool::NONE ? &curUnsentPriorityCmd : &curUnsentCmd;
+    if(!sendLine(*cmd)) return false;
+    *cmd = CommandPool::NONE;
+    return true;
+}
+
+/** Sends the line (numbered if enabled) if the printer has room for it; the sent queue takes over the handle then. */
+bool MarlinDevice::sendLine(CommandHandle cmd) {
+    CommandPool &pool = CommandPool::getPool();
+    size_t len = pool.length(cmd);
 
-    if( sentCounter->canPush(*len) ) {
-        sentCounter->push( cmd, *len );
-        printerSerial->write(cmd, *len);  
-        printerSerial->print('\n');
+    if(!lineNumbers) {
+        if( !sentCounter->canPush(len) ) return false;
+        queueTx(pool.text(cmd), len);
+        GD_DEBUGF("<  (f%3d,%3d) '%s' (%d)\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), pool.text(cmd), len );
+        sentCounter->push( cmd );
         armRxTimeout();
-        GD_DEBUGF("<  (f%3d,%3d) '%s' (%d)\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), cmd, *len );
-        *len = 0;
-    } else {
-        //if(loadedNewCmd) GD_DEBUGF("<  Not sent, free lines: %d, free space: %d\n", sentQueue.getFreeLines() , sentQueue.getFreeBytes()  );
+        return true;
     }
+
+    char line[MAX_GCODE_LINE+24];
+    size_t lineLen = snprintf(line, sizeof(line), "N%u %s", nextLineNumber, pool.text(cmd));
+    uint8_t checksum = 0;
+    for(size_t i=0; i<lineLen; i++) checksum ^= line[i];
+    lineLen += snprintf(line+lineLen, sizeof(line)-lineLen, "*%u", checksum);
+
+    if( !sentCounter->canPush(lineLen) ) return false;
+    queueTx(line, lineLen);
+    GD_DEBUGF("<  (f%3d,%3d) '%s' (%d)\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), line, lineLen );
+    sentCounter->push( cmd, lineLen-len, nextLineNumber );
+    nextLineNumber++;
+    armRxTimeout();
+    return true;
+}
+
+void MarlinDevice::sendCommands() {
+    if(panic) return;
+    // the Resend last taken for a repeat was the printer asking for N again, it waits for it
+    if(staleResendAt!=0 && millis()-staleResendAt > RESEND_QUIET_MS) requeueFrom(lastResendLine);
+    if(xoffEnabled && xoff) return;
+
+    while( !resendQueue.empty() ) {
+        if( !sendLine(resendQueue.front()) ) break;
+        resendQueue.pop();
+    }
+    if( !resendQueue.empty() ) {
+        flushTx();
+        return;
+    }
+    GCodeDevice::sendCommands();
+}
+
+/**
+ * `Resend: N` comes after every line the printer rejected, followed by an `ok` for it.
+ * Marlin empties its RX buffer before asking, so the lines sent after N that were buffered get no reply at all;
+ * the ones that arrive later are rejected too (the printer still expects N), each with its own `Resend: N`.
+ * The first one takes all lines from N on out of sentQueue and sends them again, renumbered from N;
+ * repeats are ignored, at most one per line that was sent after N, and none once N was accepted
+ * (see tryParseResponse()). Fewer may come, so when the resent N is rejected again its Resend can be
+ * taken for a repeat; if nothing follows it for RESEND_QUIET_MS, it was not (see sendCommands()).
+ */
+void MarlinDevice::resendFrom(uint32_t lineNumber) {
+    oksToSkip++;
+    if(staleResends>0 && lineNumber==lastResendLine) {
+        staleResends--;
+        staleResendAt = millis();
+        return;
+    }
+    lastResendLine = lineNumber;
+    requeueFrom(lineNumber);
+}
+
+/// Moves the lines from lineNumber on out of sentQueue, to be sent again before anything else
+void MarlinDevice::requeueFrom(uint32_t lineNumber) {
+    CommandHandle taken[MAX_SENT_LINES];
+    size_t n = 0;
+    while(sentQueue.size()>0 && sentQueue.back().lineNumber >= lineNumber) taken[n++] = sentQueue.popBack();
+    staleResends = n>0 ? n-1 : 0;
+    staleResendAt = 0;
+    resentLines += n;
+
+    // a resend still in progress was numbered after these, it goes after them
+    size_t pending = resendQueue.size();
+    while(n>0) resendQueue.push(taken[--n]);
+    for(size_t i=0; i<pending; i++) {
+        CommandHandle h = resendQueue.front();
+        resendQueue.pop();
+        resendQueue.push(h);
+    }
+    nextLineNumber = lineNumber;
+    GD_DEBUGF("Resend from %d, %d lines\n", lineNumber, resendQueue.size() );
 }
 
 void MarlinDevice::tryParseResponse( char* resp, size_t len ) {
@@ -234,10 +307,22 @@ void MarlinDevice::tryParseResponse( char* resp, size_t len ) {
 
     //GD_DEBUGF(" > '%s'; current cmd %s\n", resp, curCmd );
 
-    if ( startsWith(resp, "ok") ) {
+    if ( startsWith(resp, "ok") && oksToSkip>0 ) {
+        // acknowledges the line a Resend rejected
+        oksToSkip--;
+    } else if ( startsWith(resp, "ok") ) {
 
-        if (startsWith(curCmd, TEMP_COMMAND))
-            parseTemperatures(String(resp) );
+        // the printer accepted the resent line, every repeated Resend came before this
+        if(sentQueue.size()>0 && sentQueue.at(0).lineNumber >= lastResendLine) {
+            staleResends = 0;
+            staleResendAt = 0;
+        }
+
+        if (startsWith(curCmd, TEMP_COMMAND)) {
+            MarlinResponse r;
+            if(parseMarlinResponse(resp, r)) applyTemperatures(r);
+            onStatusReceived();
+        }
         else if (fwAutoreportTempCap && startsWith(curCmd, AUTOTEMP_COMMAND))
             autoreportTempEnabled = (curCmd[6] != '0');
         else if(startsWith(curCmd, "G0") || startsWith(curCmd, "G1")) {
@@ -252,22 +337,27 @@ void MarlinDevice::tryParseResponse( char* resp, size_t len ) {
         connected = true;
     } else {
         if (connected) {
+            MarlinResponse r;
             if(startsWith(curCmd,"M115") ) {
-                parseM115(String(resp) ); 
-            } else if (parseTemperatures(String(resp) ) ) {
-                // do nothing
-                //sprintf(responseDetail, "autotemp");
-            } else if (parsePosition(resp) ) {
-                // do nothing
-                //sprintf(responseDetail, "position");
-            /*} else if (startsWith(resp, "Resend: ")) {
-                nline = (int)extractFloat(resp, "Resend:");
-                sprintf(responseDetail, "sync line=%d", nline);
-            }*/
+                parseM115(resp); 
+            } else if (startsWith(curCmd, "M503") && applyLimits(resp)) {
+                // limits for TimeEstimator, asked for in begin()
+            } else if (parseMarlinResponse(resp, r) ) {
+                // autoreported temperatures or M114 position
+                if(!applyTemperatures(r)) applyPosition(r);
+            } else if (startsWith(resp, "Resend:")) {
+                resendFrom( strtoul(resp+7, nullptr, 10) );
+            } else if (startsWith(resp, "echo:busy:")) {
+                // still working on a line, a quiet spell after a Resend means nothing
+                if(staleResendAt!=0) staleResendAt = millis();
             } else if (startsWith(resp, "echo: cold extrusion prevented")) {
                 // To do: Pause sending gcode, or do something similar
                 lastResponse = "cold extrusion prevented";
-                notify_observers(DeviceStatusEvent{1}); 
+                notifyError(); 
+            }
+            else if (startsWith(resp, "Error:") && strstr(resp, "Last Line")!=nullptr ) {
+                // checksum or line number error, the printer follows up with Resend:
+                lastResponse = resp;
             }
             else if (startsWith(resp, "Error:") ) {
                 lastResponse = resp;
@@ -276,7 +366,7 @@ void MarlinDevice::tryParseResponse( char* resp, size_t len ) {
                 panic = true;
 
                 
-                notify_observers(DeviceStatusEvent{1}); 
+                notifyError(); 
             } else {
                 //incompleteResponse = true;
             }
@@ -296,70 +386,74 @@ void MarlinDevice::tryParseResponse( char* resp, size_t len ) {
 
 
 
-// Parse temperatures from printer responses like
-// ok T:32.8 /0.0 B:31.8 /0.0 T0:32.8 /0.0 @:0 B@:0
-bool MarlinDevice::parseTemperatures(const String &response) {
-    bool ret;
+bool MarlinDevice::applyTemperatures(const MarlinResponse &r) {
+    bool ret = false;
+
+    auto apply = [](const MarlinResponse::Temp &from, Temperature &to) {
+        if(!from.valid || !from.hasTarget) return false;
+        to.actual = from.actual;
+        to.target = from.target;
+        return true;
+    };
 
     if (fwExtruders == 1)
-        ret = parseTemp(response, "T", &toolTemperatures[0]);
+        ret = apply(r.activeTool, toolTemperatures[0]);
     else {
-        ret = false;
         for (int t = 0; t < fwExtruders; t++)
-            ret |= parseTemp(response, "T" + String(t), &toolTemperatures[t]);
+            ret |= apply(r.tools[t], toolTemperatures[t]);
     }
-    ret |= parseTemp(response, "B", &bedTemperature);
+    ret |= apply(r.bed, bedTemperature);
     if (!ret) {
-        // Parse Prusa heating temperatures
-        int e = extractPrusaHeatingExtruder(response);
-        ret = e >= 0 && e < MAX_SUPPORTED_EXTRUDERS && extractPrusaHeatingTemp(response, "T", toolTemperatures[e].actual);
-        ret |= extractPrusaHeatingTemp(response, "B", bedTemperature.actual);
+        // Prusa heating temperatures, no targets
+        int e = r.heatingExtruder();
+        if(e >= 0 && e < MAX_SUPPORTED_EXTRUDERS && r.activeTool.valid) {
+            toolTemperatures[e].actual = r.activeTool.actual;
+            ret = true;
+        }
+        if(r.bed.valid) {
+            bedTemperature.actual = r.bed.actual;
+            ret = true;
+        }
     }
 
-    if(ret) GD_DEBUGF("Parsed temp E:%d->%d  B:%d->%d\n", 
-        (int)toolTemperatures[0].actual, (int)toolTemperatures[0].target,  
-        (int)bedTemperature.actual, (int)bedTemperature.target );
-
-    notify_observers(DeviceStatusEvent{0});
+    if(ret) {
+        GD_DEBUGF("Parsed temp E:%d->%d  B:%d->%d\n", 
+            (int)toolTemperatures[0].actual, (int)toolTemperatures[0].target,  
+            (int)bedTemperature.actual, (int)bedTemperature.target );
+        notifyStatus();
+    }
 
     return ret;
 }
 
-// parses line T:aaa.aa /ttt.tt
-bool MarlinDevice::parseTemp(const String &response, const String whichTemp, Temperature *temperature) {
-    int tpos = response.indexOf(whichTemp + ":");
-    if (tpos != -1) { // This response contains a temperature
-        int slashpos = response.indexOf(" /", tpos);
-        int spacepos = response.indexOf(" ", slashpos + 1);
-        // if match mask T:xxx.xx /xxx.xx
-        if (slashpos != -1 && spacepos != -1) {
-            String actual = response.substring(tpos + whichTemp.length() + 1, slashpos);
-            String target = response.substring(slashpos + 2, spacepos);
-            if (isFloat(actual) && isFloat(target)) {
-                temperature->actual = actual.toFloat();
-                temperature->target = target.toFloat();
-
-                return true;
-            }
-        }
+bool MarlinDevice::applyLimits(const char* resp) {
+    if(!startsWith(resp, "echo:")) return false;
+    const char* p = resp+5;
+    while(*p==' ') p++;
+    float *to;
+    if(startsWith(p, "M203 ")) to = limits.maxRate;
+    else if(startsWith(p, "M201 ")) to = limits.maxAccel;
+    else return false;
+    static const char AXES[] = "XYZE";
+    for(p += 5; *p; ) {
+        const char* a = strchr(AXES, *p);
+        char* end;
+        float v = strtof(p+1, &end);
+        if(a!=nullptr && *a!=0 && end!=p+1) to[a-AXES] = v;
+        p = end!=p+1 ? end : p+1;
     }
-
-    return false;
+    GD_DEBUGF("Parsed limits: %s\n", resp);
+    return true;
 }
 
-// Parse position responses from printer like
-// X:-33.00 Y:-10.00 Z:5.00 E:37.95 Count X:-3300 Y:-1000 Z:2000
-bool MarlinDevice::parsePosition(const char * str) {
-    float t = extractFloat(str, "X:");
-    if(!isnan(t) ) x = t; else return false;
-    t = extractFloat(str, "Y:");
-    if(!isnan(t) ) y = t; else return false;
-    t = extractFloat(str, "Z:");
-    if(!isnan(t) ) z = t; else return false;
-    t = extractFloat(str, "E:");
-    if(!isnan(t) ) ePos = t; else return false;
+bool MarlinDevice::applyPosition(const MarlinResponse &r) {
+    if(!r.hasPosition()) return false;
+    x = r.x;
+    y = r.y;
+    z = r.z;
+    ePos = r.e;
     GD_DEBUGF("Parsed pos: X: %f, Y: %f, Z: %f, E: %f\n", x,y,z,ePos);
-    notify_observers(DeviceStatusEvent{0});
+    notifyStatus();
     return true;
 }
 
@@ -375,88 +469,32 @@ bool MarlinDevice::parseG0G1(const char *str) {
     t = extractFloat(str, "E");
     if(!isnan(t) ) ePos = t; else return false;
     GD_DEBUGF("Parsed pos: X: %f, Y: %f, Z: %f, E: %f\n", x,y,z,ePos);
-    notify_observers(DeviceStatusEvent{0});
+    notifyStatus();
     return true;
 }
 
-bool MarlinDevice::parseM115(const String &str) {
-    desc = extractM115String(str, "FIRMWARE_NAME") + " " + extractM115String(str, "MACHINE_TYPE");
-    String value = extractM115String(str, "EXTRUDER_COUNT");
-    fwExtruders = value == "" ? 1 : min(value.toInt(), (long)MAX_SUPPORTED_EXTRUDERS);
-    fwAutoreportTempCap = extractM115Bool(str, "Cap:AUTOREPORT_TEMP");
-    fwProgressCap = extractM115Bool(str, "Cap:PROGRESS");
-    fwBuildPercentCap = extractM115Bool(str, "Cap:BUILD_PERCENT");
+// FIRMWARE_NAME:Marlin 2.0.9 (Github) SOURCE_CODE_URL:... MACHINE_TYPE:Ender-3 EXTRUDER_COUNT:1 UUID:...
+// followed by one `Cap:NAME:0/1` line per capability, so only fields present in this line are updated
+bool MarlinDevice::parseM115(const char *str) {
+    char value[40];
+    if(findM115Field(str, "FIRMWARE_NAME", value, sizeof(value)) ) {
+        desc = value;
+        if(findM115Field(str, "MACHINE_TYPE", value, sizeof(value)) ) { desc += " "; desc += value; }
+    }
+    if(findM115Field(str, "EXTRUDER_COUNT", value, sizeof(value)) )
+        fwExtruders = max(1, min(atoi(value), (int)MAX_SUPPORTED_EXTRUDERS));
+    if(findM115Field(str, "Cap:AUTOREPORT_TEMP", value, sizeof(value)) ) fwAutoreportTempCap = value[0]=='1';
+    if(findM115Field(str, "Cap:PROGRESS", value, sizeof(value)) ) fwProgressCap = value[0]=='1';
+    if(findM115Field(str, "Cap:BUILD_PERCENT", value, sizeof(value)) ) fwBuildPercentCap = value[0]=='1';
     GD_DEBUGF("Parsed M115: desc=%s, extruders:%d, autotemp:%d, progress:%d, buildPercent:%d\n", 
         desc.c_str(), fwExtruders, fwAutoreportTempCap, fwProgressCap, fwBuildPercentCap );
-    notify_observers(DeviceStatusEvent{0});
-    return true;
-}
-
-
-bool MarlinDevice::isFloat(const String value) {
-    for (int i = 0; i < value.length(); i++) {
-        char ch = value[i];
-        if (ch != ' ' && ch != '.' && ch != '-' && !isDigit(ch)) return false;
-    }
+    EventBus::getBus().publish(Topic::DEVICE_STATUS, id);
     return true;
 }
 
 inline float MarlinDevice::extractFloat(const char *str, const char * key) {
-    char* s = strstr(str, key);
+    const char* s = strstr(str, key);
     if(s==NULL) return NAN; 
     s += strlen(key);
     return atof(s);
 }
-
-inline float MarlinDevice::extractFloat(const String &str, const String key) {
-    int s = str.indexOf(key);
-    if(s==-1) return NAN; 
-    s += key.length();
-    int e = str.indexOf(' ', s);
-    if(e==-1) e=str.length();
-    return str.substring(s,e).toFloat();
-}
-
-// Parse temperatures from prusa firmare (sent when heating)
-// ok T:32.8 E:0 B:31.8
-bool MarlinDevice::extractPrusaHeatingTemp(const String &response, const String whichTemp, float &temperature) {
-    int tpos = response.indexOf(whichTemp + ":");
-    if (tpos != -1) { // This response contains a temperature
-        int spacepos = response.indexOf(" ", tpos);
-        if (spacepos == -1)
-        spacepos = response.length();
-        String actual = response.substring(tpos + whichTemp.length() + 1, spacepos);
-        if (isFloat(actual)) {
-            temperature = actual.toFloat();
-            return true;
-        }
-    }
-
-    return false;
-}
-
-
-inline int MarlinDevice::extractPrusaHeatingExtruder(const String &response) {
-    float tmp;
-    return extractPrusaHeatingTemp(response, "E", tmp) ? (int)tmp : -1;
-}
-
-String MarlinDevice::extractM115String(const String &response, const String key) {
-    int spos = response.indexOf(key + ":");
-    if (spos != -1) {
-        spos += key.length() + 1;
-        int epos = response.indexOf(':', spos);
-        if (epos == -1) return response.substring(spos);
-        else {
-            while (epos >= spos && response[epos] != ' ' && response[epos] != '\n') --epos;
-            return response.substring(spos, epos);
-        }
-    }
-
-    return "";
-}
-
-inline bool MarlinDevice::extractM115Bool(const String &response, const String key, const bool onErrorValue) {
-    String result = extractM115String(response, key);
-    return result == "" ? onErrorValue : (result == "1" ? true : false);
-}
@@ -1,10 +1,19 @@
 #pragma once
 
 #include <Arduino.h>
-#include <etl/observer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <etl/vector.h>
 //#include <etl/queue.h>
+#include "../EventBus.h"
+#include "../TaskMonitor.h"
+#include "../TimeEstimator.h"
 #include "CommandQueue.h"
-#include <message_buffer.h>
+#include "CommandRing.h"
+#include "MarlinResponse.h"
+#include "GrblStatus.h"
+#include "JogEngine.h"
 
 //#define ADD_LINECOMMENTS
 
@@ -14,32 +23,30 @@
 
 #define KEEPALIVE_INTERVAL 5000    // Marlin defaults to 2 seconds, get a little of margin
 
-#define STATUS_REQUEST_INTERVAL  500
+#define STATUS_INTERVAL_ACTIVE   50     // while running a job or jogging
+#define STATUS_INTERVAL_IDLE     1000
+#define STATUS_ACTIVE_HOLD       1000   // stay fast this long after a jog
+#define STATUS_RESPONSE_TIMEOUT  2000   // give up on a status request that got no response
 
+#define RX_IDLE_POLL             10     // ms; UART check interval while no response is expected
 
-const int MAX_DEVICE_OBSERVERS = 3;
-struct DeviceStatusEvent { int statusField; };
-using DeviceObserver = etl::observer<const DeviceStatusEvent&> ;
 
 using ReceivedLineHandler = std::function< void(const char* str, size_t len) >;
 
-class GCodeDevice : public etl::observable<DeviceObserver, MAX_DEVICE_OBSERVERS> {
+class GCodeDevice {
 public:
 
+    /// The device selected on the pendant (see DeviceRegistry), nullptr until one is detected
     static GCodeDevice *getDevice();
-    //static void setDevice(GCodeDevice *dev);
 
-    GCodeDevice(Stream * s, size_t priorityBufSize=0, size_t bufSize=0): printerSerial(s), connected(false)  {
-        if(priorityBufSize!=0) buf0 = xMessageBufferCreate(priorityBufSize);
-        if(bufSize!=0) buf1 = xMessageBufferCreate(bufSize);
-        buf0Len = bufSize;
-        buf1Len = priorityBufSize;
-
-        assert(inst==nullptr);
-        inst = this;
+    /// Queue lengths are in lines; the lines themselves live in CommandPool
+    GCodeDevice(Stream * s, size_t priorityQueueLen=0, size_t queueLen=0): printerSerial(s), connected(false)  {
+        buf0.setLimit(priorityQueueLen);
+        buf1.setLimit(queueLen);
+        limits.setDefaults();
     }
-    GCodeDevice() : printerSerial(nullptr), connected(false) {}
-    virtual ~GCodeDevice() { clear_observers(); }
+    GCodeDevice() : printerSerial(nullptr), connected(false) { buf0.setLimit(0); buf1.setLimit(0); limits.setDefaults(); }
+    virtual ~GCodeDevice() {}
 
     virtual void begin() { 
         while(printerSerial->available()>0) printerSerial->read(); 
@@ -50,76 +57,158 @@ public:
         return scheduleCommand(cmd.c_str(), cmd.length() );
     };
     virtual bool scheduleCommand(const char* cmd, size_t len) {
-        if(panic) return false;
-        if(!buf1) return false;
-        if(len==0) return false;
-        return xMessageBufferSend(buf1, cmd, len, 0) != 0;
+        if(!canSchedule(len)) return false;
+        CommandHandle h = CommandPool::getPool().alloc(cmd, len);
+        if(h==CommandPool::NONE) return false;
+        if(!scheduleCommand(h)) { CommandPool::getPool().free(h); return false; }
+        return true;
     };
+    /** 
+     * Queues a line already written into a CommandPool slot, without copying it.
+     * On success the device owns the handle; on failure the caller still does.
+     */
+    virtual bool scheduleCommand(CommandHandle cmd) {
+        if(panic) return false;
+        if(CommandPool::getPool().length(cmd)==0) return false;
+        if(!buf1.push(cmd)) return false;
+        wake();
+        return true;
+    }
     virtual bool schedulePriorityCommand(String cmd) { 
         return schedulePriorityCommand(cmd.c_str(), cmd.length() );
     };
     virtual bool schedulePriorityCommand( const char* cmd, size_t len) {
         //if(panic) return false;
-        if(!buf0) return false;
-        if(len==0) return false;
-        return xMessageBufferSend(buf0, cmd, len, 0) != 0;
+        if(len==0 || len>CommandPool::MAX_LINE) return false;
+        CommandHandle h = CommandPool::getPool().alloc(cmd, len);
+        if(h==CommandPool::NONE) return false;
+        if(!buf0.push(h)) { CommandPool::getPool().free(h); return false; }
+        wake();
+        return true;
     }
     virtual bool canSchedule(size_t len) { 
         if(panic) return false;
-        if(!buf1) return false; 
-        if(len==0) return false;
-        return xMessageBufferSpaceAvailable(buf1) > len + 2; 
+        if(len==0 || len>CommandPool::MAX_LINE) return false;
+        return buf1.spaceAvailable() > 0 && CommandPool::getPool().getFree() > 0;
     }
 
     virtual bool jog(uint8_t axis, float dist, int feed=100)=0;
 
     virtual bool canJog() { return true; }
 
+    /// Streams jogs from encoder ticks, nullptr if the device only supports jog()
+    virtual JogEngine* getJogEngine() { return nullptr; }
+
     virtual void loop() {
         sendCommands();
+        size_t inFlight = sentCounter->bytes();
         receiveResponses();
+        // the oks just read made room, fill it now instead of after waitForWork()
+        if(sentCounter->bytes() < inFlight && getQueueLength()>0) sendCommands();
         checkTimeout();
-
-        if(nextStatusRequestTime!=0 && millis() > nextStatusRequestTime) {
-            requestStatusUpdate();
-            nextStatusRequestTime = millis() + STATUS_REQUEST_INTERVAL;
-        }
+        pollStatus();
+        EventBus::getBus().flush();
     }
     virtual void sendCommands();
     virtual void receiveResponses();
 
+    /// Task that runs loop(), woken up by wake()
+    void setTask(TaskHandle_t t) { task = t; }
+
+    /** Tells the device task there is work for it (a command, job lines, jog ticks). Any task. */
+    void wake() {
+        if(task==nullptr || xTaskGetCurrentTaskHandle()==task) return;
+        uint32_t none = 0;
+        wakeRequestedUs.compare_exchange_strong(none, micros() | 1);
+        xTaskNotifyGive(task);
+    }
+
+    /**
+     * Blocks the device task after loop() until wake(), the next status request or a possible response.
+     * The core has no UART receive callback, so while a response is expected the port is checked 
+     * every tick, and every RX_IDLE_POLL ms otherwise.
+     * Does not block at all while there are lines the device has room for;
+     * pending tells that the caller (Job) has lines to schedule.
+     */
+    void waitForWork(bool pending = false);
+
+    struct WakeStats {
+        uint32_t wakes;         ///< waits ended by wake()
+        uint32_t avgLatencyUs;  ///< from wake() to the device task running, moving average
+        uint32_t maxLatencyUs;
+    };
+    const WakeStats & getWakeStats() { return wakeStats; }
+    /// CPU use of the device task, as far as it blocks in waitForWork()
+    TaskLoad & getLoad() { return load; }
+
     float getX() { return x; }
     float getY() { return y; }
     float getZ() { return z; }
 
     bool isConnected() { return connected; }
 
+    /// Speed and acceleration limits the device reported at begin(), MotionLimits::setDefaults() until then
+    const MotionLimits & getMotionLimits() { return limits; }
+
+    /// Index in DeviceRegistry, sent as the value of device events
+    void setId(uint8_t i) { id = i; }
+    uint8_t getId() { return id; }
+    Stream* getSerial() { return printerSerial; }
+    /// UART speed the device was detected at, 0 if not known
+    void setBaudRate(uint32_t b) { baudRate = b; }
+    uint32_t getBaudRate() { return baudRate; }
+
     virtual void reset()=0;
 
     bool isInPanic() { return panic; }
 
-    virtual void enableStatusUpdates(bool v=true) {
-        if(v) nextStatusRequestTime = millis();
-        else nextStatusRequestTime = 0;
-    }
+    /** 
+     * Periodic status requests, every STATUS_INTERVAL_ACTIVE ms while the machine is busy 
+     * and STATUS_INTERVAL_IDLE ms otherwise. Only one request is in flight at a time.
+     */
+    void enableStatusUpdates(bool v=true) { statusUpdatesEnabled = v; }
+    bool isStatusUpdatesEnabled() { return statusUpdatesEnabled; }
 
     String getType() { return typeStr; }
 
     String getDescrption() { return desc; }
 
+    /// Lines scheduled but not sent yet
     size_t getQueueLength() {  
-        return (  buf0Len - xMessageBufferSpaceAvailable(buf0)  ) + 
-            (  buf1Len - xMessageBufferSpaceAvailable(buf1)  ); 
+        return buf0.size() + buf1.size() +
+            (curUnsentCmd!=CommandPool::NONE ? 1 : 0) + (curUnsentPriorityCmd!=CommandPool::NONE ? 1 : 0);
     }
 
     size_t getSentQueueLength()  {
         return sentCounter->bytes();
     }
 
-    virtual void requestStatusUpdate() = 0;
+    /** Schedules a status request right away; normally done by pollStatus() */
+    virtual bool requestStatusUpdate() = 0;
+
+    /// Time from scheduling a status request to getting the report
+    struct StatusStats {
+        uint32_t requests;
+        uint32_t responses;
+        uint32_t timeouts;
+        uint32_t lastLatencyUs;
+        uint32_t avgLatencyUs;  ///< moving average
+        uint32_t maxLatencyUs;
+    };
+    const StatusStats & getStatusStats() { return statusStats; }
 
     void addReceivedLineHandler( ReceivedLineHandler h) { receivedLineHandlers.push_back(h); }
 
+    /// UART writes done by sendCommands(); one write carries all lines sent in a pass
+    struct TxStats {
+        uint32_t writes;
+        uint32_t lines;
+        uint32_t bytes;
+    };
+    const TxStats & getTxStats() { return txStats; }
+    float getLinesPerWrite() { return txStats.writes==0 ? 0 : 1.0 * txStats.lines / txStats.writes; }
+    float getBytesPerWrite() { return txStats.writes==0 ? 0 : 1.0 * txStats.bytes / txStats.writes; }
+
 protected:
     Stream * printerSerial;
 
@@ -127,24 +216,77 @@ protected:
     bool connected;
     String desc;
     String typeStr;
-    size_t buf0Len, buf1Len;
     bool canTimeout;
+    uint8_t id = 0;
+    uint32_t baudRate = 0;
 
-    static const size_t MAX_GCODE_LINE = 96;
-    char curUnsentCmd[MAX_GCODE_LINE+1], curUnsentPriorityCmd[MAX_GCODE_LINE+1];
-    size_t curUnsentCmdLen, curUnsentPriorityCmdLen;
+    static const size_t MAX_GCODE_LINE = CommandPool::MAX_LINE;
+    CommandHandle curUnsentCmd = CommandPool::NONE, curUnsentPriorityCmd = CommandPool::NONE;
 
     float x,y,z;
     bool panic = false;
-    uint32_t nextStatusRequestTime;
-    MessageBufferHandle_t  buf0;
-    MessageBufferHandle_t  buf1;
+    MotionLimits limits;
+
+    bool statusUpdatesEnabled = false;
+    bool statusInFlight = false;
+    uint32_t statusRequestedAt;     ///< millis
+    uint32_t statusRequestedUs;
+    uint32_t activeUntil = 0;
+    StatusStats statusStats = {};
+    // filled from any task (Job, UI, web, console), drained by the device task
+    CommandRing<CommandHandle, 8, true>  buf0;
+    CommandRing<CommandHandle, 32, true>  buf1;
 
     bool xoff;
     bool xoffEnabled = false;
 
     Counter * sentCounter;
 
+    static const size_t TX_BUF_LEN = 512;
+    char txBuf[TX_BUF_LEN];
+    size_t txLen = 0;
+    TxStats txStats = {};
+
+    TaskHandle_t task = nullptr;
+    std::atomic<uint32_t> wakeRequestedUs{0};
+    WakeStats wakeStats = {};
+    TaskLoad load;
+
+    static const size_t MAX_RESPONSE = 200; // M115 is far longer than 100
+    char rxLine[MAX_RESPONSE+1];
+    size_t rxLen = 0;
+    #ifdef ADD_LINECOMMENTS
+    size_t nline = 0;
+    #endif
+
+    /** Adds data (plus newline, for non-realtime commands) to the current TX batch. */
+    void queueTx(const char* data, size_t len, bool newline=true) {
+        if(txLen + len + 1 > TX_BUF_LEN) flushTx();
+        memcpy(txBuf+txLen, data, len);
+        txLen += len;
+        if(newline) { txBuf[txLen++] = '\n'; txStats.lines++; }
+    }
+    void flushTx() {
+        if(txLen==0) return;
+        printerSerial->write(txBuf, txLen);
+        txStats.writes++;
+        txStats.bytes += txLen;
+        txLen = 0;
+    }
+
+    /// Publishes Topic::DEVICE_STATUS, unless statusFingerprint() is the same as last time
+    void notifyStatus() { EventBus::getBus().publishIfChanged(Topic::DEVICE_STATUS, statusFingerprint(), lastStatusFingerprint, id); }
+    void notifyError() { EventBus::getBus().publish(Topic::DEVICE_ERROR, id); }
+    uint32_t lastStatusFingerprint = 0;
+    /// Digest of everything the UI shows about the device
+    virtual uint32_t statusFingerprint() {
+        uint32_t h = EventBus::hash(x);
+        h = EventBus::hash(y, h);
+        h = EventBus::hash(z, h);
+        h = EventBus::hash(connected, h);
+        return EventBus::hash(panic, h);
+    }
+
     void armRxTimeout() {
         if(!canTimeout) return;
         //GD_DEBUGLN(enable ? "GCodeDevice::resetRxTimeout enable" : "GCodeDevice::resetRxTimeout disable");
@@ -167,24 +309,65 @@ protected:
             connected = false; 
             cleanupQueue();
             disarmRxTimeout(); 
-            notify_observers(DeviceStatusEvent{1});
+            notifyError();
         }
     }
 
-    void cleanupQueue() { 
-        if(buf1) xMessageBufferReset(buf1); 
-        if(buf0) xMessageBufferReset(buf0); 
+    virtual void cleanupQueue() { 
+        CommandHandle h;
+        while(buf1.pop(h)) CommandPool::getPool().free(h);
+        while(buf0.pop(h)) CommandPool::getPool().free(h);
         sentCounter->clear();
-        curUnsentCmdLen = 0;
+        CommandPool::getPool().free(curUnsentCmd);
+        curUnsentCmd = CommandPool::NONE;
+        statusInFlight = false;
+    }
+
+    bool loadNextCommand();
+
+    /** True while the machine moves or has lines to execute; status is polled faster then */
+    virtual bool isBusy() {
+        return getQueueLength()>0 || sentCounter->bytes()>0 || (int32_t)(activeUntil - millis()) > 0;
+    }
+    virtual uint32_t getStatusInterval() { return isBusy() ? STATUS_INTERVAL_ACTIVE : STATUS_INTERVAL_IDLE; }
+    /// Something was sent that the device will answer soon
+    virtual bool isAwaitingResponse() { return sentCounter->bytes()>0 || statusInFlight; }
+    /// Jogs are short; poll fast for a while so that the DRO follows them
+    void markActive() { activeUntil = millis() + STATUS_ACTIVE_HOLD; }
+
+    void pollStatus() {
+        if(!statusUpdatesEnabled) return;
+        uint32_t now = millis();
+        if(statusInFlight) {
+            if(now - statusRequestedAt < STATUS_RESPONSE_TIMEOUT) return;
+            statusInFlight = false;
+            statusStats.timeouts++;
+        }
+        if(statusStats.requests!=0 && now - statusRequestedAt < getStatusInterval() ) return;
+        if(!requestStatusUpdate()) return;
+        statusInFlight = true;
+        statusRequestedAt = now;
+        statusRequestedUs = micros();
+        statusStats.requests++;
+    }
+
+    /** Call when the reply to requestStatusUpdate() has been parsed */
+    void onStatusReceived() {
+        if(!statusInFlight) return;
+        statusInFlight = false;
+        uint32_t dt = micros() - statusRequestedUs;
+        statusStats.responses++;
+        statusStats.lastLatencyUs = dt;
+        statusStats.avgLatencyUs = statusStats.responses==1 ? dt : (statusStats.avgLatencyUs*7 + dt) / 8;
+        if(dt > statusStats.maxLatencyUs) statusStats.maxLatencyUs = dt;
     }
 
-    virtual void trySendCommand() = 0;
+    /** Sends the pending priority (or, if none, normal) command if the device has room for it. */
+    virtual bool trySendCommand() = 0;
 
     virtual void tryParseResponse( char* cmd, size_t len ) = 0;
 
 private:
-    static GCodeDevice *inst;
-
     etl::vector<ReceivedLineHandler, 3> receivedLineHandlers;
     //friend void loop();
 
@@ -195,12 +378,14 @@ private:
 class GrblDevice : public GCodeDevice {
 public:
 
-    GrblDevice(Stream * s): GCodeDevice(s, 20, 100) { 
+    GrblDevice(Stream * s): GCodeDevice(s, 8, 24) { 
         typeStr = "grbl";
         sentCounter = &sentQueue; 
         canTimeout = false;
+        resetGrblStatus(report);
+        limits.flags = MotionLimits::DWELL_SECONDS;
     };
-    GrblDevice() : GCodeDevice() {typeStr = "grbl"; sentCounter = &sentQueue; }
+    GrblDevice() : GCodeDevice() {typeStr = "grbl"; sentCounter = &sentQueue; resetGrblStatus(report); limits.flags = MotionLimits::DWELL_SECONDS; }
 
     virtual ~GrblDevice() {}
 
@@ -208,9 +393,31 @@ public:
 
     bool canJog() override;
 
+    JogEngine* getJogEngine() override { return &jogEngine; }
+
+    void loop() override {
+        jogEngine.loop();
+        GCodeDevice::loop();
+    }
+
+    /** Writes a realtime command byte right away, ahead of everything queued. Device task only. */
+    void sendRealtime(uint8_t c) {
+        queueTx((const char*)&c, 1, false);
+        flushTx();
+    }
+
+    /** A priority line of len bytes would go out in the next pass instead of waiting in buf0 */
+    bool canSendPriorityNow(size_t len) {
+        return buf0.empty() && curUnsentPriorityCmd==CommandPool::NONE && sentCounter->canPush(len);
+    }
+
+    /** Frees `$J=` lines at the head of the priority queue, so none goes out after a jog cancel. Device task only. */
+    void dropUnsentJogs();
+
     virtual void begin() {
         GCodeDevice::begin();
         schedulePriorityCommand("$I");
+        schedulePriorityCommand("$$");
         schedulePriorityCommand("?");
     }
 
@@ -221,37 +428,68 @@ public:
         schedulePriorityCommand(&c, 1);
     }
 
-    virtual void requestStatusUpdate() override {        
-        schedulePriorityCommand("?");
+    virtual bool requestStatusUpdate() override {        
+        return schedulePriorityCommand("?");
     }
 
     /// WPos = MPos - WCO
-    float getXOfs() { return ofsX; } 
-    float getYOfs() { return ofsY; }
-    float getZOfs() { return ofsZ; }
-    uint getSpindleVal() { return spindleVal; }
-    uint getFeed() { return feed; }
-    String & getStatus() { return status; }
+    float getXOfs() { return report.wco[0]; } 
+    float getYOfs() { return report.wco[1]; }
+    float getZOfs() { return report.wco[2]; }
+    uint getSpindleVal() { return report.spindle; }
+    uint getFeed() { return report.feed; }
+    const char* getStatus() { return report.state; }
     String & getLastResponse() { return lastResponse; }
+    /// All fields of the last status report
+    const GrblStatus & getStatusReport() { return report; }
+
+    /// Serial RX buffer size, as reported by `[OPT:...]` (128 until then)
+    size_t getRxBufferSize() { return sentQueue.getCapacityBytes(); }
+    /// Part of the RX buffer occupied by sent, not yet acknowledged lines
+    float getRxFill() { return 1.0 * sentQueue.bytes() / sentQueue.getCapacityBytes(); }
+    /// Planner fill from the last status report, negative if the device doesn't send `Bf:` (see $10)
+    float getPlannerFill() { return plannerFill; }
+    /// `$$` listed $10 without the buffer bit (2): status reports have no `Bf:`, so no planner fill
+    bool isBufferReportOff() { return bufferReportOff; }
+    /// Smoothed planner fill over recent status reports
+    float getAvgPlannerFill() { return plannerFillAvg; }
 
 protected:
-    void trySendCommand() override;
+    bool trySendCommand() override;
 
     void tryParseResponse( char* cmd, size_t len ) override;
+
+    bool isBusy() override;
+
+    /// A jog needs its stop detected and segments sent in time
+    bool isAwaitingResponse() override { return GCodeDevice::isAwaitingResponse() || jogEngine.isActive(); }
+
+    uint32_t statusFingerprint() override;
     
 private:
     
-    SimpleCounter<15,128> sentQueue;
+    static const size_t MAX_SENT_LINES = 128;
+
+    /// Character counting: as many lines as fit into the RX buffer, line count is not limited by Grbl
+    SimpleCounter<MAX_SENT_LINES,128> sentQueue;
+
+    uint16_t plannerBlocks = 15;
+    float plannerFill = -1;
+    float plannerFillAvg = -1;
+    bool bufferReportOff = false;
     
     String lastResponse;
 
-    String status;
+    GrblStatus report;
+
+    JogEngine jogEngine{this};
 
-    //WPos = MPos - WCO
-    float ofsX,ofsY,ofsZ;
-    uint feed, spindleVal;
+    void applyStatusReport();
 
-    void parseGrblStatus(char* v);
+    void parseGrblOptions(const char* v);
+
+    /// `$110=500.000`: rates and accelerations go to limits
+    void parseGrblSetting(const char* v);
 
     bool isCmdRealtime(char* data, size_t len);
 
@@ -264,7 +502,7 @@ class MarlinDevice: public GCodeDevice {
 
 public:
 
-    MarlinDevice(Stream * s): GCodeDevice(s, 100, 200) { 
+    MarlinDevice(Stream * s): GCodeDevice(s, 8, 8) { 
         typeStr = "marlin";
         sentCounter = &sentQueue;
         canTimeout = true;
@@ -274,9 +512,10 @@ public:
     virtual ~MarlinDevice() {}
 
     virtual bool jog(uint8_t axis, float dist, int feed) override {
+        markActive();
         constexpr const char AXIS[] = {'X', 'Y', 'Z', 'E'};
         char msg[81]; snprintf(msg, 81, "G0 F%d %c%04f", feed, AXIS[axis], dist);
-        if(  xMessageBufferSpacesAvailable(buf1)>strlen(msg)+3+3+6 ) return false;
+        if( buf0.spaceAvailable() < 3 || CommandPool::getPool().getFree() < 3 ) return false;
         schedulePriorityCommand("G91");
         schedulePriorityCommand(msg);
         schedulePriorityCommand("G90");
@@ -285,7 +524,10 @@ public:
 
     virtual void begin() {
         GCodeDevice::begin();
+        // sent as "N0 M110 N0*..", Marlin takes the new line number right away
+        if(lineNumbers && !schedulePriorityCommand("M110 N0") ) GD_DEBUGS("could not schedule M110");
         if(! schedulePriorityCommand("M115") ) GD_DEBUGS("could not schedule M115");
+        if(! schedulePriorityCommand("M503") ) GD_DEBUGS("could not schedule M503");
         if(! schedulePriorityCommand("M114") ) GD_DEBUGS("could not schedule M114");
         if(! schedulePriorityCommand("M105") ) GD_DEBUGS("could not schedule M105");
     }
@@ -299,9 +541,11 @@ public:
 
     //virtual void receiveResponses() ;
 
-    void requestStatusUpdate() override {
-        schedulePriorityCommand("M114"); // temp
-        schedulePriorityCommand("M105"); // pos
+    bool requestStatusUpdate() override {
+        if( buf0.spaceAvailable() < 2 || CommandPool::getPool().getFree() < 2 ) return false;
+        schedulePriorityCommand("M114"); // pos
+        schedulePriorityCommand("M105"); // temp, its 'ok' completes the request
+        return true;
     }
 
     struct Temperature {
@@ -313,23 +557,70 @@ public:
     const Temperature & getExtruderTemp(uint8_t e) const { return toolTemperatures[e]; }
     uint8_t getExtruderCount() const { return fwExtruders; }
 
+    /**
+     * Send every line as `N<num> <cmd>*<checksum>`, so that the printer detects corrupted lines 
+     * and asks for them with `Resend:`. Set before begin().
+     */
+    void setLineNumbers(bool v) { lineNumbers = v; }
+    bool getLineNumbers() { return lineNumbers; }
+    /// Lines sent again after a `Resend:`
+    uint32_t getResentLines() { return resentLines; }
+
+    void sendCommands() override;
+
 protected:
 
-    void trySendCommand() override;
+    bool trySendCommand() override;
+
+    void cleanupQueue() override {
+        GCodeDevice::cleanupQueue();
+        while(!resendQueue.empty()) { CommandPool::getPool().free(resendQueue.front()); resendQueue.pop(); }
+        staleResends = 0;
+        staleResendAt = 0;
+        oksToSkip = 0;
+    }
 
     void tryParseResponse( char* cmd, size_t len ) override;
 
+    /// every poll is two lines in the planner queue, so keep it slower than Grbl's '?' while printing
+    uint32_t getStatusInterval() override { return isBusy() ? STATUS_INTERVAL_MARLIN_ACTIVE : STATUS_INTERVAL_IDLE; }
+
+    uint32_t statusFingerprint() override {
+        uint32_t h = GCodeDevice::statusFingerprint();
+        h = EventBus::hash(toolTemperatures, h);
+        h = EventBus::hash(bedTemperature, h);
+        return EventBus::hash(ePos, h);
+    }
+
 private:
 
+    static const uint32_t STATUS_INTERVAL_MARLIN_ACTIVE = 500;
+    /// above Marlin's 2s busy keepalive, below KEEPALIVE_INTERVAL
+    static const uint32_t RESEND_QUIET_MS = 3000;
+
     static const int MAX_SUPPORTED_EXTRUDERS = 3;
 
     static const size_t MAX_SENT_BYTES = 128;
-    static const size_t MAX_SENT_LINES = 400;
+    static const size_t MAX_SENT_LINES = 64;
+
+    SizedQueue<MAX_SENT_LINES, MAX_SENT_BYTES> sentQueue;
 
-    SizedQueue<MAX_SENT_LINES, MAX_SENT_BYTES, MAX_GCODE_LINE> sentQueue;
+    bool lineNumbers = true;
+    uint32_t nextLineNumber = 0;
+    /// lines the printer asked for again, sent before anything else
+    etl::queue<CommandHandle, MAX_SENT_LINES> resendQueue;
+    uint32_t lastResendLine = 0;
+    size_t staleResends = 0;    ///< lines sent after lastResendLine that may still be rejected with the same Resend
+    uint32_t staleResendAt = 0; ///< when a Resend was last taken for a repeat, 0 once N was accepted or resent
+    size_t oksToSkip = 0;       ///< 'ok's following a Resend, they acknowledge nothing in sentQueue
+    uint32_t resentLines = 0;
+
+    bool sendLine(CommandHandle cmd);
+    void resendFrom(uint32_t lineNumber);
+    void requeueFrom(uint32_t lineNumber);
 
     int fwExtruders = 1;
-    bool fwAutoreportTempCap, fwProgressCap, fwBuildPercentCap;
+    bool fwAutoreportTempCap = false, fwProgressCap = false, fwBuildPercentCap = false;
     bool autoreportTempEnabled;
 
     Temperature toolTemperatures[MAX_SUPPORTED_EXTRUDERS];
@@ -337,59 +628,68 @@ private:
     String lastResponse;
     float ePos; ///< extruder pos
 
-    bool parseTemperatures(const String &response);
-
-    // Parse temperatures from printer responses like
-    // ok T:32.8 /0.0 B:31.8 /0.0 T0:32.8 /0.0 @:0 B@:0
-    bool parseTemp(const String &response, const String whichTemp, Temperature *temperature);
-    
-    // Parse position responses from printer like
-    // X:-33.00 Y:-10.00 Z:5.00 E:37.95 Count X:-3300 Y:-1000 Z:2000
-    bool parsePosition(const char *str);
+    /// applies temperatures from `ok T:32.8 /0.0 B:31.8 /0.0 T0:32.8 /0.0 @:0 B@:0` or Prusa `T:32.8 E:0 B:31.8`
+    bool applyTemperatures(const MarlinResponse &r);
+    /// applies `echo:  M203 X500.00 Y500.00 Z5.00 E25.00` or `echo:  M201 ...` from M503 to limits
+    bool applyLimits(const char* resp);
+    /// applies position from `X:-33.00 Y:-10.00 Z:5.00 E:37.95 Count X:-3300 Y:-1000 Z:2000`
+    bool applyPosition(const MarlinResponse &r);
 
-    bool parseM115(const String &str);
+    bool parseM115(const char *str);
     bool parseG0G1(const char * str);
 
-
-    static float extractFloat(const String &str, const String key) ;
     static float extractFloat(const char * str, const char* key) ;
-    
-    static bool isFloat(const String value);
-
-    // Parse temperatures from prusa firmare (sent when heating)
-    // ok T:32.8 E:0 B:31.8
-    static bool extractPrusaHeatingTemp(const String &response, const String whichTemp, float &temperature) ;
-
-    static int extractPrusaHeatingExtruder(const String &response) ;
 
-    static String extractM115String(const String &response, const String field) ;
-
-    static bool extractM115Bool(const String &response, const String field, const bool onErrorValue = false);
 
 };
 
-String readStringUntil(Stream &PrinterSerial, char terminator, size_t timeout);
-String readString(Stream &PrinterSerial, size_t timeout, size_t timeout2=100);
-
+/**
+ * Finds out firmware type and baud rate of the device on a serial port.
+ *
+ * The probes of all types (`$I` for Grbl, `M115` for Marlin) go out in one burst, 
+ * and the answer is recognized from a single response window. 
+ * The port is polled with vTaskDelay() in between, so detection does not hold a CPU.
+ * UART autobaud is of no use here: controllers stay silent until they are asked something.
+ */
 class DeviceDetector {
 public:
 
+    enum Type: int8_t { TYPE_GRBL = 0, TYPE_MARLIN = 1 };
     constexpr static int N_TYPES = 2;
+    static const uint8_t ALL_TYPES = (1<<N_TYPES) - 1;
 
     constexpr static int N_SERIAL_BAUDS = 3;
 
     static const uint32_t serialBauds[];   // Marlin valid bauds (removed very low bauds; roughly ordered by popularity to speed things up)
 
-    static GCodeDevice* detectPrinter(HardwareSerial &PrinterSerial);
+    static const uint32_t RESPONSE_WINDOW = 300;  // ms; M115 takes Marlin some tens of ms
+    static const uint32_t QUIET_TIME = 50;        // ms without data that ends the answers to the probes
 
-    static GCodeDevice* detectPrinterAttempt(HardwareSerial &PrinterSerial, uint32_t speed, uint8_t type);
+    /// Room for a device of any type; every serial port being probed needs its own
+    struct DeviceBuffer {
+        alignas(alignof(MarlinDevice) > alignof(GrblDevice) ? alignof(MarlinDevice) : alignof(GrblDevice))
+        char data[sizeof(MarlinDevice) > sizeof(GrblDevice) ? sizeof(MarlinDevice) : sizeof(GrblDevice)];
+    };
+
+    /** 
+     * Probes until a device answers; the device is created in buf.
+     * lastBaud and lastType (from a previous detection, see typeOf()) are tried first, 
+     * so a known device is found within one response window.
+     */
+    static GCodeDevice* detectPrinter(HardwareSerial &PrinterSerial, DeviceBuffer &buf, uint32_t lastBaud=0, int8_t lastType=-1);
 
-    static uint32_t serialBaud;    
+    /** @param types bit mask of Type to probe for */
+    static GCodeDevice* detectPrinterAttempt(HardwareSerial &PrinterSerial, uint32_t speed, uint8_t types, DeviceBuffer &buf);
+
+    static Type typeOf(GCodeDevice *dev) { return dev->getType()=="grbl" ? TYPE_GRBL : TYPE_MARLIN; }
 
 private:
-    static void sendProbe(uint8_t i, Stream &serial);
+    static void sendProbes(uint8_t types, Stream &serial);
+
+    /// @return Type recognized in the line, or -1
+    static int8_t matchResponse(const char* line, uint8_t types);
 
-    static GCodeDevice* checkProbe(uint8_t i, String v, Stream &serial) ;
+    static void drain(Stream &serial);
 
 };
 
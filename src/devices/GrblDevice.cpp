@@ -2,19 +2,39 @@
 
 
     bool GrblDevice::jog(uint8_t axis, float dist, int feed) {
+        markActive();
         constexpr static char AXIS[] = {'X', 'Y', 'Z'};
         char msg[81]; snprintf(msg, 81, "$J=G91 F%d %c%.3f", feed, AXIS[axis], dist);
         return scheduleCommand(msg, strlen(msg) );
     }
         
+    void GrblDevice::dropUnsentJogs() {
+        // JogEngine only queues a segment into an empty buf0, so its segments are never behind other lines
+        CommandPool &pool = CommandPool::getPool();
+        while(true) {
+            if(curUnsentPriorityCmd==CommandPool::NONE && !buf0.pop(curUnsentPriorityCmd)) {
+                curUnsentPriorityCmd = CommandPool::NONE;
+                return;
+            }
+            if(strncmp(pool.text(curUnsentPriorityCmd), "$J=", 3)!=0) return;
+            pool.free(curUnsentPriorityCmd);
+            curUnsentPriorityCmd = CommandPool::NONE;
+        }
+    }
+
     bool GrblDevice::canJog() {        
-        return status=="Idle" || status=="Jog";
+        return strcmp(report.state, "Idle")==0 || strcmp(report.state, "Jog")==0;
         
     }
 
+    bool GrblDevice::isBusy() {
+        if(GCodeDevice::isBusy() || jogEngine.isActive()) return true;
+        return strcmp(report.state, "Run")==0 || strcmp(report.state, "Jog")==0 || strcmp(report.state, "Home")==0;
+    }
+
     bool GrblDevice::isCmdRealtime(char* data, size_t len) {
         if (len != 1) return false;
-        char c = data[0];
+        uint8_t c = data[0];
         switch(c) {
             case '?': // status
             case '~': // cycle start/stop
@@ -33,26 +53,29 @@
         }
     }
 
-    void GrblDevice::trySendCommand() {
+    bool GrblDevice::trySendCommand() {
+        CommandPool &pool = CommandPool::getPool();
 
-        if(isCmdRealtime(curUnsentPriorityCmd, curUnsentPriorityCmdLen) ) {
-            printerSerial->write(curUnsentPriorityCmd, curUnsentPriorityCmdLen);  
-            GD_DEBUGF("<  (f%3d,%3d) '%c' RT\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), curUnsentPriorityCmd[0] );
-            curUnsentPriorityCmdLen = 0;
-            return;
+        if(curUnsentPriorityCmd!=CommandPool::NONE && isCmdRealtime(pool.text(curUnsentPriorityCmd), pool.length(curUnsentPriorityCmd)) ) {
+            queueTx(pool.text(curUnsentPriorityCmd), 1, false);
+            GD_DEBUGF("<  (f%3d,%3d) '%c' RT\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), pool.text(curUnsentPriorityCmd)[0] );
+            pool.free(curUnsentPriorityCmd);
+            curUnsentPriorityCmd = CommandPool::NONE;
+            return true;
         }
 
-        char* cmd  = curUnsentPriorityCmdLen!=0 ? &curUnsentPriorityCmd[0] :  &curUnsentCmd[0]; 
-        size_t * len = curUnsentPriorityCmdLen!=0 ? &curUnsentPriorityCmdLen : &curUnsentCmdLen ;
+        CommandHandle * cmd = curUnsentPriorityCmd!=CommandPool::NONE ? &curUnsentPriorityCmd : &curUnsentCmd;
+        size_t len = pool.length(*cmd);
 
-        if( sentCounter->canPush(*len) ) {
-            sentCounter->push( cmd, *len );
-            printerSerial->write(cmd, *len);  
-            printerSerial->print('\n');
-            GD_DEBUGF("<  (f%3d,%3d) '%s' (%d)\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), cmd, *len );
-            *len = 0;
+        if( sentCounter->canPush(len) ) {
+            queueTx(pool.text(*cmd), len);
+            GD_DEBUGF("<  (f%3d,%3d) '%s' (%d)\n", sentCounter->getFreeLines(), sentCounter->getFreeBytes(), pool.text(*cmd), len );
+            sentCounter->push( *cmd );
+            *cmd = CommandPool::NONE;
+            return true;
         } else {
             //if(loadedNewCmd) GD_DEBUGF("<  Not sent, free lines: %d, free space: %d\n", sentQueue.getFreeLines() , sentQueue.getFreeBytes()  );
+            return false;
         }
 
     }
@@ -68,82 +91,87 @@
             sentQueue.pop();
             panic = true;
             GD_DEBUGF("ERR '%s'\n", resp ); 
-            notify_observers(DeviceStatusEvent{1}); 
+            notifyError(); 
             lastResponse = resp;
         } else
         if ( startsWith(resp, "<") ) {
-            parseGrblStatus(resp+1);
+            if(parseGrblStatus(resp+1, report)) applyStatusReport();
+            onStatusReceived();
         } else 
         if(startsWith(resp, "[MSG:")) {
             GD_DEBUGF("Msg '%s'\n", resp ); 
             lastResponse = resp;
-        }        
+        } else
+        if(startsWith(resp, "[OPT:")) {
+            parseGrblOptions(resp+5);
+        } else
+        if(startsWith(resp, "$")) {
+            parseGrblSetting(resp+1);
+        }
         
         GD_DEBUGF(" > (f%3d,%3d) '%s' \n", sentQueue.getFreeLines(), sentQueue.getFreeBytes(),resp );
     }
 
-    void mystrcpy(char* dst, const char* start, const char* end) {
-        while(start!=end) {
-            *(dst++) = *(start++);
-        }
-        *dst=0;
-    }
-
-    void GrblDevice::parseGrblStatus(char* v) {
+    void GrblDevice::applyStatusReport() {
         //<Idle|MPos:9.800,0.000,0.000|FS:0,0|WCO:0.000,0.000,0.000>
         //<Idle|MPos:9.800,0.000,0.000|FS:0,0|Ov:100,100,100>
-        //GD_DEBUGF("parsing %s\n", v.c_str() );
-        
-        char buf[10];
-        bool mpos;
-        char cpy[100];
-        strncpy(cpy, v, 100);
-        v=cpy;
-
-        // idle/jogging
-        char* pch = strtok(v, "|");
-        if(pch==nullptr) return;
-        status = pch; 
-        //GD_DEBUGF("Parsed Status: %s\n", status.c_str() );
-
-        // MPos:0.000,0.000,0.000
-        pch = strtok(nullptr, "|"); 
-        if(pch==nullptr) return;
+        if(report.axes >= 3) {
+            x = report.mpos[0];
+            y = report.mpos[1];
+            z = report.mpos[2];
+        }
+
+        if(report.has(GrblStatus::F_BUF)) {
+            plannerFill = 1.0f - 1.0f * report.plannerFree / plannerBlocks;
+            if(plannerFill<0) plannerFill = 0;
+            plannerFillAvg = plannerFillAvg<0 ? plannerFill : plannerFillAvg*0.8f + plannerFill*0.2f;
+        }
         
-        char *st, *fi;
-        st=pch+5;fi = strchr(st, ',');   mystrcpy(buf, st, fi);  x = atof(buf);
-        st=fi+1; fi = strchr(st, ',');   mystrcpy(buf, st, fi);  y = atof(buf);
-        st=fi+1;                                                 z = atof(st);
-        mpos = startsWith(pch, "MPos");
-        //GD_DEBUGF("Parsed Pos: %f %f %f\n", x,y,z);
-
-        // FS:500,8000 or F:500    
-        pch = strtok(nullptr, "|"); 
-        while(pch!=nullptr) {
+        jogEngine.onStatus(report);
         
-            if( startsWith(pch, "FS:") || startsWith(pch, "F:")) {
-                if(pch[1] == 'S') {
-                    st=pch+3; fi = strchr(st, ','); mystrcpy(buf, st, fi);  feed = atoi(buf);
-                    st=fi+1;  spindleVal = atoi(st);
-                } else {
-                    feed = atoi(pch+2);
-                }
-            } else 
-            if(startsWith(pch, "WCO:")) {
-                st=pch+4;fi = strchr(st, ',');   mystrcpy(buf, st, fi);  ofsX = atof(buf);
-                st=fi+1; fi = strchr(st, ',');   mystrcpy(buf, st, fi);  ofsY = atof(buf);
-                st=fi+1;                                                 ofsZ = atof(st);
-                //GD_DEBUGF("Parsed WCO: %f %f %f\n", ofsX, ofsY, ofsZ);
-            }
+        notifyStatus();
+    }
 
-            pch = strtok(nullptr, "|"); 
+    uint32_t GrblDevice::statusFingerprint() {
+        // not Bf:, it changes with every report while running and is not shown
+        uint32_t h = GCodeDevice::statusFingerprint();
+        h = EventBus::hash(report.state, sizeof(report.state), h);
+        h = EventBus::hash(report.subState, h);
+        h = EventBus::hash(report.wco, h);
+        h = EventBus::hash(report.feed, h);
+        h = EventBus::hash(report.spindle, h);
+        h = EventBus::hash(report.pins, h);
+        h = EventBus::hash(report.ovFeed, h);
+        h = EventBus::hash(report.ovRapid, h);
+        h = EventBus::hash(report.ovSpindle, h);
+        return EventBus::hash(report.accessories, h);
+    }
 
+    void GrblDevice::parseGrblSetting(const char* v) {
+        // $10 status report mask, $110-$112 max rate in mm/min, $120-$122 acceleration in mm/s^2
+        char* end;
+        long n = strtol(v, &end, 10);
+        if(*end!='=') return;
+        float val = strtof(end+1, nullptr);
+        if(n==10) {
+            bufferReportOff = ((int)val & 2) == 0;
+            if(bufferReportOff) GD_DEBUGS("$10 has no buffer bit, set $10=3 (or $10=2) for planner fill");
         }
-        
-        if(!mpos) {
-            x -= ofsX; y -= ofsY; z -= ofsZ;
-        }
-        
-        notify_observers(DeviceStatusEvent{0});
+        else if(n>=110 && n<=112) limits.maxRate[n-110] = val/60;
+        else if(n>=120 && n<=122) limits.maxAccel[n-120] = val;
+        else return;
+        GD_DEBUGF("Parsed $%ld=%f\n", n, val );
     }
 
+    void GrblDevice::parseGrblOptions(const char* v) {
+        //[OPT:V,15,128]  or grblHAL [OPT:VNMHSL,35,1024,3,0]
+        const char* p = strchr(v, ',');
+        if(p==nullptr) return;
+        int blocks = atoi(p+1);
+        p = strchr(p+1, ',');
+        if(p==nullptr) return;
+        int rxSize = atoi(p+1);
+        if(blocks>0) plannerBlocks = blocks;
+        if(rxSize>0) sentQueue.setCapacity(MAX_SENT_LINES, rxSize);
+        GD_DEBUGF("Parsed OPT: planner %d blocks, rx buffer %d bytes\n", plannerBlocks, rxSize );
+    }
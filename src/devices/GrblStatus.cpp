@@ -0,0 +1,172 @@
+#include "GrblStatus.h"
+
+#include <string.h>
+
+// Grbl prints plain decimals (`-12.345`), this is much cheaper than strtof()
+static float parseNumber(const char* &p) {
+    bool neg = false;
+    if(*p=='-') { neg = true; p++; }
+    else if(*p=='+') p++;
+    uint32_t ip = 0;
+    while(*p>='0' && *p<='9') ip = ip*10 + (*p++ - '0');
+    float v = ip;
+    if(*p=='.') {
+        p++;
+        uint32_t fp = 0, div = 1;
+        while(*p>='0' && *p<='9') {
+            if(div<100000000) { fp = fp*10 + (*p - '0'); div *= 10; }
+            p++;
+        }
+        v += (float)fp / div;
+    }
+    return neg ? -v : v;
+}
+
+static uint32_t parseUint(const char* &p) {
+    uint32_t v = 0;
+    while(*p>='0' && *p<='9') v = v*10 + (*p++ - '0');
+    if(*p=='.') { p++; while(*p>='0' && *p<='9') p++; }  // grblHAL may send a fractional feed
+    return v;
+}
+
+static inline bool isEnd(char c) { return c==0 || c=='|' || c=='>'; }
+
+// "1.000,2.000,3.000" -> number of values read
+static uint8_t parseAxes(const char* &p, float *dst) {
+    uint8_t n = 0;
+    while(true) {
+        float v = parseNumber(p);
+        if(n < GrblStatus::MAX_AXES) dst[n++] = v;
+        if(*p!=',') break;
+        p++;
+    }
+    return n;
+}
+
+static uint16_t pinBit(char c) {
+    switch(c) {
+        case 'X': return GrblStatus::PIN_X;
+        case 'Y': return GrblStatus::PIN_Y;
+        case 'Z': return GrblStatus::PIN_Z;
+        case 'A': return GrblStatus::PIN_A;
+        case 'B': return GrblStatus::PIN_B;
+        case 'C': return GrblStatus::PIN_C;
+        case 'P': return GrblStatus::PIN_PROBE;
+        case 'D': return GrblStatus::PIN_DOOR;
+        case 'H': return GrblStatus::PIN_HOLD;
+        case 'R': return GrblStatus::PIN_RESET;
+        case 'S': return GrblStatus::PIN_START;
+        default: return 0;
+    }
+}
+
+static uint8_t accessoryBit(char c) {
+    switch(c) {
+        case 'S': return GrblStatus::ACC_SPINDLE_CW;
+        case 'C': return GrblStatus::ACC_SPINDLE_CCW;
+        case 'F': return GrblStatus::ACC_FLOOD;
+        case 'M': return GrblStatus::ACC_MIST;
+        default: return 0;
+    }
+}
+
+static inline uint8_t percent(uint32_t v) { return v>255 ? 255 : v; }
+
+void resetGrblStatus(GrblStatus &s) {
+    memset(&s, 0, sizeof(s));
+    s.subState = -1;
+    s.ovFeed = s.ovRapid = s.ovSpindle = 100;
+}
+
+bool parseGrblStatus(const char* p, GrblStatus &s) {
+    s.fields = 0;
+    s.subState = -1;
+    s.pins = 0;
+    s.feed = s.spindle = 0;
+    s.lineNumber = 0;
+    s.plannerFree = s.rxFree = 0;
+
+    // state, possibly with a substate: "Idle", "Hold:0"
+    size_t n = 0;
+    while(!isEnd(*p) && *p!=':') {
+        if(n < GrblStatus::MAX_STATE) s.state[n++] = *p;
+        p++;
+    }
+    s.state[n] = 0;
+    if(*p==':') { p++; s.subState = parseUint(p); }
+    if(n==0) return false;
+
+    float pos[GrblStatus::MAX_AXES];
+    bool isMpos = true;
+    uint8_t posAxes = 0;
+
+    while(*p=='|') {
+        p++;
+        const char* key = p;
+        while(!isEnd(*p) && *p!=':') p++;
+        size_t keyLen = p-key;
+        if(*p!=':') continue;
+        p++;
+
+        switch(key[0]) {
+            case 'M':   // MPos
+            case 'W':   // WPos, WCO
+                if(keyLen==4 && key[1]=='P') {
+                    isMpos = key[0]=='M';
+                    posAxes = parseAxes(p, pos);
+                    s.fields |= isMpos ? GrblStatus::F_MPOS : GrblStatus::F_WPOS;
+                } else if(keyLen==3 && key[0]=='W' && key[1]=='C') {
+                    parseAxes(p, s.wco);
+                    s.fields |= GrblStatus::F_WCO;
+                }
+                break;
+            case 'F':   // FS:feed,spindle or F:feed
+                s.feed = parseUint(p);
+                s.fields |= GrblStatus::F_FEED;
+                if(keyLen==2 && *p==',') {
+                    p++;
+                    s.spindle = parseUint(p);
+                    s.fields |= GrblStatus::F_SPINDLE;
+                }
+                break;
+            case 'B':   // Bf:blocks,bytes
+                s.plannerFree = parseUint(p);
+                if(*p==',') { p++; s.rxFree = parseUint(p); }
+                s.fields |= GrblStatus::F_BUF;
+                break;
+            case 'L':   // Ln:
+                s.lineNumber = parseUint(p);
+                s.fields |= GrblStatus::F_LINE;
+                break;
+            case 'P':   // Pn:XYZPDHRS
+                for(; !isEnd(*p); p++) s.pins |= pinBit(*p);
+                s.fields |= GrblStatus::F_PINS;
+                break;
+            case 'O':   // Ov:feed,rapid,spindle
+                s.ovFeed = percent(parseUint(p));
+                if(*p==',') { p++; s.ovRapid = percent(parseUint(p)); }
+                if(*p==',') { p++; s.ovSpindle = percent(parseUint(p)); }
+                s.fields |= GrblStatus::F_OV;
+                break;
+            case 'A':   // A:SFM
+                s.accessories = 0;
+                for(; !isEnd(*p); p++) s.accessories |= accessoryBit(*p);
+                s.fields |= GrblStatus::F_ACC;
+                break;
+        }
+        while(!isEnd(*p)) p++;  // anything not understood
+    }
+
+    // accessories are reported along with overrides, and only when some are on
+    if(s.has(GrblStatus::F_OV) && !s.has(GrblStatus::F_ACC)) s.accessories = 0;
+
+    if(posAxes!=0) {
+        s.axes = posAxes;
+        for(uint8_t i=0; i<posAxes; i++) {
+            // WPos = MPos - WCO
+            if(isMpos) { s.mpos[i] = pos[i]; s.wpos[i] = pos[i] - s.wco[i]; }
+            else { s.wpos[i] = pos[i]; s.mpos[i] = pos[i] + s.wco[i]; }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Everything in a Grbl 1.1 (or grblHAL) status report 
+ * `<Run|MPos:1.000,2.000,3.000,0.000|Bf:15,128|Ln:99|FS:500,8000|Pn:XZP|WCO:0.000,0.000,0.000|Ov:100,100,100|A:SF>`, 
+ * filled by parseGrblStatus().
+ *
+ * Grbl sends WCO and Ov only every few reports; the struct keeps their last values, 
+ * and mpos/wpos are both valid as soon as a WCO has been seen once.
+ */
+struct GrblStatus {
+    static const size_t MAX_AXES = 6;
+    static const size_t MAX_STATE = 8;
+
+    /// Bits of fields present in the last report
+    enum Field: uint16_t {
+        F_MPOS = 1<<0, F_WPOS = 1<<1, F_WCO = 1<<2, F_FEED = 1<<3, F_SPINDLE = 1<<4,
+        F_BUF = 1<<5, F_LINE = 1<<6, F_PINS = 1<<7, F_OV = 1<<8, F_ACC = 1<<9
+    };
+
+    /// Pn: input pins
+    enum Pin: uint16_t {
+        PIN_X = 1<<0, PIN_Y = 1<<1, PIN_Z = 1<<2, PIN_A = 1<<3, PIN_B = 1<<4, PIN_C = 1<<5,
+        PIN_PROBE = 1<<6, PIN_DOOR = 1<<7, PIN_HOLD = 1<<8, PIN_RESET = 1<<9, PIN_START = 1<<10
+    };
+
+    /// A: accessories
+    enum Accessory: uint8_t { ACC_SPINDLE_CW = 1, ACC_SPINDLE_CCW = 2, ACC_FLOOD = 4, ACC_MIST = 8 };
+
+    char state[MAX_STATE+1];    ///< Idle, Run, Hold, Jog, Alarm, Door, Check, Home, Sleep
+    int8_t subState;            ///< `Hold:1`, `Door:2`; -1 if none
+    uint8_t axes;               ///< number of coordinates in MPos/WPos
+    float mpos[MAX_AXES];
+    float wpos[MAX_AXES];
+    float wco[MAX_AXES];        ///< cached
+    uint32_t feed;
+    uint32_t spindle;
+    uint16_t plannerFree;       ///< Bf: free planner blocks
+    uint16_t rxFree;            ///< Bf: free RX buffer bytes
+    uint32_t lineNumber;        ///< Ln:
+    uint16_t pins;              ///< Pin bits
+    uint8_t ovFeed, ovRapid, ovSpindle;   ///< cached, percent
+    uint8_t accessories;        ///< Accessory bits, cached with Ov (Grbl only sends A: together with Ov:)
+    uint16_t fields;            ///< Field bits
+
+    bool has(Field f) const { return (fields & f) != 0; }
+};
+
+/** Initial state, 100% overrides and zero WCO */
+void resetGrblStatus(GrblStatus &s);
+
+/**
+ * Parses a status report into s in one pass, without copying or modifying the line.
+ * Fields of s not present in this report are cleared, except cached WCO, Ov and A.
+ * @param line starts after `<`
+ * @return false if there is no state
+ */
+bool parseGrblStatus(const char* line, GrblStatus &s);
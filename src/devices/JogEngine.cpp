@@ -0,0 +1,133 @@
+#include "JogEngine.h"
+#include "GCodeDevice.h"
+
+#define JE_DEBUGF(...) // { Serial.printf(__VA_ARGS__); }
+
+static const char AXIS[] = {'X', 'Y', 'Z'};
+
+bool JogEngine::onTick(uint8_t axis, float dist, uint32_t at) {
+    Tick *t = ticks.back();
+    if(t==nullptr) { stats.droppedTicks++; return false; }
+    t->axis = axis;
+    t->dist = dist;
+    t->at = at;
+    ticks.push();
+    dev->wake();
+    return true;
+}
+
+void JogEngine::start(const Tick &t) {
+    state = State::JOGGING;
+    axis = t.axis;
+    pending = dialed = 0;
+    speed = 0;
+    tickInterval = STOP_MAX_MS;
+    lastTickAt = t.at - STOP_MIN_MS;   // speed of the first tick is unknown, assume a slow turn
+    for(size_t i=0; i<MAX_SEGMENTS; i++) segmentEnds[i] = 0;
+    startPosValid = statusValid && lastStatus.axes > axis && strcmp(lastStatus.state, "Idle")==0;
+    if(startPosValid) startPos = lastStatus.mpos[axis];
+}
+
+void JogEngine::addTick(const Tick &t) {
+    uint32_t dt = t.at - lastTickAt;
+    if(dt==0) dt = 1;
+    if(dt > STOP_MAX_MS) dt = STOP_MAX_MS;
+    float v = fabsf(t.dist) * 1000 / dt;
+    bool first = dialed==0;
+    speed = first ? v : speed*0.6f + v*0.4f;
+    tickInterval = first ? dt : (tickInterval*3 + dt) / 4;
+    lastTickAt = t.at;
+    pending += t.dist;
+    dialed += t.dist;
+}
+
+size_t JogEngine::segmentsInFlight(uint32_t now) {
+    size_t n = 0;
+    for(size_t i=0; i<MAX_SEGMENTS; i++) 
+        if(segmentEnds[i]!=0 && (int32_t)(segmentEnds[i] - now) > 0) n++;
+    return n;
+}
+
+bool JogEngine::sendSegment(uint32_t now) {
+    // a segment covers SEGMENT_MS at the wheel speed, so the planner holds about MAX_SEGMENTS*SEGMENT_MS of motion
+    float feed = speed * 60;
+    if(feed < MIN_FEED) feed = MIN_FEED;
+    if(feed > MAX_FEED) feed = MAX_FEED;
+    float len = feed / 60 * SEGMENT_MS / 1000;
+    float d = fabsf(pending) < len ? pending : (pending>0 ? len : -len);
+    if(fabsf(d) < 0.001f) return false;
+
+    char msg[40]; 
+    size_t msgLen = snprintf(msg, sizeof(msg), "$J=G91 F%d %c%.3f", (int)feed, AXIS[axis], d);
+    // only what goes out right away: a segment left waiting in buf0 would be sent after a cancel
+    if(!dev->canSendPriorityNow(msgLen)) return false;
+    if(!dev->schedulePriorityCommand(msg, msgLen)) return false;
+    pending -= d;
+    stats.segments++;
+
+    // starts after the last segment in flight ends
+    uint32_t startAt = now;
+    size_t slot = 0;
+    for(size_t i=0; i<MAX_SEGMENTS; i++) {
+        if((int32_t)(segmentEnds[i] - startAt) > 0) startAt = segmentEnds[i];
+        if((int32_t)(segmentEnds[i] - segmentEnds[slot]) < 0) slot = i;
+    }
+    segmentEnds[slot] = startAt + (uint32_t)(fabsf(d) * 60000 / feed) + 1;
+    JE_DEBUGF("jog seg %s, %d in flight\n", msg, segmentsInFlight(now) );
+    return true;
+}
+
+void JogEngine::stop() {
+    uint32_t now = millis();
+    dev->dropUnsentJogs();
+    if(segmentsInFlight(now) > 0 || pending!=0) {
+        dev->sendRealtime(0x85);
+        stats.cancels++;
+    }
+    pending = 0;
+    state = State::STOPPING;
+    stopSentAt = now;
+    JE_DEBUGF("jog stop, dialed %.3f\n", dialed);
+}
+
+void JogEngine::loop() {
+    uint32_t now = millis();
+    Tick *t;
+    while( (t = ticks.front()) != nullptr ) {
+        Tick tick = *t;
+        ticks.pop();
+        if(state==State::JOGGING && tick.axis!=axis) stop();
+        if(state!=State::JOGGING) start(tick);
+        addTick(tick);
+    }
+
+    if(state==State::JOGGING) {
+        uint32_t stopAfter = tickInterval*2;
+        if(stopAfter < STOP_MIN_MS) stopAfter = STOP_MIN_MS;
+        if(stopAfter > STOP_MAX_MS) stopAfter = STOP_MAX_MS;
+        if(now - lastTickAt > stopAfter) { 
+            stop(); 
+            return;
+        }
+        while(pending!=0 && segmentsInFlight(now) < MAX_SEGMENTS) {
+            if(!sendSegment(now)) break;
+        }
+    } else if(state==State::STOPPING && now - stopSentAt > 5000) {
+        // no Idle report, give up measuring
+        state = State::IDLE;
+    }
+}
+
+void JogEngine::onStatus(const GrblStatus &s) {
+    lastStatus = s;
+    statusValid = true;
+    if(state!=State::STOPPING || strcmp(s.state, "Idle")!=0) return;
+    state = State::IDLE;
+    if(!startPosValid || s.axes <= axis || dialed==0) return;
+
+    float over = s.mpos[axis] - (startPos + dialed);
+    if(dialed < 0) over = -over;
+    stats.lastOvershoot = over;
+    if(fabsf(over) > stats.maxOvershoot) stats.maxOvershoot = fabsf(over);
+    JE_DEBUGF("jog overshoot %.3f mm\n", over);
+}
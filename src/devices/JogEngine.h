@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "SpscRing.h"
+#include "GrblStatus.h"
+
+class GrblDevice;
+
+/**
+ * Turns encoder ticks into a stream of short `$J=` segments for Grbl.
+ *
+ * The feed of each segment follows the wheel speed, and at most MAX_SEGMENTS
+ * (about MAX_SEGMENTS*SEGMENT_MS of motion) are ahead of the machine at any time.
+ * A segment is only queued when it can be sent right away, so none is left behind a cancel.
+ * When the wheel stops, the rest is dropped with a jog cancel (0x85), and the distance 
+ * the machine ended up past the dialed position is recorded as overshoot.
+ *
+ * onTick() may be called from the UI task; everything else runs in the device task.
+ */
+class JogEngine {
+public:
+
+    static const size_t MAX_SEGMENTS = 3;
+    static const uint32_t SEGMENT_MS = 60;
+    static const uint32_t STOP_MIN_MS = 80;     ///< wheel is considered stopped after this long without ticks...
+    static const uint32_t STOP_MAX_MS = 250;    ///< ...or 2 tick intervals of the current speed, up to this
+    static const uint32_t MIN_FEED = 30;        ///< mm/min
+    static const uint32_t MAX_FEED = 6000;
+
+    struct Stats {
+        uint32_t segments;
+        uint32_t cancels;
+        uint32_t droppedTicks;  ///< tick ring was full
+        float lastOvershoot;    ///< mm past the dialed position in the jog direction, negative if short of it
+        float maxOvershoot;     ///< largest absolute value
+    };
+
+    JogEngine(GrblDevice *dev): dev(dev) {}
+
+    /** Encoder moved by dist mm on axis at time `at` (millis) */
+    bool onTick(uint8_t axis, float dist, uint32_t at);
+
+    /** Sends segments or the cancel; call from the device loop */
+    void loop();
+
+    /** Status report from the device, used to measure overshoot */
+    void onStatus(const GrblStatus &s);
+
+    bool isActive() const { return state!=State::IDLE; }
+
+    const Stats& getStats() const { return stats; }
+
+private:
+
+    struct Tick {
+        uint8_t axis;
+        float dist;
+        uint32_t at;
+    };
+
+    enum class State: uint8_t { IDLE, JOGGING, STOPPING };
+
+    GrblDevice *dev;
+    SpscRing<Tick, 16> ticks;
+
+    State state = State::IDLE;
+    uint8_t axis;
+    float pending;          ///< dialed but not sent yet
+    float dialed;           ///< total dialed in this jog
+    float startPos;
+    bool startPosValid;
+    float speed;            ///< mm/s, smoothed
+    uint32_t tickInterval;  ///< ms, smoothed
+    uint32_t lastTickAt;
+    uint32_t segmentEnds[MAX_SEGMENTS];     ///< expected completion of segments in flight (millis)
+    uint32_t stopSentAt;
+
+    GrblStatus lastStatus;
+    bool statusValid = false;
+
+    Stats stats = {};
+
+    void start(const Tick &t);
+    void stop();
+    void addTick(const Tick &t);
+    size_t segmentsInFlight(uint32_t now);
+    bool sendSegment(uint32_t now);
+};
@@ -0,0 +1,98 @@
+#include "MarlinResponse.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline bool isKey(const char* tok, size_t len, const char* key) {
+    return strlen(key)==len && strncmp(tok, key, len)==0;
+}
+
+bool parseMarlinResponse(const char* line, MarlinResponse &r) {
+    memset(&r, 0, sizeof(r));
+    const char* s = line;
+    bool found = false;
+    bool afterCount = false;    // M114 step counts follow "Count", those are not positions
+    MarlinResponse::Temp *lastTemp = nullptr; // waiting for its " /target"
+
+    while(*s) {
+        while(*s==' ') s++;
+        if(*s==0) break;
+
+        const char* tok = s;
+        while(*s && *s!=' ' && *s!=':') s++;
+        size_t len = s-tok;
+
+        if(*s!=':') {
+            // words without a value: "ok", "/210.00", "Count"
+            if(tok[0]=='/' && lastTemp!=nullptr) {
+                char* end;
+                float v = strtof(tok+1, &end);
+                if(end!=tok+1) { lastTemp->target = v; lastTemp->hasTarget = true; }
+            } else if(tok==line && isKey(tok, len, "ok")) {
+                r.ok = true;
+            } else if(isKey(tok, len, "Count")) {
+                afterCount = true;
+            }
+            lastTemp = nullptr;
+            continue;
+        }
+
+        s++; // ':'
+        char* end;
+        float v = strtof(s, &end);
+        bool isNum = end!=s;
+        s = end;
+        while(*s && *s!=' ' && *s!='/') s++;   // rest of a non-numeric value
+
+        lastTemp = nullptr;
+        if(!isNum) continue;
+
+        MarlinResponse::Temp *t = nullptr;
+        if(len==1) {
+            switch(tok[0]) {
+                case 'T': t = &r.activeTool; break;
+                case 'B': t = &r.bed; break;
+                case 'X': if(!afterCount) { r.x = v; r.axes |= MarlinResponse::AXIS_X; found = true; } break;
+                case 'Y': if(!afterCount) { r.y = v; r.axes |= MarlinResponse::AXIS_Y; found = true; } break;
+                case 'Z': if(!afterCount) { r.z = v; r.axes |= MarlinResponse::AXIS_Z; found = true; } break;
+                case 'E': if(!afterCount) { r.e = v; r.axes |= MarlinResponse::AXIS_E; found = true; } break;
+            }
+        } else if(len==2 && tok[0]=='T' && tok[1]>='0' && tok[1]<='9') {
+            size_t i = tok[1]-'0';
+            if(i < MarlinResponse::MAX_TOOLS) t = &r.tools[i];
+        }
+        if(t!=nullptr) {
+            t->actual = v;
+            t->valid = true;
+            found = true;
+            if(*s=='/') {   // "T:21.5/0.0"
+                t->target = strtof(s+1, &end);
+                t->hasTarget = end!=s+1;
+                s = end;
+            } else lastTemp = t;
+        }
+    }
+    return found;
+}
+
+bool findM115Field(const char* line, const char* key, char* out, size_t outLen) {
+    size_t keyLen = strlen(key);
+    const char* p = line;
+    while( (p = strstr(p, key)) != nullptr ) {
+        if( (p==line || p[-1]==' ') && p[keyLen]==':' ) break;
+        p += keyLen;
+    }
+    if(p==nullptr) return false;
+
+    const char* start = p + keyLen + 1;
+    const char* end = strchr(start, ':');
+    if(end==nullptr) end = start + strlen(start);
+    else {
+        while(end>start && *end!=' ') end--;
+    }
+    size_t n = end-start;
+    if(n >= outLen) n = outLen-1;
+    memcpy(out, start, n);
+    out[n] = 0;
+    return true;
+}
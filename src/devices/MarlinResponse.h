@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Fields found in one line from Marlin (or Prusa firmware), filled by parseMarlinResponse() 
+ * in a single pass over the line, without heap allocation.
+ *
+ * Handles lines like:
+ *   ok T:210.00 /210.00 B:60.00 /60.00 @:64 B@:0          (M105 or autoreport)
+ *   T:210.0 /210.0 T0:210.0 /210.0 T1:25.0 /0.0 B:60.0 /60.0 (several extruders)
+ *   T:32.8 E:0 B:31.8                                       (Prusa, while heating)
+ *   X:-33.00 Y:-10.00 Z:5.00 E:37.95 Count X:-3300 Y:-1000 Z:2000  (M114)
+ */
+struct MarlinResponse {
+    static const size_t MAX_TOOLS = 3;
+
+    struct Temp {
+        float actual;
+        float target;
+        bool valid;
+        bool hasTarget;
+    };
+
+    enum Axis: uint8_t { AXIS_X = 1, AXIS_Y = 2, AXIS_Z = 4, AXIS_E = 8 };
+
+    bool ok;            ///< line starts with `ok`
+    Temp activeTool;    ///< `T:`
+    Temp tools[MAX_TOOLS];  ///< `T0:`, `T1:`...
+    Temp bed;           ///< `B:`
+    uint8_t axes;       ///< Axis bits of the position fields found before `Count`
+    float x, y, z, e;
+
+    bool hasPosition() const { return (axes & (AXIS_X|AXIS_Y|AXIS_Z|AXIS_E)) == (AXIS_X|AXIS_Y|AXIS_Z|AXIS_E); }
+    /// Prusa firmware reports the heating extruder as `E:n` next to temperatures, -1 if not present
+    int heatingExtruder() const { return (axes & AXIS_E) && !(axes & AXIS_X) ? (int)e : -1; }
+};
+
+/** @return true if anything besides `ok` was found */
+bool parseMarlinResponse(const char* line, MarlinResponse &r);
+
+/**
+ * Finds `key:value` in an M115 reply (`FIRMWARE_NAME:Marlin 2.0.9 (Github) SOURCE_CODE_URL:...`, `Cap:AUTOREPORT_TEMP:1`).
+ * The value runs up to the last space before the next colon, so it may contain spaces.
+ * @return false if key is not found; out is truncated to outLen-1 characters
+ */
+bool findM115Field(const char* line, const char* key, char* out, size_t outLen);
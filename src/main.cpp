@@ -3,15 +3,30 @@
 #include <SPI.h>
 #include <SD.h>
 #include <U8g2lib.h>
+#include <Preferences.h>
 
 #include "devices/GCodeDevice.h"
 #include "Job.h"
+#include "DeviceRegistry.h"
+#include "TaskMonitor.h"
+#include "UploadWriter.h"
+#include "DirCache.h"
+#include "ResumePoint.h"
 #include "ui/FileChooser.h"
+#include "ui/DeviceChooser.h"
 #include "ui/DRO.h"
 #include "ui/GrblDRO.h"
 #include "InetServer.h"
+#ifdef RING_BENCH
+  #include "bench/RingBench.h"
+#endif
 
+// one per DeviceRegistry slot
 HardwareSerial PrinterSerial(2);
+HardwareSerial PrinterSerial2(1);
+HardwareSerial * const deviceSerials[DeviceRegistry::MAX_DEVICES] = { &PrinterSerial, &PrinterSerial2 };
+struct SerialPins { int8_t rx, tx; };
+SerialPins devicePins[DeviceRegistry::MAX_DEVICES] = { {-1, -1}, {-1, -1} };
 
 #ifdef DEBUGF
   #undef DEBUGF
@@ -41,48 +56,108 @@ U8G2 &Display::u8g2 = u8g2_;
 
 WebServer server;
 
-GCodeDevice *dev = nullptr;
-
-Job *job;
-
 enum class Mode {
     DRO, FILECHOOSER
 };
 
 Display display;
 FileChooser fileChooser;
-uint8_t droBuffer[ sizeof(GrblDRO) ];
-DRO *dro;
+DeviceChooser deviceChooser;
+alignas(GrblDRO) uint8_t droBuffers[DeviceRegistry::MAX_DEVICES][ sizeof(GrblDRO) ];
+DRO *dros[DeviceRegistry::MAX_DEVICES];
 Mode cMode = Mode::DRO;
 
+/// DRO of the selected device, nullptr while it is being detected
+DRO* selectedDro() { return dros[ DeviceRegistry::get().getSelectedIndex() ]; }
+
 
 void encISR();
 void bt1ISR();
 void bt2ISR();
 void bt3ISR();
 
-bool detectPrinterAttempt(uint32_t speed, uint8_t type);
-void detectPrinter();
 
 void deviceLoop(void* );
-TaskHandle_t deviceTask;
+TaskHandle_t deviceTasks[DeviceRegistry::MAX_DEVICES];
 
 void wifiLoop(void * );
 TaskHandle_t wifiTask;
 
+void readerLoop(void * );
+TaskHandle_t readerTasks[DeviceRegistry::MAX_DEVICES];
+TaskLoad readerLoads[DeviceRegistry::MAX_DEVICES];
+
+void renderLoop(void * );
+TaskHandle_t renderTask;
+
+void uploadLoop(void * );
+TaskHandle_t uploadTask;
+
+void dirLoop(void * );
+TaskHandle_t dirTask;
+
+void uiLoop(void * );
+TaskHandle_t uiTask;
+TaskLoad uiLoad;
+#define UI_POLL_MS 5
+
+/** 
+ * Core and priority of every task; "tasks" in config.json overrides entries by name, 
+ * e.g. "tasks": { "render": { "core": 1, "priority": 0 } }.
+ * The first device streams alone on core 1, above everything else. 
+ * The web server (AsyncTCP) runs on core 0 too, see CONFIG_ASYNC_TCP_RUNNING_CORE in platformio.ini.
+ */
+struct TaskPlacement { const char* name; BaseType_t core; UBaseType_t priority; };
+enum TaskId { T_DEVICE0, T_DEVICE1, T_READER0, T_READER1, T_UPLOAD, T_DIR, T_UI, T_RENDER, T_WEB, N_TASKS };
+TaskPlacement taskMap[N_TASKS] = {
+    {"device0", 1, 3},
+    {"device1", 0, 3},
+    {"reader0", 0, 2},
+    {"reader1", 0, 2},
+    {"upload",  0, 2},
+    {"dir",     0, 1},
+    {"ui",      0, 1},
+    {"render",  0, tskIDLE_PRIORITY},   // below the readers
+    {"web",     0, 1},
+};
+
+void configTasks(JsonObjectConst cfg) {
+    if(cfg.isNull()) return;
+    for(TaskPlacement &t: taskMap) {
+        JsonObjectConst c = cfg[t.name].as<JsonObjectConst>();
+        if(c.isNull()) continue;
+        t.core = c["core"] | (int)t.core;
+        t.priority = c["priority"] | (int)t.priority;
+        if(t.core<0 || t.core>1) t.core = tskNO_AFFINITY;
+        if(t.priority >= configMAX_PRIORITIES) t.priority = configMAX_PRIORITIES-1;
+    }
+}
+
+TaskHandle_t createTask(TaskFunction_t f, TaskId id, void *param, TaskLoad *load) {
+    const TaskPlacement &t = taskMap[id];
+    TaskHandle_t ret;
+    xTaskCreatePinnedToCore(f, t.name, 4096, param, t.priority, &ret, t.core);
+    if(load!=nullptr) TaskMonitor::get().add(t.name, t.core==tskNO_AFFINITY ? -1 : t.core, t.priority, load);
+    return ret;
+}
+
 
 void setup() {
 
     Serial.begin(115200);
 
+#ifdef RING_BENCH
+    runRingBench(100000);
+#endif
+
     pinMode(PIN_BT1, INPUT_PULLUP);
     pinMode(PIN_BT2, INPUT_PULLUP);
     pinMode(PIN_BT3, INPUT_PULLUP);
 
-    pinMode(PIN_ENC1, INPUT_PULLUP);
-    pinMode(PIN_ENC2, INPUT_PULLUP);
+    Display::encoder.begin(PIN_ENC1, PIN_ENC2);
 
     attachInterrupt(PIN_ENC1, encISR, CHANGE);
+    attachInterrupt(PIN_ENC2, encISR, CHANGE);
     attachInterrupt(PIN_BT1, bt1ISR, CHANGE);
     attachInterrupt(PIN_BT2, bt2ISR, CHANGE);
     attachInterrupt(PIN_BT3, bt3ISR, CHANGE);
@@ -100,30 +175,55 @@ void setup() {
 
     Serial.print("Initializing SD card...");
 
-    if (!SD.begin(PIN_CE_SD)) {
+    // two jobs with their sidecars, an upload with its sidecar and index, directory listings
+    const uint8_t SD_MAX_FILES = 12;
+    if (!SD.begin(PIN_CE_SD, SPI, 4000000, "/sd", SD_MAX_FILES)) {
         Serial.println("initialization failed!");
         while (1);
     }
     Serial.println("initialization done.");
 
-    DynamicJsonDocument cfg(512);
+    DynamicJsonDocument cfg(1024);
     File file = SD.open("/config.json");
     DeserializationError error = deserializeJson(cfg, file);
     if (error)  Serial.println(F("Failed to read file, using default configuration"));
  
     server.config( cfg["web"].as<JsonObjectConst>() );
-    server.add_observer(display);
+    display.setMaxFps( cfg["display"]["maxFps"] | 20 );
+    configTasks( cfg["tasks"].as<JsonObjectConst>() );
+
+
+    // "devices": [ {}, {"rx": 25, "tx": 15} ]; the first one is UART2 on its default pins, the second UART1
+    DeviceRegistry &registry = DeviceRegistry::get();
+    JsonArrayConst devCfg = cfg["devices"].as<JsonArrayConst>();
+    size_t nDevices = devCfg.isNull() ? 1 : min(devCfg.size(), (size_t)DeviceRegistry::MAX_DEVICES);
+    for(size_t i=0; i<nDevices && !devCfg.isNull(); i++) {
+        devicePins[i].rx = devCfg[i]["rx"] | -1;
+        devicePins[i].tx = devCfg[i]["tx"] | -1;
+        // UART1 default pins are taken by the flash
+        if(i>0 && (devicePins[i].rx<0 || devicePins[i].tx<0)) { nDevices = i; break; }
+    }
+    if(nDevices==0) nDevices = 1;
+    registry.begin(nDevices);
+
+    for(size_t i=0; i<nDevices; i++) {
+        // the device task registers its load once the device is detected
+        deviceTasks[i] = createTask(deviceLoop, TaskId(T_DEVICE0+i), (void*)i, nullptr);
+        readerTasks[i] = createTask(readerLoop, TaskId(T_READER0+i), (void*)i, &readerLoads[i]);
+        registry.getJob(i)->setReaderTask(readerTasks[i]);
+    }
 
+    uploadTask = createTask(uploadLoop, T_UPLOAD, nullptr, &UploadWriter::get().getLoad());
+    UploadWriter::get().setWriterTask(uploadTask);
 
-    xTaskCreatePinnedToCore(deviceLoop, "DeviceTask", 
-        4096, nullptr, 1, &deviceTask, 1); // cpu1 
+    dirTask = createTask(dirLoop, T_DIR, nullptr, &DirCache::get().getLoad());
+    DirCache::get().setLoaderTask(dirTask);
 
-    xTaskCreatePinnedToCore(wifiLoop, "WifiTask", 
-        4096, nullptr, 1, &wifiTask, 1); // cpu1 
-    
+    wifiTask = createTask(wifiLoop, T_WEB, nullptr, nullptr);
+
+    renderTask = createTask(renderLoop, T_RENDER, nullptr, &display.getRenderLoad());
+    display.setRenderTask(renderTask);
     
-    job = Job::getJob();
-    job->add_observer( display );
 
     //dro.config(cfg["menu"].as<JsonObjectConst>() );
 
@@ -131,50 +231,105 @@ void setup() {
     fileChooser.setCallback( [&](bool res, String path){
         if(res) {
             DEBUGF("Starting job %s\n", path.c_str() );
+            Job *job = Job::getJob();
             job->setFile(path);            
             job->start();
             
-            Display::getDisplay()->setScreen(dro); // select file
+            Display::getDisplay()->setScreen(selectedDro()); // select file
         } else {
-            Display::getDisplay()->setScreen(dro); // cancel
+            Display::getDisplay()->setScreen(selectedDro()); // cancel
         }
     } );
 
+    deviceChooser.setCallback( [](bool res, size_t i) {
+        if(res) DeviceRegistry::get().select(i);
+        Display::getDisplay()->setScreen(selectedDro());
+    } );
+
     file.close();
 
-    
+    // input and the console move off core 1, see loop()
+    uiTask = createTask(uiLoop, T_UI, nullptr, &uiLoad);
 }
 
 
 void deviceLoop(void* pvParams) {
-    PrinterSerial.begin(115200);
-    PrinterSerial.setTimeout(1000);
-    dev = DeviceDetector::detectPrinterAttempt(PrinterSerial, 115200, 1); 
-    if(dev==nullptr ) {
-        dev = DeviceDetector::detectPrinter(PrinterSerial);
-    }
+    size_t i = (size_t)pvParams;
+    DeviceRegistry &registry = DeviceRegistry::get();
+    HardwareSerial &serial = *deviceSerials[i];
+    serial.setRxBufferSize(1024);   // holds RX_IDLE_POLL ms of unexpected output at any baud
+    serial.begin(115200, SERIAL_8N1, devicePins[i].rx, devicePins[i].tx);
+    DeviceDetector::DeviceBuffer &buf = registry.getDeviceBuffer(i);
+
+    // the device found last time on this port is probed first; Marlin at 115200 if there was none
+    Preferences prefs;
+    prefs.begin("devices", false);
+    char baudKey[8], typeKey[8];
+    snprintf(baudKey, sizeof(baudKey), "baud%u", (unsigned)i);
+    snprintf(typeKey, sizeof(typeKey), "type%u", (unsigned)i);
+    uint32_t lastBaud = prefs.getUInt(baudKey, 115200);
+    int8_t lastType = prefs.getChar(typeKey, DeviceDetector::TYPE_MARLIN);
+    uint32_t t = millis();
+    GCodeDevice *dev = DeviceDetector::detectPrinter(serial, buf, lastBaud, lastType);
+    DEBUGF("Device %u detected in %u ms\n", (unsigned)i, millis()-t);
+    if(dev->getBaudRate()!=lastBaud) prefs.putUInt(baudKey, dev->getBaudRate());
+    if(DeviceDetector::typeOf(dev)!=lastType) prefs.putChar(typeKey, DeviceDetector::typeOf(dev));
+    prefs.end();
     
-    //GCodeDevice::setDevice(dev);
-    dev->add_observer( *job );
-    dev->add_observer(display);
-    //dev->add_observer(dro);  // dro.setDevice(dev);
-    //dev->add_observer(fileChooser);
-    dev->addReceivedLineHandler( [](const char* d, size_t l) {server.resendDeviceResponse(d,l);} );
+    // only the selected device talks to telnet clients
+    dev->addReceivedLineHandler( [dev](const char* d, size_t l) { 
+        if(GCodeDevice::getDevice()==dev) server.resendDeviceResponse(d,l); 
+    } );
+    dev->setTask(xTaskGetCurrentTaskHandle());
+    const TaskPlacement &tp = taskMap[T_DEVICE0+i];
+    TaskMonitor::get().add(tp.name, tp.core==tskNO_AFFINITY ? -1 : tp.core, tp.priority, &dev->getLoad());
+    registry.setDevice(i, dev);
     dev->begin();
+    dev->enableStatusUpdates();
 
+    DRO *dro;
     if(dev->getType() == "grbl") {
-        dro = new (droBuffer) GrblDRO();
-    } else dro = new (droBuffer) DRO();
+        dro = new (droBuffers[i]) GrblDRO();
+    } else dro = new (droBuffers[i]) DRO();
     dro->begin( );
+    dros[i] = dro;
 
-    display.setScreen(dro);
+    if(registry.getSelectedIndex()==i) display.setScreen(dro);
    
+    Job *job = registry.getJob(i);
     while(1) {
+        job->loop();
         dev->loop();
+        dev->waitForWork(job->hasLinesReady());
     }
     vTaskDelete( NULL );
 }
 
+void readerLoop(void* pvParams) {
+    size_t i = (size_t)pvParams;
+    Job *job = DeviceRegistry::get().getJob(i);
+    while(1) {
+        if(!job->prefetch()) readerLoads[i].notifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        ResumePoint::update(i, job);
+    }
+    vTaskDelete( NULL );
+}
+
+void renderLoop(void* args) {
+    display.renderLoop();
+    vTaskDelete( NULL );
+}
+
+void uploadLoop(void* args) {
+    UploadWriter::get().writerLoop();
+    vTaskDelete( NULL );
+}
+
+void dirLoop(void* args) {
+    DirCache::get().loaderLoop();
+    vTaskDelete( NULL );
+}
+
 void wifiLoop(void* args) {
     server.begin();
     vTaskDelete( NULL );
@@ -185,45 +340,39 @@ void readPots() {
     Display::potVal[1] = analogRead(PIN_POT2);
 }
 
-void loop() {
-    readPots();    
+void uiLoop(void* args) {
+    String s;
+    while(1) {
+        uiLoad.delay(pdMS_TO_TICKS(UI_POLL_MS));
 
-    job->loop();
+        readPots();    
 
-    display.loop();
+        display.loop();
 
-    if(dev==nullptr) return;
+        GCodeDevice *dev = GCodeDevice::getDevice();
+        if(dev==nullptr) continue;
 
-    static String s;
-    while(Serial.available()!=0) {
-        char c = Serial.read();
-        if(c=='\n' || c=='\r') { 
-            if(s.length()>0) DEBUGF("send %s, result: %d\n", s.c_str(), dev->schedulePriorityCommand(s) ); 
-            s=""; 
-            continue; 
+        while(Serial.available()!=0) {
+            char c = Serial.read();
+            if(c=='\n' || c=='\r') { 
+                if(s.length()>0) DEBUGF("send %s, result: %d\n", s.c_str(), dev->schedulePriorityCommand(s) ); 
+                s=""; 
+                continue; 
+            }
+            s += c;
         }
-        s += c;
     }
+    vTaskDelete( NULL );
+}
 
+void loop() {
+    // the Arduino loop task is pinned to core 1, which is left to the first device
+    vTaskDelete( NULL );
 }
 
 
 IRAM_ATTR void encISR() {
-    static int lastV1=0;
-    static unsigned int lastISRTime = millis();
-    if(millis()<lastISRTime+2) return;
-
-    int v1 = digitalRead(PIN_ENC1);
-    int v2 = digitalRead(PIN_ENC2);
-    if(v1==HIGH && lastV1==LOW) {
-        if(v2==HIGH) Display::encVal++; else Display::encVal--;
-    }
-    if(v1==LOW && lastV1==HIGH) {
-        if(v2==LOW) Display::encVal++; else Display::encVal--;
-    }
-    //log_printf("%d, %d\n", v1,v2);
-    //log_printf("%d, %d,  %3d\n", v1,v2,Display::encVal);
-    lastV1 = v1;
+    Display::encoder.onPinChange();
 }
 
 
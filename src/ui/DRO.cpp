@@ -1,5 +1,15 @@
 #include "DRO.h"
 
+#include "DeviceChooser.h"
+
+extern DeviceChooser deviceChooser;
+
+    void DRO::begin() {
+        if(DeviceRegistry::get().size() > 1)
+            menuItems.push_back( MenuItem::simpleItem(6, 'd', [](MenuItem&){  Display::getDisplay()->setScreen(&deviceChooser); }) );
+    }
+
+
 
     void DRO::drawContents() {
         const int LEN = 20;
@@ -23,6 +33,7 @@
         drawAxis('X', dev->getX(), y); y+=h;
         drawAxis('Y', dev->getY(), y); y+=h;
         drawAxis('Z', dev->getZ(), y); y+=h;        
+        axisRows = Display::contentRows(y-3*h-1, 3*h);
 
         y+=5;
         u8g2.setFont( u8g2_font_nokiafc22_tr   );
@@ -53,7 +64,6 @@
         int rangeH = rangeL + l + 2*d;
         if(v<rangeL && var>0    ) { var--; ch=true; }
         if(v>rangeH && var<p.N-1) { var++; ch=true; }
-        if(ch && pot==0) lastJogTime=0;
          if(ch) {
             //S_DEBUGF("changed pot: axis:%d dist:%d, pot%d=%d\n", (int)cAxis, (int)cDist, pot, v);
             setDirty();
@@ -71,15 +81,22 @@
             case Button::ENC_UP:
             case Button::ENC_DOWN: {
                 if(! dev->canJog() ) return;
-                float f=0;
                 float d = distVal(cDist)*arg;
-                if( lastJogTime!=0) { f = d / (millis()-lastJogTime) * 1000*60; };
-                if(f<500) f=500;
-                //S_DEBUGF("jog af %d, dt=%d ms, delta=%d\n", (int)f, millis()-lastJog, arg);
-                bool r = dev->jog( (int)cAxis, d, (int)f );
-                lastJogTime = millis();
+                bool r;
+                JogEngine *je = dev->getJogEngine();
+                const Encoder &enc = Display::encoder;
+                if(je!=nullptr) {
+                    // when the count actually happened, not when the UI got to it
+                    uint32_t at = millis() - (micros() - enc.getLastEventUs()) / 1000;
+                    r = je->onTick( (int)cAxis, d, at );
+                } else {
+                    float f = fabsf(enc.getVelocity()) * distVal(cDist) * 60;
+                    if(f<500) f=500;
+                    //S_DEBUGF("jog af %d, dt=%d ms, delta=%d\n", (int)f, millis()-lastJog, arg);
+                    r = dev->jog( (int)cAxis, d, (int)f );
+                }
                 if(!r) S_DEBUGF("Could not schedule jog\n");
-                setDirty();
+                Display::getDisplay()->invalidate(axisRows);
                 break;
             }
             default: break;
@@ -25,30 +25,20 @@ using JogDist = int;
 class DRO: public Screen {
 public:
 
-    DRO(): nextRefresh(1) {}
+    DRO() {}
     
-    void begin() override {
-        /*
-        menuItems.push_back("oFile...");
-        menuItems.push_back("xReset");
-        menuItems.push_back("uUpdate");
-        */
-    };
-
-    void loop() override {
-        Screen::loop();
-        if(nextRefresh!=0 && millis()>nextRefresh) {
-            nextRefresh = millis() + 500;
-            GCodeDevice *dev = GCodeDevice::getDevice();
-            if (dev!=nullptr) {
-                dev->requestStatusUpdate();
-                //setDirty();
-            }
-        }
-    }
+    /// Adds the device selector to the menu when there is more than one device
+    void begin() override;
 
-    void enableRefresh(bool r) { nextRefresh = r?millis() : 0;  }
-    bool isRefreshEnabled() { return nextRefresh!=0; }
+    // status is polled by the device itself, see GCodeDevice::pollStatus()
+    void enableRefresh(bool r) { 
+        GCodeDevice *dev = GCodeDevice::getDevice();
+        if(dev!=nullptr) dev->enableStatusUpdates(r);
+    }
+    bool isRefreshEnabled() { 
+        GCodeDevice *dev = GCodeDevice::getDevice();
+        return dev!=nullptr && dev->isStatusUpdatesEnabled();
+    }
 
 /*
     void config(JsonObjectConst cfg) {
@@ -86,12 +76,14 @@ private:
 
     //etl::map<String, etl::map<String,String, 10>, 3> allMenuItems;
 
+    /// The axis rows; updated by drawContents()
+    uint16_t getStatusRows() override { return axisRows; }
+
 protected:
 
     JogAxis cAxis;
     JogDist cDist;
-    uint32_t nextRefresh;
-    uint32_t lastJogTime;
+    uint16_t axisRows = Display::CONTENT;
 
     
     static char axisChar(const JogAxis &a) {
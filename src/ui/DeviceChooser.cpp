@@ -0,0 +1,52 @@
+#include "DeviceChooser.h"
+
+
+    void DeviceChooser::drawContents() {
+        U8G2 &u8g2 = Display::u8g2;
+        u8g2.setFont(u8g2_font_5x8_tr);
+        u8g2.setDrawColor(1);
+
+        int y = Display::STATUS_BAR_HEIGHT, h=10;
+        u8g2.drawStr(1, y, "Devices" ); 
+        u8g2.drawHLine(0, y+9, u8g2.getWidth() );
+        y += h;
+
+        DeviceRegistry &reg = DeviceRegistry::get();
+        char str[20];
+        for(size_t i=0; i<reg.size(); i++) {
+            GCodeDevice *dev = reg.getDevice(i);
+            Job *job = reg.getJob(i);
+            if(dev==nullptr) snprintf(str, sizeof(str), "%d ...", (int)i);
+            else if(job->isValid()) snprintf(str, sizeof(str), "%d %s %d%%", (int)i, dev->getType().c_str(), (int)(job->getCompletion()*100) );
+            else snprintf(str, sizeof(str), "%d %s%s", (int)i, dev->getType().c_str(), dev->isInPanic() ? " !" : "" );
+
+            if(i == selLine) {
+                u8g2.setDrawColor( 1 );
+                u8g2.drawBox(0, y-1, u8g2.getWidth(), h);
+                u8g2.setDrawColor( 0 );
+            } else u8g2.setDrawColor( 1 );
+            u8g2.drawStr(1, y, str ); 
+            y += h;
+        }
+    }
+
+
+    void DeviceChooser::onButtonPressed(Button bt, int8_t arg) {
+        size_t n = DeviceRegistry::get().size();
+        switch(bt) {
+            case Button::ENC_UP:
+                if(selLine>0) { selLine--; setDirty(); }
+                break;
+            case Button::ENC_DOWN:
+                if(selLine+1<n) { selLine++; setDirty(); }
+                break;
+            case Button::BT1:
+                if(returnCallback) returnCallback(false, 0);
+                break;
+            case Button::BT2:
+                if(returnCallback) returnCallback(true, selLine);
+                break;
+            default: 
+                break;
+        }
+    }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Screen.h"
+
+#include <functional>
+
+#include "../DeviceRegistry.h"
+
+
+/** Lists the devices in DeviceRegistry with their state and job progress, to select the one the pendant controls */
+class DeviceChooser: public Screen {
+public:
+
+    /// Called with true and the chosen index, or with false when the screen is left without choosing
+    void setCallback(const std::function<void(bool, size_t)> &cb) {
+        returnCallback = cb;
+    }
+
+protected:
+
+    void drawContents() override;
+
+    void onButtonPressed(Button bt, int8_t arg) override;
+
+    void onShow() override { selLine = DeviceRegistry::get().getSelectedIndex(); }
+
+private:
+    std::function<void(bool, size_t)> returnCallback;
+
+    size_t selLine = 0;
+
+};
@@ -11,24 +11,61 @@ Display * Display::inst = nullptr;
 
 bool Display::buttonPressed[3] = {false};
 int Display::potVal[2] = {0};
-int Display::encVal = 0;
+Encoder Display::encoder;
 
 
     Display* Display::getDisplay() { return inst; }
 
     void Display::setScreen(Screen *screen) { 
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
         if(cScreen != nullptr) cScreen->onHide();
         cScreen = screen; 
         if(cScreen != nullptr) cScreen->onShow();
         selMenuItem = 0;
-        dirty=true;
+        xSemaphoreGiveRecursive(lock);
+        invalidate(ALL);
     }
 
 
     void Display::loop() {
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
         processInput();
         if(cScreen!=nullptr) cScreen->loop();
-        draw();
+        xSemaphoreGiveRecursive(lock);
+    }
+
+    void Display::renderLoop() {
+        uint32_t lastFrameAt = 0;
+        while(1) {
+            takeEvents();
+            if(dirty==0) { renderLoad.notifyTake(pdTRUE, portMAX_DELAY); continue; }
+            // whatever gets invalidated until the next frame is due goes into that frame
+            uint32_t since = millis() - lastFrameAt;
+            if(since < frameIntervalMs) renderLoad.delay(pdMS_TO_TICKS(frameIntervalMs - since));
+            lastFrameAt = millis();
+            takeEvents();
+            draw();
+            if(frameIntervalMs!=0 && frameStats.lastFrameUs/1000 > frameIntervalMs) 
+                frameStats.droppedFrames += frameStats.lastFrameUs/1000 / frameIntervalMs;
+        }
+    }
+
+    void Display::takeEvents() {
+        Event e;
+        while(EventBus::getBus().receive(events, e)) {
+            switch(e.topic) {
+                case Topic::DEVICE_STATUS: 
+                case Topic::DEVICE_ERROR: invalidate(STATUS_BAR | screenStatusRows()); break;
+                default: invalidate(STATUS_BAR); break;
+            }
+        }
+    }
+
+    uint16_t Display::screenStatusRows() {
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+        uint16_t rows = cScreen!=nullptr ? cScreen->getStatusRows() : CONTENT;
+        xSemaphoreGiveRecursive(lock);
+        return rows;
     }
 
     constexpr int VISIBLE_MENUS = 6;
@@ -50,13 +87,12 @@ int Display::encVal = 0;
     } 
 
     void Display::processEnc() {
-        static int lastEnc;
-        int v = encVal;
-        if(lastEnc != v) {
-            int8_t dx = (v - lastEnc);
+        int32_t dx = encoder.update();
+        if(dx != 0) {
+            if(dx>127) dx=127; 
+            if(dx<-127) dx=-127;
             if(cScreen!=nullptr) cScreen->onButtonPressed(dx>0 ? Button::ENC_DOWN : Button::ENC_UP, dx);
         }
-        lastEnc = v;
     }
 
     void Display::processButtons() {
@@ -70,8 +106,8 @@ int Display::encVal = 0;
                 if(p) {
                     int menuLen = cScreen->menuItems.size();
                     if(menuLen!=0) {
-                        if(bt==0) { selMenuItem = selMenuItem>0 ? selMenuItem-1 : menuLen-1; ensureSelMenuVisible(); setDirty(); }
-                        if(bt==2) { selMenuItem = (selMenuItem+1) % menuLen; ensureSelMenuVisible(); setDirty(); }
+                        if(bt==0) { selMenuItem = selMenuItem>0 ? selMenuItem-1 : menuLen-1; ensureSelMenuVisible(); invalidate(MENU); }
+                        if(bt==2) { selMenuItem = (selMenuItem+1) % menuLen; ensureSelMenuVisible(); invalidate(MENU); }
                         if(bt==1) {
                             MenuItem& item = cScreen->menuItems[selMenuItem];
                             if(!item.togglalbe) { item.onCmd(item); }
@@ -102,18 +138,103 @@ int Display::encVal = 0;
     }
 
     void Display::draw() {
-        if(!dirty) return;
-        u8g2.clearBuffer();
-        if(cScreen!=nullptr) cScreen->drawContents();
-        drawStatusBar();
-        drawMenu();
+        uint16_t widgets = dirty.exchange(0);
+        if(widgets==0) return;
+        uint32_t t = micros();
+
+        if(!shownValid) widgets = ALL;
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+        // neighbouring dirty rows are drawn together
+        for(int i=0; i<CONTENT_ROWS; ) {
+            if(!(widgets & contentRow(i))) { i++; continue; }
+            int j = i+1;
+            while(j<CONTENT_ROWS && (widgets & contentRow(j))) j++;
+            drawContentRows(i, j);
+            i = j;
+        }
+        if(widgets & STATUS_BAR) drawWidget(STATUS_BAR);
+        if(widgets & MENU) drawWidget(MENU);
+        xSemaphoreGiveRecursive(lock);
+
+        // only this task touches the buffer, the UI can go on while it is sent
+        uint32_t bytes = sendChangedTiles();
+
+        t = micros() - t;
+        FrameStats &f = frameStats;
+        f.frames++;
+        f.lastFrameUs = t;
+        f.avgFrameUs = f.frames==1 ? t : (f.avgFrameUs*7 + t) / 8;
+        if(t > f.maxFrameUs) f.maxFrameUs = t;
+        f.lastSpiBytes = bytes;
+        f.totalSpiBytes += bytes;
+    }
 
+    // Clears and redraws one widget; the clip window keeps it from touching the others
+    void Display::drawWidget(Widget w) {
+        int y0, y1;
+        if(w==STATUS_BAR) { y0 = 0; y1 = STATUS_BAR_HEIGHT; }
+        else { y0 = u8g2.getHeight()-MENU_HEIGHT; y1 = u8g2.getHeight(); }
+        u8g2.setClipWindow(0, y0, u8g2.getWidth(), y1);
+        u8g2.setDrawColor(0);
+        u8g2.drawBox(0, y0, u8g2.getWidth(), y1-y0);
+        u8g2.setDrawColor(1);
+
+        if(w==STATUS_BAR) drawStatusBar(); else drawMenu();
+        u8g2.setMaxClipWindow();
+    }
+
+    // The screen draws all of its content, the clip window drops what is outside the rows
+    void Display::drawContentRows(int first, int last) {
+        int y0 = STATUS_BAR_HEIGHT + first*ROW_HEIGHT;
+        int y1 = STATUS_BAR_HEIGHT + last*ROW_HEIGHT;
+        if(y1 > u8g2.getHeight()-MENU_HEIGHT) y1 = u8g2.getHeight()-MENU_HEIGHT;
+        u8g2.setClipWindow(0, y0, u8g2.getWidth(), y1);
+        u8g2.setDrawColor(0);
+        u8g2.drawBox(0, y0, u8g2.getWidth(), y1-y0);
+        u8g2.setDrawColor(1);
+
+        if(cScreen!=nullptr) cScreen->drawContents();
         //char str[15]; sprintf(str, "%lu", millis() ); u8g2.drawStr(20,110, str);
         //char str[15]; sprintf(str, "%4d %4d", potVal[0], potVal[1] ); u8g2.drawStr(5,110, str);
-        char str[15]; sprintf(str, "%d", encVal ); u8g2.drawStr(5,110, str);
+        { char str[15]; sprintf(str, "%d", encoder.getCount() ); u8g2.setFont(u8g2_font_5x8_tr); u8g2.setDrawColor(1); u8g2.drawStr(5,110, str); }
+        u8g2.setMaxClipWindow();
+    }
 
-        u8g2.sendBuffer();
-        dirty = false;
+    /** 
+     * Sends tiles that differ from what is on the display, row by row. 
+     * The buffer is in physical orientation (U8G2_R3: a logical row of the screen is a physical column),
+     * and in the ST7920's horizontal layout: a tile row is 8 pixel rows of tileWidth bytes.
+     * The ST7920 addresses 16-pixel words, so spans are widened to even tiles.
+     * @return bytes of display data sent
+     */
+    uint32_t Display::sendChangedTiles() {
+        uint8_t *buf = u8g2.getBufferPtr();
+        const int tw = u8g2.getBufferTileWidth(), th = u8g2.getBufferTileHeight();
+        const int rowBytes = tw*8;
+        if((size_t)(rowBytes*th) > sizeof(shownBuffer)) {
+            u8g2.sendBuffer();
+            return rowBytes*th;
+        }
+        uint32_t bytes = 0;
+        for(int ty=0; ty<th; ty++) {
+            uint8_t *row = buf + ty*rowBytes;
+            uint8_t *shownRow = shownBuffer + ty*rowBytes;
+            int first = -1, last = -1;
+            for(int tx=0; tx<tw; tx++) {
+                bool changed = !shownValid;
+                for(int r=0; r<8 && !changed; r++) changed = row[r*tw+tx] != shownRow[r*tw+tx];
+                if(changed) { if(first<0) first = tx; last = tx; }
+            }
+            if(first<0) continue;
+            first &= ~1;
+            last |= 1;
+            if(last >= tw) last = tw-1;
+            u8g2.updateDisplayArea(first, ty, last-first+1, 1);
+            bytes += (last-first+1)*8;
+        }
+        memcpy(shownBuffer, buf, sizeof(shownBuffer));
+        shownValid = true;
+        return bytes;
     }
 
     void Display::drawStatusBar() {
@@ -6,11 +6,18 @@
 
 #include <etl/vector.h>
 #include <functional>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 
 
 #include "../devices/GCodeDevice.h"
 #include "../InetServer.h"
 #include "../Job.h"
+#include "../EventBus.h"
+#include "../TaskMonitor.h"
+#include "Encoder.h"
 
 
 struct MenuItem {
@@ -33,41 +40,81 @@ enum class Button {
 
 class Screen;
 
-class Display : public JobObserver, public DeviceObserver, public WebServerObserver {
+class Display {
 public:
     static U8G2 &u8g2;
     static bool buttonPressed[3];
-    static int encVal;
+    static Encoder encoder;
     static int potVal[2];
     static const int STATUS_BAR_HEIGHT = 9;
+    static const int MENU_HEIGHT = 10;
+    static const int ROW_HEIGHT = 10;
+    static const int CONTENT_ROWS = 11;     ///< of ROW_HEIGHT between the status bar and the menu, the last one shorter
+
+    /// Parts of the screen that are redrawn and sent separately; the content is split into rows (see contentRows())
+    enum Widget: uint16_t { STATUS_BAR = 1, MENU = 2, CONTENT = ((1<<CONTENT_ROWS)-1) << 2, ALL = CONTENT|STATUS_BAR|MENU };
+
+    static uint16_t contentRow(int i) { return (uint16_t)(4 << i); }
+    /// Content rows covering pixels y..y+h-1 of the screen
+    static uint16_t contentRows(int y, int h) {
+        if(h<=0 || y+h <= STATUS_BAR_HEIGHT) return 0;
+        int first = y < STATUS_BAR_HEIGHT ? 0 : (y - STATUS_BAR_HEIGHT) / ROW_HEIGHT;
+        int last = (y + h - 1 - STATUS_BAR_HEIGHT) / ROW_HEIGHT;
+        if(last >= CONTENT_ROWS) last = CONTENT_ROWS-1;
+        uint16_t rows = 0;
+        for(int i=first; i<=last; i++) rows |= contentRow(i);
+        return rows;
+    }
+
+    struct FrameStats {
+        uint32_t frames;
+        uint32_t lastFrameUs;   ///< drawing and sending
+        uint32_t avgFrameUs;
+        uint32_t maxFrameUs;
+        uint32_t lastSpiBytes;  ///< display data sent, without ST7920 framing
+        uint32_t totalSpiBytes;
+        uint32_t droppedFrames; ///< frames missed at max FPS because drawing took longer
+        uint32_t coalesced;     ///< invalidations merged into an already pending frame
+    };
 
     Display() { 
         assert(inst==nullptr);
         inst=this; 
+        lock = xSemaphoreCreateRecursiveMutexStatic(&lockBuf);
     }
 
-    void setDirty(bool fdirty=true) { dirty=fdirty; }
-
-    void notification(JobStatusEvent e) override {
-        setDirty();
-    }
-    void notification(const DeviceStatusEvent &e) override {
-        setDirty();
-    }
-    void notification(const WebServerStatusEvent &e) override {
-        setDirty();
+    void setDirty(bool fdirty=true) { if(fdirty) invalidate(ALL); }
+    /** Marks widgets for redraw; may be called from any task */
+    void invalidate(uint16_t widgets) { 
+        if(dirty.fetch_or(widgets) != 0) frameStats.coalesced++;
+        else if(renderTask!=nullptr) xTaskNotifyGive(renderTask);
     }
 
-    void begin() { dirty=true; }
+    void begin() { dirty=ALL; }
 
+    /** Handles input and runs the current screen; call from the UI task */
     void loop();
 
-    void draw();
+    /** 
+     * Draws whatever is dirty, at most maxFps times per second; never returns. 
+     * Run it in its own low priority task, so that a slow SPI transfer only delays the next frame.
+     */
+    void renderLoop();
+    /// Also subscribes the render task to job, device and web server events
+    void setRenderTask(TaskHandle_t task) { 
+        renderTask = task; 
+        events = EventBus::getBus().subscribe(EventBus::ALL_TOPICS, task);
+    }
+    void setMaxFps(uint8_t fps) { frameIntervalMs = fps==0 ? 0 : 1000/fps; }
 
     void setScreen(Screen *screen) ;    
 
     static Display *getDisplay();
 
+    const FrameStats & getFrameStats() { return frameStats; }
+    /// CPU use of the render task
+    TaskLoad & getRenderLoad() { return renderLoad; }
+
 
 private:
 
@@ -75,7 +122,21 @@ private:
 
     Screen *cScreen;
 
-    bool dirty;
+    std::atomic<uint16_t> dirty{ALL};
+
+    // screens are changed by input in the UI task and drawn in the render task
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lockBuf;
+    TaskHandle_t renderTask = nullptr;
+    EventBus::Subscriber events = EventBus::NONE;
+    uint32_t frameIntervalMs = 50;
+
+    /// copy of what the display shows, to send only changed tiles
+    uint8_t shownBuffer[128*64/8];
+    bool shownValid = false;
+
+    FrameStats frameStats = {};
+    TaskLoad renderLoad;
 
     int selMenuItem=0;
 
@@ -85,8 +146,16 @@ private:
     void processButtons();
     void processPot();   
 
+    void takeEvents();
+    void draw();
     void drawStatusBar();
     void drawMenu() ;
+    void drawWidget(Widget w);
+    /// Content rows first..last-1, with one drawContents() call
+    void drawContentRows(int first, int last);
+    /// Content rows of the current screen that follow device status
+    uint16_t screenStatusRows();
+    uint32_t sendChangedTiles();
 
     void ensureSelMenuVisible();
 
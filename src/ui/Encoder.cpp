@@ -0,0 +1,74 @@
+#include "Encoder.h"
+
+// (previous AB << 2) | current AB: +1 for 00->01->11->10->00, -1 backwards, 0 for no change or a skipped state.
+// Read from the ISR, so kept in DRAM: flash may be unreachable then
+static const DRAM_ATTR int8_t QUADRATURE[16] = {
+     0, +1, -1,  0,
+    -1,  0,  0, +1,
+    +1,  0,  0, -1,
+     0, -1, +1,  0
+};
+
+void Encoder::begin(uint8_t a, uint8_t b) {
+    pinA = a;
+    pinB = b;
+    pinMode(pinA, INPUT_PULLUP);
+    pinMode(pinB, INPUT_PULLUP);
+    state = (digitalRead(pinA)<<1) | digitalRead(pinB);
+    sub = 0;
+}
+
+IRAM_ATTR void Encoder::onPinChange() {
+    uint8_t cur = (digitalRead(pinA)<<1) | digitalRead(pinB);
+    uint8_t prev = state;
+    if(cur==prev) return;
+    state = cur;
+    int8_t d = QUADRATURE[(prev<<2) | cur];
+    if(d==0) { invalid++; return; }
+
+    int8_t s = sub + d;
+    if(s >= TRANSITIONS_PER_COUNT || s <= -TRANSITIONS_PER_COUNT) {
+        int8_t delta = s>0 ? 1 : -1;
+        sub = 0;
+        count.store(count.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        Event *e = events.back();
+        if(e==nullptr) { dropped++; return; }
+        e->delta = delta;
+        e->us = micros();
+        events.push();
+    } else sub = s;
+}
+
+void Encoder::addEvent(const Event &e) {
+    uint32_t dt = e.us - lastUs;
+    if(dt==0) dt = 1;
+    float v = e.delta * 1e6f / dt;
+    float prevV = velocity;
+    if(dt > STOP_US) {
+        // first count after a stop: the interval says nothing about the speed
+        velocity = e.delta * 1e6f / STOP_US;
+        acceleration = 0;
+    } else {
+        // weigh by interval, so a burst of fast counts is not averaged away by slow ones
+        float a = dt < 20000 ? 0.3f : 0.6f;
+        velocity = velocity*(1-a) + v*a;
+        acceleration = acceleration*(1-a) + (velocity-prevV) * 1e6f / dt * a;
+    }
+    lastUs = e.us;
+}
+
+int32_t Encoder::update() {
+    Event *e;
+    while( (e = events.front()) != nullptr ) {
+        addEvent(*e);
+        events.pop();
+    }
+    if(velocity!=0 && micros() - lastUs > STOP_US) {
+        velocity = 0;
+        acceleration = 0;
+    }
+    int32_t c = getCount();
+    int32_t dx = c - lastCount;
+    lastCount = c;
+    return dx;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "../SpscRing.h"
+
+/**
+ * Quadrature decoder for the jog wheel.
+ *
+ * onPinChange() runs in the interrupt of both pins and decodes every transition 
+ * with a state table, so contact bounce cancels out instead of being filtered by time.
+ * Each count (2 transitions, a detent) is pushed with its time into a ring;
+ * update() drains it in the UI task and estimates velocity and acceleration.
+ * getCount() is exact even when the ring overflows.
+ */
+class Encoder {
+public:
+
+    static const int8_t TRANSITIONS_PER_COUNT = 2;
+    static const uint32_t STOP_US = 150000;    ///< velocity is 0 after this long without counts
+
+    struct Event {
+        int8_t delta;
+        uint32_t us;
+    };
+
+    void begin(uint8_t pinA, uint8_t pinB);
+
+    /** Call from the pin change interrupt of both pins */
+    void onPinChange();
+
+    int32_t getCount() const { return count.load(std::memory_order_relaxed); }
+
+    /** Drains the event ring into the estimator; UI task only. @return counts since the last call */
+    int32_t update();
+
+    /// counts/s, signed
+    float getVelocity() const { return velocity; }
+    /// counts/s^2
+    float getAcceleration() const { return acceleration; }
+    /// micros() of the last count
+    uint32_t getLastEventUs() const { return lastUs; }
+
+    uint32_t getDroppedEvents() const { return dropped; }
+    uint32_t getInvalidTransitions() const { return invalid; }
+
+private:
+    uint8_t pinA, pinB;
+    volatile uint8_t state;
+    volatile int8_t sub;
+    std::atomic<int32_t> count{0};
+    SpscRing<Event, 64> events;
+    volatile uint32_t dropped = 0;
+    volatile uint32_t invalid = 0;
+
+    // consumer side
+    int32_t lastCount = 0;
+    uint32_t lastUs = 0;
+    float velocity = 0;
+    float acceleration = 0;
+
+    void addEvent(const Event &e);
+};
@@ -1,46 +1,59 @@
 #include "FileChooser.h"
 
 
-    bool FileChooser::isGCode(const String &s) {
-        int p = s.lastIndexOf('.');
-        if(p==-1) return true; // files without extension can be printed
-        String ext = s.substring(p+1); ext.toLowerCase();
-        return (ext=="gcode" || ext=="nc" || ext=="gc" || ext=="gco");
-    }
-
-    void FileChooser::loadDirContents(File newDir, int startingIndex) {
-        if(!newDir) return;
-        //FC_DEBUGF("loadDirContents dir %s\n", newDir.name() );
-        if( !cDir || strcmp(cDir.name(), newDir.name())!=0 ) {
-            cDir = newDir;
-            //FC_DEBUGF("loadDirContents opening new dir %s\n", cDir.name() );
-        }
+    void FileChooser::loadDirContents(const String &path) {
+        //FC_DEBUGF("loadDirContents dir %s\n", path.c_str() );
+        dirPath = path;
         topLine = 0;
-        File file;
-        files.clear();
-        cDir.rewindDirectory();
-        int i=0;
-        while ( file = cDir.openNextFile() ) {
-            if(i>=startingIndex && i<startingIndex+MAX_FILES) {
-                String name = file.name();
-                int p = name.lastIndexOf('/');  if(p>=0) name = name.substring(p+1);
+        selLine = 0;
+        DirCache::get().open(dirPath);
+        loadPage();
+    }
 
-                if(file.isDirectory() ) { 
-                    name += "/"; 
-                    files.push_back(name);
-                } else {
-                    if(isGCode(name) ) { files.push_back(name); }
-                }
-                
-                //if(i==MAX_FILES) break;
-                S_DEBUGF("loadDirContents: file %s\n", name.c_str() );
-            }
-            i++;
-            file.close();
-        }
+    void FileChooser::loadPage() {
+        DirCache &cache = DirCache::get();
+        if(cache.getPath() != dirPath) cache.open(dirPath); // the web listing took the cache over
+        cache.want(KINDS, topLine, VISIBLE_FILES);
+        copyPage();
+    }
 
-        S_DEBUGF("loadDirContents: file count %d\n", files.size() );
+    void FileChooser::copyPage() {
+        DirCache &cache = DirCache::get();
+        cacheVersion = cache.getVersion();
+        fileCount = cache.count(KINDS);
+        large = cache.isLarge();
+        if(cache.isComplete() && selLine >= (int)fileCount) selLine = fileCount==0 ? 0 : fileCount-1;
+        if(topLine > selLine) topLine = selLine;
         setDirty();
+        // the window is still read, or the web moved it: keep the lines we have, if they are still the ones shown
+        bool covered = cache.covers(KINDS, topLine, VISIBLE_FILES);
+        if(covered || filesTop != topLine) files.clear();
+        filesTop = topLine;
+        if(!covered) return;
+        cache.list(KINDS, DirCache::BY_NAME, topLine, VISIBLE_FILES, [this](const char* name, const DirCache::Entry &e) {
+            String n = name;
+            if(e.kind & DirCache::DIR) n += "/";
+            files.push_back(n);
+        });
+        S_DEBUGF("copyPage: %d of %d files from %d\n", files.size(), fileCount, topLine );
+    }
+
+    void FileChooser::setLinesDirty(int a, int b) {
+        // as in drawContents(): a header line, then the files, each highlighted from one pixel above
+        const int y0 = Display::STATUS_BAR_HEIGHT + LINE_HEIGHT - 1;
+        setDirtyRows(y0 + (a-topLine)*LINE_HEIGHT, LINE_HEIGHT);
+        setDirtyRows(y0 + (b-topLine)*LINE_HEIGHT, LINE_HEIGHT);
+    }
+
+    void FileChooser::loop() {
+        DirCache &cache = DirCache::get();
+        if(cache.getVersion() == cacheVersion) return;
+        if(cache.getPath() != dirPath) {
+            // the web listing took the cache over; keep showing what we have until the user scrolls
+            cacheVersion = cache.getVersion();
+            return;
+        }
+        copyPage();
     }
 
     void FileChooser::drawContents() {
@@ -49,21 +62,23 @@
         u8g2.setDrawColor(1);
         u8g2.setFont(u8g2_font_5x8_tr);
 
-        const char* t = cDir.name();
-        int y = Display::STATUS_BAR_HEIGHT, h=10;
-        u8g2.drawStr(1, y, t ); 
+        int y = Display::STATUS_BAR_HEIGHT, h=LINE_HEIGHT;
+        u8g2.drawStr(1, y, dirPath.c_str() ); 
+        // too many to sort: in directory order, marked with '*'
+        char count[12];
+        snprintf(count, sizeof(count), large ? "*%u" : "%u", (unsigned)fileCount);
+        u8g2.drawStr(u8g2.getWidth() - u8g2.getStrWidth(count) - 1, y, count);
         u8g2.drawHLine(0, y+9, u8g2.getWidth() );
         y += h;
 
-        const int visibleLines = min(VISIBLE_FILES, files.size()-topLine);
-        for(int i=0; i<visibleLines; i++) {
+        for(int i=0; i<(int)files.size(); i++) {
             if(i+topLine == selLine) {
                 u8g2.setDrawColor( 1 );
                 u8g2.drawBox(0, y-1, u8g2.getWidth(), h);
                 u8g2.setDrawColor( 0 );
             } else u8g2.setDrawColor( 1 );
             
-            u8g2.drawStr(1, y, files[topLine+i].c_str() ); 
+            u8g2.drawStr(1, y, files[i].c_str() ); 
             y += h;
         }
         //DEBUGF("FileChooser::drawContents, topLine:%d, selLine:%d\n", topLine, selLine);
@@ -72,22 +87,29 @@
 
     void FileChooser::onButtonPressed(Button bt, int8_t arg) {
         switch(bt) {
-            case Button::ENC_UP:
-                if(selLine>0) {
+            case Button::ENC_UP: {
+                // one line per count, fast spins arrive as several counts at once
+                int top = topLine, sel = selLine;
+                for(int i=arg; i<0 && selLine>0; i++) {
                     selLine--;
                     if(selLine < topLine) {topLine -= VISIBLE_FILES-1; if(topLine<0)topLine=0;}
-                    setDirty();
                 }
+                if(topLine != top) loadPage();
+                else if(selLine != sel) setLinesDirty(sel, selLine);
                 break;
-            case Button::ENC_DOWN:
-                if(selLine<files.size()-1) {
+            }
+            case Button::ENC_DOWN: {
+                int top = topLine, sel = selLine;
+                for(int i=arg; i>0 && selLine<(int)fileCount-1; i--) {
                     selLine++;
-                    if(selLine >= topLine+VISIBLE_FILES) topLine += VISIBLE_FILES-1;
-                    setDirty();
+                    if(selLine >= topLine+(int)VISIBLE_FILES) topLine += VISIBLE_FILES-1;
                 }
+                if(topLine != top) loadPage();
+                else if(selLine != sel) setLinesDirty(sel, selLine);
                 break;
+            }
             case Button::BT1: {
-                String newPath = cDir.name();
+                String newPath = dirPath;
                 if(newPath=="/") {
                     S_DEBUGF("FileChooser::onButtonPressed(BT2): quit\n" );
                     if(returnCallback) returnCallback(false, "");
@@ -95,25 +117,24 @@
                     S_DEBUGF("FileChooser::onButtonPressed(BT2): moving up from %s\n", newPath.c_str() );
                     int p = newPath.lastIndexOf("/");
                     if(p==0) newPath="/"; else newPath = newPath.substring(0, p);
-                    selLine = 0;
-                    loadDirContents(SD.open(newPath) );
+                    loadDirContents(newPath);
                 }
                 break;
             }
             case Button::BT2: {
-                String file = files[selLine];
-                S_DEBUGF("FileChooser::onButtonPressed(BT1): dir='%s'  file='%s'\n", cDir.name(), file.c_str() );
+                if(selLine-topLine >= (int)files.size()) break;  // still loading
+                String file = files[selLine-topLine];
+                S_DEBUGF("FileChooser::onButtonPressed(BT1): dir='%s'  file='%s'\n", dirPath.c_str(), file.c_str() );
                 bool isDir = file.charAt(file.length()-1) == '/';
                 if(isDir) {
                     file = file.substring(0, file.length()-1 );
                 }
-                String cDirName = cDir.name(); 
+                String cDirName = dirPath; 
                 if(cDirName.charAt(cDirName.length()-1) != '/' ) cDirName+="/";
                 String newPath = cDirName+file;
                 if(isDir) {
-                    S_DEBUGF("cdir is %s, file is %s\n", cDir.name(), file.c_str() );
-                    selLine = 0;
-                    loadDirContents(SD.open(newPath), 0);
+                    S_DEBUGF("cdir is %s, file is %s\n", dirPath.c_str(), file.c_str() );
+                    loadDirContents(newPath);
                 } else {
                     if(returnCallback) returnCallback(true, newPath); else  DEBUGF("no  ret callback\n");
                 }
@@ -6,14 +6,15 @@
 #include <functional>
 #include <etl/vector.h>
 
+#include "../DirCache.h"
+
 
 class FileChooser: public Screen {
 public:
 
     void begin() override {
-        //const char* t = cDir.name();
-        //FC_DEBUGF("loadDirContents: cdir is %s\n", t);
-        loadDirContents(SD.open("/") );
+        //FC_DEBUGF("loadDirContents: cdir is %s\n", dirPath.c_str());
+        loadDirContents("/");
 
         //menuItems.push_back("xClose");
         //menuItems.push_back("yOpen");
@@ -21,7 +22,11 @@ public:
     }
     
 
-    //void loop() override {    }
+    /// Follows the directory as DirCache reads it
+    void loop() override;
+    void onShow() override { loadPage(); }
+    /// Nothing here follows the device
+    uint16_t getStatusRows() override { return 0; }
 
     void setCallback(const std::function<void(bool, String)> &cb) {
         returnCallback = cb;
@@ -32,15 +37,24 @@ private:
     
     int selLine;
     int topLine;
-    File cDir;
-    static const size_t MAX_FILES = 50;
+    String dirPath;
     static const size_t VISIBLE_FILES = 11;
-    //String files[MAX_FILES];
-    etl::vector<String, MAX_FILES> files;
-
-    void loadDirContents(File newDir, int startingIndex=0) ;
+    static const int LINE_HEIGHT = 10;
+    static const uint8_t KINDS = DirCache::DIR | DirCache::GCODE;
+    size_t fileCount;
+    bool large;
+    uint32_t cacheVersion;
+    /// names of the visible lines, from topLine on; directories end with '/'
+    etl::vector<String, VISIBLE_FILES> files;
+    int filesTop = -1;      ///< topLine of files
 
-    bool isGCode(const String &s);
+    void loadDirContents(const String &path);
+    /// Takes the cache for the visible lines and copies them
+    void loadPage();
+    /// Copies the visible lines from DirCache, if it has them
+    void copyPage();
+    /// Redraws the rows of two lines, e.g. the old and new selection
+    void setLinesDirty(int a, int b);
 
 protected:
 
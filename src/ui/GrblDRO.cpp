@@ -6,7 +6,6 @@
 extern FileChooser fileChooser;
 
     void GrblDRO::begin() {
-        DRO::begin();
         menuItems.push_back( MenuItem::simpleItem(0, 'o', [](MenuItem&){  Display::getDisplay()->setScreen(&fileChooser); }) );
         menuItems.push_back( MenuItem::simpleItem(0, 'p', [this](MenuItem& m){   
             Job *job = Job::getJob();
@@ -28,6 +27,7 @@ extern FileChooser fileChooser;
           [](MenuItem&){  GCodeDevice::getDevice()->scheduleCommand("M3 S1"); },
           [](MenuItem&){  GCodeDevice::getDevice()->scheduleCommand("M5"); } 
         } );
+        DRO::begin();
     };
 
 
@@ -73,7 +73,7 @@ extern FileChooser fileChooser;
         u8g2.drawStr(0, y, str);  y+=7;
         
         float m = distVal(cDist);
-        const char* stat = dev->isInPanic() ? dev->getLastResponse().c_str() : dev->getStatus().c_str();
+        const char* stat = dev->isInPanic() ? dev->getLastResponse().c_str() : dev->getStatus();
         
         snprintf(str, LEN, m<1 ? "%c x%.1f %s" : "%c x%.0f %s", axisChar(cAxis), m, stat );
         u8g2.drawStr(0, y, str);  
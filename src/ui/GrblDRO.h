@@ -5,6 +5,9 @@ class GrblDRO : public DRO {
 public:
     void begin() override ;
 
+    /// Offsets, feed, spindle and state come with the status report too
+    uint16_t getStatusRows() override { return Display::CONTENT; }
+
 protected:
     
     void drawContents() override;
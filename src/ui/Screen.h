@@ -23,7 +23,13 @@ public:
 
     Screen() : firstDisplayedMenuItem(0) {}
 
-    void setDirty(bool fdirty=true) { Display::getDisplay()->setDirty(fdirty); }
+    /// Screen contents and its menu changed
+    void setDirty(bool fdirty=true) { if(fdirty) Display::getDisplay()->invalidate(Display::CONTENT | Display::MENU); }
+    /// Only the content at pixel rows y..y+h-1 changed
+    void setDirtyRows(int y, int h) { Display::getDisplay()->invalidate(Display::contentRows(y, h)); }
+
+    /// Content rows that show device status, redrawn with every status report
+    virtual uint16_t getStatusRows() { return Display::CONTENT; }
 
     virtual void begin() { setDirty(true); }
 